@@ -0,0 +1,40 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "AllocationCounter.h"
+
+#include <cstdlib>
+
+#include "lexbor/core/lexbor.h"
+
+namespace {
+    thread_local std::uint64_t allocations = 0;
+
+    void *countedMalloc(std::size_t size) {
+        ++allocations;
+        return std::malloc(size);
+    }
+
+    void *countedRealloc(void *ptr, std::size_t size) {
+        ++allocations;
+        return std::realloc(ptr, size);
+    }
+
+    void *countedCalloc(std::size_t count, std::size_t size) {
+        ++allocations;
+        return std::calloc(count, size);
+    }
+}
+
+bool AllocationCounter::install() {
+    return lexbor_memory_setup(countedMalloc, countedRealloc, countedCalloc, std::free) == LXB_STATUS_OK;
+}
+
+std::uint64_t AllocationCounter::threadAllocations() {
+    return allocations;
+}
+
+void AllocationCounter::count() {
+    ++allocations;
+}
@@ -0,0 +1,42 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_ALLOCATIONCOUNTER_H
+#define WEEBCENTRAL_DOWNLOAD_ALLOCATIONCOUNTER_H
+
+#include <cstdint>
+
+/**
+ * Counts heap allocations per thread.
+ *
+ * Only the programs that link AllocationHooks.cpp count C++ allocations: it replaces the global
+ * operator new, which is why the downloader leaves it out unless it is built with
+ * WEEBCENTRAL_COUNT_ALLOCATIONS. install also routes lexbor's allocations through the counter.
+ * The counts are kept per thread, so a stage can measure the allocations of its own work by
+ * taking the difference of two readings, undisturbed by other threads.
+ */
+namespace AllocationCounter {
+    /**
+     * Routes lexbor's allocations through the counter. Must be called before the first lexbor
+     * object is created.
+     *
+     * @return Returns true if lexbor accepted the allocator; otherwise, false.
+     */
+    bool install();
+
+    /**
+     * Returns how many allocations the calling thread has made so far.
+     *
+     * @return The number of allocations, counting operator new where it is replaced and, once
+     *         installed, lexbor.
+     */
+    std::uint64_t threadAllocations();
+
+    /**
+     * Counts one allocation made by the calling thread. Called by the replaced operator new.
+     */
+    void count();
+}
+
+#endif //WEEBCENTRAL_DOWNLOAD_ALLOCATIONCOUNTER_H
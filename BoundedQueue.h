@@ -0,0 +1,99 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_BOUNDEDQUEUE_H
+#define WEEBCENTRAL_DOWNLOAD_BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+/**
+ * A fixed capacity queue for handing work between threads.
+ *
+ * push blocks while the queue is full and pop blocks while it is empty, so a fast
+ * producer can never run further ahead of its consumer than the capacity. Closing the
+ * queue wakes every waiting thread: pushes are rejected from then on, and pops drain the
+ * remaining items before reporting that the queue is finished.
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity) : capacity(capacity == 0 ? 1 : capacity) {
+    }
+
+    /**
+     * Adds an item, waiting for space if the queue is full.
+     *
+     * @param item The item to add.
+     * @return Returns true if the item was added; false if the queue was closed.
+     */
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+
+        if (closed) {
+            return false;
+        }
+
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    /**
+     * Removes the oldest item, waiting for one if the queue is empty.
+     *
+     * @return The item, or an empty optional once the queue is closed and drained.
+     */
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return closed || !items.empty(); });
+
+        if (items.empty()) {
+            return std::nullopt;
+        }
+
+        T item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return item;
+    }
+
+    // Marks the end of the stream; no more items can be pushed
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    // Closes the queue and throws away the items still waiting in it
+    void abort() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        items.clear();
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    // Empties the queue and opens it again, for a new stream once nobody uses it any more
+    void reopen() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = false;
+        items.clear();
+    }
+
+private:
+    const std::size_t capacity;
+    std::deque<T> items;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_BOUNDEDQUEUE_H
@@ -0,0 +1,303 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "CbzWriter.h"
+
+#include <algorithm>
+#include <array>
+#include <ctime>
+#include <memory>
+#include <limits>
+
+#include "Storage.h"
+
+namespace {
+    // Signatures of the zip records that are written
+    constexpr std::uint32_t localHeaderSignature = 0x04034b50;
+    constexpr std::uint32_t centralHeaderSignature = 0x02014b50;
+    constexpr std::uint32_t endOfCentralDirectorySignature = 0x06054b50;
+
+    constexpr std::uint16_t versionNeeded = 10; // Stored entries need nothing newer than zip 1.0
+    constexpr std::uint16_t utf8NameFlag = 1 << 11; // Entry names are UTF-8
+    constexpr std::uint16_t storedMethod = 0;
+
+    // Lookup table for the CRC-32 that zip uses (reflected polynomial 0xEDB88320)
+    constexpr std::array<std::uint32_t, 256> crcTable = [] {
+        std::array<std::uint32_t, 256> table{};
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+            }
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    // Pass the result of the previous block as crc to continue a CRC over several blocks
+    std::uint32_t crc32(std::string_view data, std::uint32_t crc = 0) {
+        crc ^= 0xFFFFFFFFu;
+        for (unsigned char c: data) {
+            crc = crcTable[(crc ^ c) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    // Offset of the CRC field in a local header
+    constexpr std::uint64_t localHeaderCrcOffset = 14;
+
+    // Size of the blocks an entry is copied from its file in
+    constexpr std::size_t copyBlockSize = 64 * 1024;
+
+    // Moves to a position in a file that may be past what a long can address
+    bool seekTo(FILE *file, std::uint64_t position) {
+#ifdef _WIN32
+        return _fseeki64(file, static_cast<__int64>(position), SEEK_SET) == 0;
+#else
+        return fseeko(file, static_cast<off_t>(position), SEEK_SET) == 0;
+#endif
+    }
+
+    // Zip stores every number little endian, whatever the machine
+    void put16(std::string &out, std::uint16_t value) {
+        out.push_back(static_cast<char>(value & 0xFF));
+        out.push_back(static_cast<char>(value >> 8));
+    }
+
+    void put32(std::string &out, std::uint32_t value) {
+        put16(out, static_cast<std::uint16_t>(value & 0xFFFF));
+        put16(out, static_cast<std::uint16_t>(value >> 16));
+    }
+}
+
+CbzWriter::~CbzWriter() {
+    abort();
+}
+
+bool CbzWriter::open(const std::filesystem::path &path) {
+    abort();
+
+    this->path = path;
+    temp_path = path;
+    temp_path += ".part";
+
+    entries.clear();
+    offset = 0;
+    failed = false;
+
+    file = fopen(temp_path.string().c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    // Every entry is stamped with the time the archive was started, in the local time zone
+    // as zip expects
+    std::time_t now = std::time(nullptr);
+    std::tm local{};
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    dos_time = static_cast<std::uint16_t>(local.tm_hour << 11 | local.tm_min << 5 | local.tm_sec / 2);
+    dos_date = static_cast<std::uint16_t>(std::max(local.tm_year - 80, 0) << 9 | (local.tm_mon + 1) << 5 |
+                                          local.tm_mday);
+
+    return true;
+}
+
+bool CbzWriter::add(std::string_view name, std::string_view data) {
+    if (!file || failed) {
+        return false;
+    }
+
+    if (!fits(name, data.size())) {
+        return false;
+    }
+
+    Entry entry;
+    entry.name = std::string(name);
+    entry.crc = crc32(data);
+    entry.size = static_cast<std::uint32_t>(data.size());
+    entry.offset = static_cast<std::uint32_t>(offset);
+
+    if (!write_local_header(entry) || fwrite(data.data(), 1, data.size(), file) != data.size()) {
+        failed = true;
+        return false;
+    }
+
+    offset += data.size();
+    entries.push_back(std::move(entry));
+    return true;
+}
+
+bool CbzWriter::add_file(std::string_view name, const std::filesystem::path &source) {
+    if (!file || failed) {
+        return false;
+    }
+
+    std::error_code ec;
+    const std::uintmax_t size = std::filesystem::file_size(source, ec);
+    if (ec || !fits(name, size)) {
+        failed = true;
+        return false;
+    }
+
+    std::unique_ptr<FILE, int (*)(FILE *)> input(fopen(source.string().c_str(), "rb"), fclose);
+    if (!input) {
+        failed = true;
+        return false;
+    }
+
+    Entry entry;
+    entry.name = std::string(name);
+    entry.size = static_cast<std::uint32_t>(size);
+    entry.offset = static_cast<std::uint32_t>(offset);
+
+    // The CRC is not known until the data has been copied, so it is written as 0 for now
+    if (!write_local_header(entry)) {
+        failed = true;
+        return false;
+    }
+
+    std::array<char, copyBlockSize> block;
+    std::uint64_t copied = 0;
+    while (std::size_t read = fread(block.data(), 1, block.size(), input.get())) {
+        entry.crc = crc32(std::string_view(block.data(), read), entry.crc);
+        if (fwrite(block.data(), 1, read, file) != read) {
+            failed = true;
+            return false;
+        }
+        copied += read;
+    }
+
+    // A file that changed while it was copied does not match the sizes in the header
+    std::string crc;
+    put32(crc, entry.crc);
+    if (ferror(input.get()) || copied != size ||
+        !seekTo(file, entry.offset + localHeaderCrcOffset) || fwrite(crc.data(), 1, crc.size(), file) != crc.size() ||
+        !seekTo(file, offset + size)) {
+        failed = true;
+        return false;
+    }
+
+    offset += size;
+    entries.push_back(std::move(entry));
+    return true;
+}
+
+bool CbzWriter::close() {
+    if (!file) {
+        return false;
+    }
+
+    const std::uint64_t directory_offset = offset;
+
+    std::string directory;
+    for (const Entry &entry: entries) {
+        put32(directory, centralHeaderSignature);
+        put16(directory, versionNeeded); // Version made by
+        put16(directory, versionNeeded);
+        put16(directory, utf8NameFlag);
+        put16(directory, storedMethod);
+        put16(directory, dos_time);
+        put16(directory, dos_date);
+        put32(directory, entry.crc);
+        put32(directory, entry.size);
+        put32(directory, entry.size);
+        put16(directory, static_cast<std::uint16_t>(entry.name.size()));
+        put16(directory, 0); // Extra field length
+        put16(directory, 0); // Comment length
+        put16(directory, 0); // Disk number
+        put16(directory, 0); // Internal attributes
+        put32(directory, 0); // External attributes
+        put32(directory, entry.offset);
+        directory.append(entry.name);
+    }
+
+    std::string end;
+    put32(end, endOfCentralDirectorySignature);
+    put16(end, 0); // This disk
+    put16(end, 0); // Disk holding the central directory
+    put16(end, static_cast<std::uint16_t>(entries.size()));
+    put16(end, static_cast<std::uint16_t>(entries.size()));
+    put32(end, static_cast<std::uint32_t>(directory.size()));
+    put32(end, static_cast<std::uint32_t>(directory_offset));
+    put16(end, 0); // Comment length
+
+    if (failed || directory_offset + directory.size() > std::numeric_limits<std::uint32_t>::max() ||
+        !write(directory) || !write(end)) {
+        abort();
+        return false;
+    }
+
+    bool written = Storage::syncFile(file);
+    written = fclose(file) == 0 && written;
+    file = nullptr;
+
+    std::error_code ec;
+    if (written) {
+        std::filesystem::rename(temp_path, path, ec);
+    }
+
+    if (!written || ec) {
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+
+    return true;
+}
+
+void CbzWriter::abort() {
+    if (!file) {
+        return;
+    }
+
+    fclose(file);
+    file = nullptr;
+
+    std::error_code ec;
+    std::filesystem::remove(temp_path, ec);
+}
+
+bool CbzWriter::fits(std::string_view name, std::uint64_t size) {
+    // Plain zip cannot address more than this; chapters never get close
+    constexpr std::uint64_t max_offset = std::numeric_limits<std::uint32_t>::max();
+    if (entries.size() >= std::numeric_limits<std::uint16_t>::max() || name.size() > 0xFFFF ||
+        offset + 30 + name.size() + size > max_offset) {
+        failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool CbzWriter::write_local_header(const Entry &entry) {
+    // The sizes are known up front, so the local header is complete and needs no data descriptor
+    std::string header;
+    header.reserve(30 + entry.name.size());
+    put32(header, localHeaderSignature);
+    put16(header, versionNeeded);
+    put16(header, utf8NameFlag);
+    put16(header, storedMethod);
+    put16(header, dos_time);
+    put16(header, dos_date);
+    put32(header, entry.crc);
+    put32(header, entry.size); // Compressed size
+    put32(header, entry.size); // Uncompressed size
+    put16(header, static_cast<std::uint16_t>(entry.name.size()));
+    put16(header, 0); // Extra field length
+    header.append(entry.name);
+
+    return write(header);
+}
+
+bool CbzWriter::write(const std::string &bytes) {
+    if (fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+        return false;
+    }
+
+    offset += bytes.size();
+    return true;
+}
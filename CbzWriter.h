@@ -0,0 +1,107 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_CBZWRITER_H
+#define WEEBCENTRAL_DOWNLOAD_CBZWRITER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Writes a chapter as a CBZ archive: a zip file whose entries are stored uncompressed.
+ *
+ * Entries are appended one after another as they are added, and the central directory follows
+ * when the archive is closed. The archive is written to path + ".part" and only renamed to path
+ * once closed, so a chapter is never left behind half written under its final name. An entry
+ * copied from a file is streamed through in small blocks, and its CRC is filled into the local
+ * header once the copy is done.
+ *
+ * Only plain zip is written, so an archive holds at most 65535 entries and 4 GiB, which is far
+ * more than any chapter.
+ */
+class CbzWriter {
+public:
+    CbzWriter() = default;
+
+    // Owns the open file
+    CbzWriter(const CbzWriter &) = delete;
+
+    CbzWriter &operator=(const CbzWriter &) = delete;
+
+    // Removes an archive that was opened but never closed
+    ~CbzWriter();
+
+    /**
+     * Starts a new archive.
+     *
+     * @param path The final path of the archive.
+     * @return Returns true if the temporary file was created; otherwise, false.
+     */
+    bool open(const std::filesystem::path &path);
+
+    /**
+     * Appends an entry to the archive.
+     *
+     * @param name The entry's file name inside the archive (UTF-8).
+     * @param data The entry's contents.
+     * @return Returns true if the entry was written; otherwise, false.
+     */
+    bool add(std::string_view name, std::string_view data);
+
+    /**
+     * Appends an entry with the contents of a file, without reading the whole file into memory.
+     *
+     * @param name The entry's file name inside the archive (UTF-8).
+     * @param source The file holding the entry's contents.
+     * @return Returns true if the entry was written; otherwise, false.
+     */
+    bool add_file(std::string_view name, const std::filesystem::path &source);
+
+    /**
+     * Writes the central directory, syncs the archive to disk and renames it to its final path.
+     *
+     * @return Returns true if the archive is complete; otherwise, false, in which case the
+     *         temporary file is removed.
+     */
+    bool close();
+
+    /**
+     * Abandons the archive and removes its temporary file.
+     */
+    void abort();
+
+private:
+    // What the central directory needs to know about an entry written earlier
+    struct Entry {
+        std::string name;
+        std::uint32_t crc = 0;
+        std::uint32_t size = 0;
+        std::uint32_t offset = 0; // Of the entry's local header
+    };
+
+    FILE *file = nullptr;
+    std::filesystem::path path;
+    std::filesystem::path temp_path;
+
+    std::vector<Entry> entries;
+    std::uint64_t offset = 0; // Bytes written so far
+    std::uint16_t dos_time = 0;
+    std::uint16_t dos_date = 0;
+
+    bool failed = false; // A write failed, so the archive cannot be completed
+
+    // Checks that an entry still fits in plain zip, marking the archive failed if it does not
+    bool fits(std::string_view name, std::uint64_t size);
+
+    // Writes the local header of an entry that starts at the current offset
+    bool write_local_header(const Entry &entry);
+
+    bool write(const std::string &bytes);
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_CBZWRITER_H
@@ -0,0 +1,606 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "ChapterPipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "CbzWriter.h"
+#include "ChapterScheduler.h"
+#include "Metrics.h"
+#include "PageExtractor.h"
+#include "Storage.h"
+#include "Url.h"
+#include "Utils.h"
+
+namespace {
+    // End of the line printed for a finished image, e.g. " (failed: not a JPEG image)"
+    std::string imageOutcome(const ImageDownload &download) {
+        if (download.success) {
+            return "";
+        }
+        if (download.problem.empty()) {
+            return " (failed)";
+        }
+        return " (failed: " + download.problem + ")";
+    }
+}
+
+ChapterPipeline::ChapterPipeline(HttpClient &http_client, std::size_t workers, ParserMode parser_mode,
+                                 OutputFormat output_format, std::size_t queue_capacity)
+    : http_client(http_client),
+      workers(workers == 0 ? 1 : workers),
+      output_format(output_format),
+      extractor(parser_mode),
+      parse_queue(queue_capacity),
+      download_queue(queue_capacity),
+      finalize_queue(queue_capacity) {
+}
+
+bool ChapterPipeline::run(std::vector<Series> &series) {
+    this->series = &series;
+    failed_series.assign(series.size(), false);
+    active_workers = workers;
+
+    // The queues were closed at the end of the previous run
+    parse_queue.reopen();
+    download_queue.reopen();
+    finalize_queue.reopen();
+
+    std::thread fetch_thread(&ChapterPipeline::fetch_stage, this);
+    std::thread parse_thread(&ChapterPipeline::parse_stage, this);
+
+    std::vector<std::thread> download_threads;
+    for (std::size_t i = 0; i < workers; ++i) {
+        download_threads.emplace_back(&ChapterPipeline::download_stage, this, i + 1);
+    }
+
+    finalize_stage();
+
+    fetch_thread.join();
+    parse_thread.join();
+    for (std::thread &thread: download_threads) {
+        thread.join();
+    }
+
+    return std::ranges::find(failed_series, true) == failed_series.end();
+}
+
+// Stage 1: decide whether the chapter is needed and fetch and parse its image list page
+void ChapterPipeline::fetch_stage() {
+    Metrics *metrics = http_client.get_metrics();
+    if (metrics) {
+        metrics->name_thread("fetch");
+    }
+
+    ChapterScheduler scheduler(*series);
+    std::size_t series_index = 0;
+    std::size_t chapter_index = 0;
+
+    while (scheduler.next(series_index, chapter_index)) {
+        // Nothing after a failed chapter of a series is downloaded
+        if (is_failed(series_index)) {
+            scheduler.drop(series_index);
+            continue;
+        }
+
+        Metrics::Label metrics_label((*series)[series_index].title);
+
+        ChapterJob job;
+        job.series_index = series_index;
+        job.index = chapter_index;
+        job.chapter = (*series)[series_index].chapters[chapter_index];
+        job.folder = (*series)[series_index].folder / Utils::sanitizeFolderName(job.chapter.name);
+
+        // The folder itself is only created by the download stage, so an aborted run never
+        // leaves empty folders behind for chapters that were only prefetched
+        std::error_code ec;
+        if (output_format == OutputFormat::cbz) {
+            // An archive only appears under its final name once it is complete
+            job.archive = job.folder;
+            job.archive += ".cbz";
+            job.skipped = std::filesystem::exists(job.archive, ec);
+        } else if (std::filesystem::exists(job.folder, ec)) {
+            // A folder without a manifest was downloaded by an older version; its image list is
+            // fetched and checked against the files it holds. One whose manifest cannot be read is
+            // downloaded again, since nothing says it is complete.
+            if (Storage::loadChapterManifest(job.folder, job.manifest)) {
+                job.resumed = !job.manifest.complete;
+                job.skipped = job.manifest.complete;
+            } else if (std::filesystem::exists(job.folder / Storage::manifestFileName, ec)) {
+                std::lock_guard<std::mutex> lock(output_mutex);
+                std::cerr << "  Warning: Could not read the manifest of " << job.folder
+                        << ", downloading the chapter again" << std::endl;
+            } else {
+                job.adopted = true;
+            }
+        }
+
+        // A resumed chapter already knows its images from the manifest
+        if (!job.skipped && !job.resumed) {
+            std::string images_uri = base_url + std::string(job.chapter.url) +
+                                     "/images?is_prev=False&current_page=1&reading_style=long_strip";
+
+            // The page is parsed chunk by chunk while it downloads, never held as a whole
+            bool downloaded = http_client.download_html_stream(
+                images_uri,
+                [this] { return extractor.begin(PageExtractor::Page::chapter_images); },
+                [this](std::string_view chunk) { return extractor.feed(chunk); });
+
+            if (!downloaded) {
+                job.error = "Failed to download HTML";
+            } else if (!extractor.finish()) {
+                job.error = "Failed to parse chapter images list HTML";
+            } else {
+                if (metrics) {
+                    metrics->record_stage("parse", job.chapter.name, extractor.last_page_time());
+                }
+                if (!extractor.mismatch.empty()) {
+                    std::lock_guard<std::mutex> lock(output_mutex);
+                    std::cerr << "  Warning: Parsers disagree on the images of " << job.chapter.name << ": "
+                            << extractor.mismatch << std::endl;
+                }
+
+                // The URIs are copied once, straight into the manifest that keeps them
+                job.manifest.images.resize(extractor.image_uris.size());
+                for (std::size_t j = 0; j < extractor.image_uris.size(); ++j) {
+                    job.manifest.images[j].url = extractor.image_uris[j];
+                }
+            }
+        }
+
+        if (!parse_queue.push(std::move(job))) {
+            break;
+        }
+    }
+
+    parse_queue.close();
+}
+
+// Stage 2: turn the image list into the chapter's manifest
+void ChapterPipeline::parse_stage() {
+    if (Metrics *metrics = http_client.get_metrics()) {
+        metrics->name_thread("parse");
+    }
+
+    while (std::optional<ChapterJob> next = parse_queue.pop()) {
+        ChapterJob &job = *next;
+
+        if (!job.skipped && !job.resumed && job.error.empty()) {
+            if (job.manifest.images.empty()) {
+                job.error = "Could not get image URIs for chapter: " + std::string(job.chapter.name);
+            }
+
+            for (ManifestImage &image: job.manifest.images) {
+                image.filename = Utils::sanitizeFolderName(Url::filename(image.url));
+            }
+        }
+
+        if (!download_queue.push(std::move(job))) {
+            break;
+        }
+    }
+
+    download_queue.close();
+}
+
+// Stage 3: create the chapter folder and download its missing images
+void ChapterPipeline::download_stage(std::size_t worker) {
+    Metrics *metrics = http_client.get_metrics();
+    if (metrics) {
+        metrics->name_thread("download " + std::to_string(worker));
+    }
+
+    while (std::optional<ChapterJob> next = download_queue.pop()) {
+        ChapterJob &job = *next;
+
+        // Chapters prefetched before their series failed are dropped
+        if (is_failed(job.series_index)) {
+            continue;
+        }
+
+        Metrics::Label metrics_label((*series)[job.series_index].title);
+        const std::string label = series_label(job);
+
+        {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::cout << "  " << label << "[" << (job.index + 1) << "/"
+                    << (*series)[job.series_index].chapters.size() << "] " << job.chapter.name << " -> "
+                    << job.chapter.url << std::endl;
+
+            if (job.skipped && !job.archive.empty()) {
+                std::cout << "    Chapter archive " << job.archive << " exists, skipping." << std::endl;
+            } else if (job.skipped) {
+                std::cout << "    Chapter folder " << job.folder << " exists, skipping." << std::endl;
+            }
+        }
+
+        // An archive is written straight into the series folder
+        const bool needs_folder = !job.skipped && job.archive.empty();
+
+        if (needs_folder && job.error.empty()) {
+            try {
+                std::filesystem::create_directories(job.folder);
+            } catch (const std::filesystem::filesystem_error &e) {
+                job.error = "Could not create folder: " + job.folder.string() + "\n" + e.what();
+            }
+        }
+
+        // Images already in a folder from an older version are kept if they pass the image check
+        if (needs_folder && job.error.empty() && job.adopted) {
+            Metrics::Span span(metrics, "adopt", job.chapter.name);
+            Storage::adoptChapterFolder(job.folder, job.manifest, http_client.get_trailer_check());
+        }
+
+        // Record the expected images before downloading any, so an interrupted run can resume
+        if (needs_folder && job.error.empty()) {
+            Metrics::Span span(metrics, "manifest", job.chapter.name);
+            if (!Storage::saveChapterManifest(job.folder, job.manifest)) {
+                job.error = "Could not write manifest in folder: " + job.folder.string();
+            }
+        }
+
+        if (!job.error.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(output_mutex);
+                std::cerr << "    Error: " << label << job.error << std::endl;
+            }
+
+            mark_failed(job.series_index);
+            continue;
+        }
+
+        if (job.skipped) {
+            if (!finalize_queue.push(std::move(job))) {
+                break;
+            }
+            continue;
+        }
+
+        {
+            Metrics::Span span(metrics, "chapter", job.chapter.name);
+            if (job.archive.empty()) {
+                download_folder(job, label);
+            } else {
+                download_archive(job, label);
+            }
+        }
+
+        if (!finalize_queue.push(std::move(job))) {
+            break;
+        }
+    }
+
+    // The last worker to finish ends the stream for the finalize stage
+    if (--active_workers == 0) {
+        finalize_queue.close();
+    }
+}
+
+void ChapterPipeline::download_folder(ChapterJob &job, const std::string &label) {
+    // Only download the images that are missing or do not match their recorded size
+    const std::size_t missing = job.resumed
+                                    ? Storage::verifyChapterManifest(job.folder, job.manifest)
+                                    : static_cast<std::size_t>(std::ranges::count(job.manifest.images, false,
+                                                                                  &ManifestImage::done));
+
+    {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        if (job.adopted) {
+            std::cout << "    Checked chapter folder " << job.folder << " from an older version: " << missing
+                    << " of " << job.manifest.images.size() << " images missing" << std::endl;
+        } else if (job.resumed) {
+            const auto corrupt = std::ranges::count_if(job.manifest.images, &ManifestImage::corrupt);
+            std::cout << "    Resuming chapter folder " << job.folder << ": " << missing << " of "
+                    << job.manifest.images.size() << " images missing";
+            if (corrupt > 0) {
+                std::cout << " (" << corrupt << " corrupt last time)";
+            }
+            std::cout << std::endl;
+        } else {
+            std::cout << "    Created chapter folder: " << job.folder << std::endl;
+        }
+    }
+
+    for (std::size_t j = 0; j < job.manifest.images.size(); ++j) {
+        const ManifestImage &image = job.manifest.images[j];
+        if (image.done) {
+            continue;
+        }
+
+        ImageDownload download;
+        download.url = image.url;
+        download.output_path = (job.folder / image.filename).string();
+        job.downloads.push_back(std::move(download));
+        job.download_images.push_back(j);
+    }
+
+    // The manifest is rewritten after this many finished images or this much time, and once more
+    // at the end, rather than after every image. An image finished since the last write is found
+    // missing and downloaded again if the run is interrupted.
+    constexpr std::size_t manifest_save_images = 16;
+    constexpr auto manifest_save_interval = std::chrono::seconds(2);
+
+    std::size_t unsaved_images = 0;
+    auto manifest_saved = std::chrono::steady_clock::now();
+
+    // A failed write is tried again with the next batch and at the end
+    bool manifest_written = true;
+    auto save_manifest = [&] {
+        Metrics::Span span(http_client.get_metrics(), "manifest", job.chapter.name);
+        manifest_written = Storage::saveChapterManifest(job.folder, job.manifest);
+        if (!manifest_written) {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::cerr << "    Warning: " << label << "Could not write manifest in folder: " << job.folder
+                    << std::endl;
+        }
+        unsaved_images = 0;
+        manifest_saved = std::chrono::steady_clock::now();
+    };
+
+    // Download the chapter's images concurrently, recording each one in the manifest as it finishes
+    const std::size_t image_uris_count = job.downloads.size();
+    std::size_t images_completed = 0;
+    job.images_success = http_client.download_images(job.downloads, [&](std::size_t j) {
+        const ImageDownload &download = job.downloads[j];
+
+        // Images that kept arriving corrupt are recorded too, so they can be told apart from
+        // ones that were never attempted
+        ManifestImage &image = job.manifest.images[job.download_images[j]];
+        if (download.success) {
+            std::error_code ec;
+            image.size = std::filesystem::file_size(download.output_path, ec);
+            image.done = !ec;
+            image.corrupt = false;
+        } else {
+            image.corrupt = !download.problem.empty();
+            job.corrupt_images += image.corrupt ? 1 : 0;
+        }
+
+        if (download.success || image.corrupt) {
+            ++unsaved_images;
+        }
+        if (unsaved_images >= manifest_save_images ||
+            (unsaved_images > 0 && std::chrono::steady_clock::now() - manifest_saved >= manifest_save_interval)) {
+            save_manifest();
+        }
+
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cout << "    " << label << "[" << ++images_completed << "/" << image_uris_count << "] "
+                << download.url << " -> "
+                << download.output_path << imageOutcome(download) << std::endl;
+    });
+
+    if (unsaved_images > 0 || !manifest_written) {
+        save_manifest();
+    }
+
+    // The finished images must be on record, or the next run cannot tell what is left to download
+    if (!manifest_written) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cerr << "    Error: " << label << "Could not write manifest in folder: " << job.folder << std::endl;
+        job.images_success = false;
+    }
+}
+
+void ChapterPipeline::download_archive(ChapterJob &job, const std::string &label) {
+    CbzWriter archive;
+    if (!archive.open(job.archive)) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cerr << "    Error: " << label << "Could not create archive: " << job.archive << std::endl;
+        job.images_success = false;
+        return;
+    }
+
+    // Images that do not fit the memory budget are staged in a folder next to the archive. A run
+    // that was killed leaves its staged images behind, so the folder is emptied first.
+    std::filesystem::path staging = job.archive;
+    staging += ".parts";
+
+    std::error_code ec;
+    std::filesystem::remove_all(staging, ec);
+    std::filesystem::create_directories(staging, ec);
+    if (ec) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cerr << "    Error: " << label << "Could not create folder: " << staging << std::endl;
+        job.images_success = false;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cout << "    Writing chapter archive: " << job.archive << std::endl;
+    }
+
+    // An unfinished archive cannot be resumed, so every image is downloaded. Images are kept in
+    // memory while the memory budget allows, and staged otherwise.
+    for (std::size_t j = 0; j < job.manifest.images.size(); ++j) {
+        ImageDownload download;
+        download.url = job.manifest.images[j].url;
+        download.output_path = (staging / job.manifest.images[j].filename).string();
+        download.in_memory = true;
+        download.staged = true;
+        job.downloads.push_back(std::move(download));
+        job.download_images.push_back(j);
+    }
+
+    MemoryBudget *memory_budget = http_client.get_memory_budget();
+
+    // Gives back the memory of an image, or removes its staged file, once it is not needed any more
+    auto drop_image = [memory_budget](ImageDownload &download) {
+        if (download.in_memory) {
+            if (memory_budget) {
+                memory_budget->release(download.body.size());
+            }
+            std::string().swap(download.body);
+        } else {
+            std::error_code ec;
+            std::filesystem::remove(download.output_path, ec);
+            std::filesystem::remove(download.output_path + ".part", ec);
+        }
+    };
+
+    // Images are written to the archive in page order, whatever order they finish in. One that
+    // finishes early waits, in memory or in its staged file, until every image before it has
+    // been written.
+    const std::size_t image_uris_count = job.downloads.size();
+    std::size_t images_completed = 0;
+    std::size_t next_entry = 0;
+    bool archive_written = true;
+    Metrics *metrics = http_client.get_metrics();
+    job.images_success = http_client.download_images(job.downloads, [&](std::size_t j) {
+        while (archive_written && next_entry < job.downloads.size() && job.downloads[next_entry].success) {
+            ImageDownload &ready = job.downloads[next_entry];
+            const std::string &filename = job.manifest.images[next_entry].filename;
+            Metrics::Span span(metrics, "archive", filename);
+            archive_written = ready.in_memory
+                                  ? archive.add(filename, ready.body)
+                                  : archive.add_file(filename, ready.output_path);
+            drop_image(ready);
+            ++next_entry;
+        }
+
+        // An archive keeps no manifest, so only the series index learns of images that kept
+        // arriving corrupt
+        const ImageDownload &download = job.downloads[j];
+        if (!download.success && !download.problem.empty()) {
+            ++job.corrupt_images;
+        }
+
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cout << "    " << label << "[" << ++images_completed << "/" << image_uris_count << "] "
+                << download.url << " -> "
+                << (job.archive / job.manifest.images[j].filename).string() << imageOutcome(download) << std::endl;
+    });
+
+    // Whatever could not be written is dropped; the chapter starts over on the next run
+    for (std::size_t j = next_entry; j < job.downloads.size(); ++j) {
+        drop_image(job.downloads[j]);
+    }
+
+    // Removed before the archive appears, so a complete chapter never leaves staged images behind
+    std::filesystem::remove_all(staging, ec);
+
+    // Only a complete archive is kept; the chapter is downloaded again on the next run otherwise
+    bool archive_closed = false;
+    if (job.images_success && archive_written) {
+        Metrics::Span span(metrics, "archive", job.chapter.name);
+        archive_closed = archive.close();
+    }
+
+    if (job.images_success && !archive_closed) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cerr << "    Error: " << label << "Could not write archive: " << job.archive << std::endl;
+        job.images_success = false;
+    }
+}
+
+// Stage 4: mark finished chapters complete in their manifest and series index
+void ChapterPipeline::finalize_stage() {
+    Metrics *metrics = http_client.get_metrics();
+    if (metrics) {
+        metrics->name_thread("finalize");
+    }
+
+    // Indexes are saved at most this often while the run goes on, and once more at the end
+    constexpr auto index_save_interval = std::chrono::seconds(5);
+
+    std::vector<bool> index_dirty(series->size(), false);
+    std::vector<std::chrono::steady_clock::time_point> index_saved(series->size());
+
+    auto save_index = [&](std::size_t series_index) {
+        Series &job_series = (*series)[series_index];
+        Metrics::Label metrics_label(job_series.title);
+        Metrics::Span span(metrics, "index");
+        if (!Storage::saveSeriesIndex(job_series.folder, job_series.index)) {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::cerr << "    Warning: Could not write the chapter index of " << job_series.title << std::endl;
+        }
+        index_dirty[series_index] = false;
+        index_saved[series_index] = std::chrono::steady_clock::now();
+    };
+
+    while (std::optional<ChapterJob> next = finalize_queue.pop()) {
+        ChapterJob &job = *next;
+
+        Metrics::Label metrics_label((*series)[job.series_index].title);
+
+        if (!job.skipped) {
+            // An archive is complete by being there, and has no manifest
+            job.manifest.complete = job.images_success;
+            if (job.manifest.complete && job.archive.empty()) {
+                Metrics::Span span(metrics, "manifest", job.chapter.name);
+                if (!Storage::saveChapterManifest(job.folder, job.manifest)) {
+                    std::lock_guard<std::mutex> lock(output_mutex);
+                    std::cerr << "    Warning: Could not mark chapter complete: " << series_label(job)
+                            << job.chapter.name << std::endl;
+                }
+            }
+
+            if (!job.images_success) {
+                std::lock_guard<std::mutex> lock(output_mutex);
+                std::cerr << "    Warning: Some images could not be downloaded for chapter: " << series_label(job)
+                        << job.chapter.name;
+                if (job.corrupt_images > 0) {
+                    std::cerr << ", " << job.corrupt_images << " of them corrupt";
+                }
+                std::cerr << " (they will be retried on the next run)" << std::endl;
+            }
+        }
+
+        // Skipped chapters are complete too, so the next sync does not look at their folder or
+        // archive again
+        Series &job_series = (*series)[job.series_index];
+        const std::string_view chapter_id = Url::chapterId(job.chapter.url);
+        if (!chapter_id.empty()) {
+            IndexedChapter &indexed = job_series.index.chapters[std::string(chapter_id)];
+            indexed.name = job.chapter.name;
+            indexed.complete = job.skipped || job.images_success;
+            indexed.corrupt = !indexed.complete && job.corrupt_images > 0;
+            index_dirty[job.series_index] = true;
+        }
+
+        if (index_dirty[job.series_index] &&
+            std::chrono::steady_clock::now() - index_saved[job.series_index] >= index_save_interval) {
+            save_index(job.series_index);
+        }
+    }
+
+    for (std::size_t i = 0; i < series->size(); ++i) {
+        if (index_dirty[i]) {
+            save_index(i);
+        }
+    }
+}
+
+void ChapterPipeline::set_base_url(const std::string &base_url) {
+    this->base_url = base_url;
+}
+
+PageExtractor::Stats ChapterPipeline::parser_stats() const {
+    return extractor.stats();
+}
+
+void ChapterPipeline::mark_failed(std::size_t series_index) {
+    std::lock_guard<std::mutex> lock(failed_mutex);
+    failed_series[series_index] = true;
+}
+
+bool ChapterPipeline::is_failed(std::size_t series_index) {
+    std::lock_guard<std::mutex> lock(failed_mutex);
+    return failed_series[series_index];
+}
+
+std::string ChapterPipeline::series_label(const ChapterJob &job) const {
+    if (series->size() < 2) {
+        return {};
+    }
+
+    return "[" + (*series)[job.series_index].title + "] ";
+}
@@ -0,0 +1,129 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_CHAPTERPIPELINE_H
+#define WEEBCENTRAL_DOWNLOAD_CHAPTERPIPELINE_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BoundedQueue.h"
+#include "HttpClient.h"
+#include "PageExtractor.h"
+#include "models/ChapterJob.h"
+#include "models/Options.h"
+#include "models/Series.h"
+
+/**
+ * Downloads the chapters of one or more series as a staged pipeline.
+ *
+ * Each chapter passes through four stages connected by bounded queues: list fetch (download the
+ * /images page, extracting the image URIs as it arrives), parse (turn the image URIs into the
+ * chapter's manifest), image download (create the chapter folder and download the images, or stream
+ * them into the chapter's archive) and finalize. While the images of one chapter are downloading,
+ * the image lists of the next chapters are already being fetched and parsed, but never more than
+ * the queue capacity ahead. The image download stage runs on a pool of worker threads that is
+ * shared by all series, and chapters of different series are interleaved by a ChapterScheduler.
+ */
+class ChapterPipeline {
+public:
+    /**
+     * @param http_client The client used for every request of the pipeline.
+     * @param workers How many chapters may download their images at the same time.
+     * @param parser_mode How the image list pages are parsed.
+     * @param output_format Whether chapters are written as folders or as .cbz archives.
+     * @param queue_capacity How many chapters each stage may run ahead of the next one.
+     */
+    explicit ChapterPipeline(HttpClient &http_client, std::size_t workers = 1,
+                             ParserMode parser_mode = ParserMode::dom,
+                             OutputFormat output_format = OutputFormat::folder, std::size_t queue_capacity = 2);
+
+    /**
+     * Downloads the chapters of the given series.
+     *
+     * Chapters whose manifest marks them complete are skipped. Chapters with an incomplete
+     * manifest, and folders from older versions that have none, only download the images that are
+     * missing or broken, and chapters whose manifest cannot be read are downloaded again. When
+     * writing archives, chapters whose archive exists are skipped and any other chapter is
+     * downloaded in full. If a chapter's image list cannot be fetched or its folder cannot be
+     * created, the remaining chapters of that series are dropped; other series carry on.
+     *
+     * Only the pending chapters of each series are processed. The outcome of each one is
+     * recorded in its series' index, which is saved to the series folder as the run goes on.
+     *
+     * The pipeline can be run again once run has returned, and keeps the buffers of its
+     * extractor from one run to the next.
+     *
+     * @param series The series to download, with their folders, chapter lists and indexes.
+     * @return Returns true if every chapter was processed; false if any series stopped on an error.
+     */
+    bool run(std::vector<Series> &series);
+
+    /**
+     * Sets the origin that image list pages are requested from.
+     *
+     * @param base_url The origin, e.g. "https://weebcentral.com".
+     */
+    void set_base_url(const std::string &base_url);
+
+    /**
+     * Returns the allocations made while extracting the image lists. Only meaningful after run
+     * has returned.
+     *
+     * @return The statistics of the list fetch stage's extractor.
+     */
+    PageExtractor::Stats parser_stats() const;
+
+private:
+    HttpClient &http_client;
+    const std::size_t workers;
+    const OutputFormat output_format;
+    std::string base_url = "https://weebcentral.com";
+
+    // Used by the list fetch stage for every image list page, so its buffers are reused
+    PageExtractor extractor;
+
+    BoundedQueue<ChapterJob> parse_queue;
+    BoundedQueue<ChapterJob> download_queue;
+    BoundedQueue<ChapterJob> finalize_queue;
+
+    std::vector<Series> *series = nullptr;
+
+    // Series that stopped on an error, guarded by failed_mutex
+    std::vector<bool> failed_series;
+    std::mutex failed_mutex;
+
+    // Download workers still running; the last one to finish closes the finalize queue
+    std::atomic<std::size_t> active_workers{0};
+
+    // Serialises console output from the stage threads
+    std::mutex output_mutex;
+
+    void fetch_stage();
+
+    void parse_stage();
+
+    // Runs on each of the download workers, numbered from 1
+    void download_stage(std::size_t worker);
+
+    // Downloads the missing images of a chapter into its folder, recording them in its manifest
+    void download_folder(ChapterJob &job, const std::string &label);
+
+    // Downloads every image of a chapter and writes them to its archive in page order
+    void download_archive(ChapterJob &job, const std::string &label);
+
+    // Runs on the calling thread; the only stage that touches the series indexes
+    void finalize_stage();
+
+    void mark_failed(std::size_t series_index);
+
+    bool is_failed(std::size_t series_index);
+
+    // Prefix identifying a chapter's series in the output when several series are downloaded
+    std::string series_label(const ChapterJob &job) const;
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_CHAPTERPIPELINE_H
@@ -0,0 +1,30 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "ChapterScheduler.h"
+
+ChapterScheduler::ChapterScheduler(const std::vector<Series> &series)
+    : series(series),
+      next_chapter(series.size(), 0) {
+}
+
+bool ChapterScheduler::next(std::size_t &series_index, std::size_t &chapter_index) {
+    // Look at each series at most once, starting with the one whose turn it is
+    for (std::size_t checked = 0; checked < series.size(); ++checked) {
+        const std::size_t candidate = (turn + checked) % series.size();
+
+        if (next_chapter[candidate] < series[candidate].pending_chapters.size()) {
+            series_index = candidate;
+            chapter_index = series[candidate].pending_chapters[next_chapter[candidate]++];
+            turn = (candidate + 1) % series.size();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ChapterScheduler::drop(std::size_t series_index) {
+    next_chapter[series_index] = series[series_index].pending_chapters.size();
+}
@@ -0,0 +1,48 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_CHAPTERSCHEDULER_H
+#define WEEBCENTRAL_DOWNLOAD_CHAPTERSCHEDULER_H
+
+#include <cstddef>
+#include <vector>
+
+#include "models/Series.h"
+
+/**
+ * Decides the order in which the chapters of several series are downloaded.
+ *
+ * Only the pending chapters of each series (new or incomplete ones) are handed out. They
+ * are handed out round-robin between the series that still have chapters left, so
+ * a long series does not hold up the others and every series makes progress at the same
+ * pace. Within a series the chapters keep their order. A series can be dropped, e.g. after
+ * one of its chapters failed, and is then skipped from the next turn on.
+ */
+class ChapterScheduler {
+public:
+    explicit ChapterScheduler(const std::vector<Series> &series);
+
+    /**
+     * Picks the next chapter to download.
+     *
+     * @param series_index Receives the index of the chapter's series.
+     * @param chapter_index Receives the index of the chapter within its series.
+     * @return Returns true if a chapter was picked; false once every chapter was handed out.
+     */
+    bool next(std::size_t &series_index, std::size_t &chapter_index);
+
+    /**
+     * Stops handing out the remaining chapters of a series.
+     *
+     * @param series_index The series to drop.
+     */
+    void drop(std::size_t series_index);
+
+private:
+    const std::vector<Series> &series;
+    std::vector<std::size_t> next_chapter; // Per series, the next pending chapter to hand out
+    std::size_t turn = 0; // Series whose turn it is
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_CHAPTERSCHEDULER_H
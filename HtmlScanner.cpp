@@ -0,0 +1,587 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "HtmlScanner.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+namespace {
+    constexpr std::size_t npos = std::string_view::npos;
+
+    bool isAsciiAlpha(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    bool isAsciiAlnum(char c) {
+        return isAsciiAlpha(c) || (c >= '0' && c <= '9');
+    }
+
+    bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+    }
+
+    char toLower(char c) {
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(),
+                                                  [](char x, char y) { return toLower(x) == toLower(y); });
+    }
+
+    // Elements whose contents are text up to their end tag, never markup
+    bool isRawTextElement(std::string_view name) {
+        return name == "script" || name == "style" || name == "title" || name == "textarea";
+    }
+
+    void appendUtf8(std::uint32_t code_point, std::string &out) {
+        // NUL, surrogates and values out of range are replaced, as an HTML parser does
+        if (code_point == 0 || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF)) {
+            code_point = 0xFFFD;
+        }
+
+        if (code_point < 0x80) {
+            out += static_cast<char>(code_point);
+        } else if (code_point < 0x800) {
+            out += static_cast<char>(0xC0 | (code_point >> 6));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        } else if (code_point < 0x10000) {
+            out += static_cast<char>(0xE0 | (code_point >> 12));
+            out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code_point >> 18));
+            out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+    }
+
+    // Finds the end tag of a raw text element, "</name" followed by a delimiter; returns the
+    // position of its '<', or npos
+    std::size_t findRawTextEnd(std::string_view input, std::size_t pos, std::string_view name) {
+        for (std::size_t lt = input.find("</", pos); lt != npos; lt = input.find("</", lt + 1)) {
+            std::size_t after = lt + 2 + name.size();
+            if (after >= input.size()) {
+                break;
+            }
+
+            char c = input[after];
+            if (equalsIgnoreCase(input.substr(lt + 2, name.size()), name) && (isSpace(c) || c == '/' || c == '>')) {
+                return lt;
+            }
+        }
+
+        return npos;
+    }
+}
+
+void HtmlScanner::begin() {
+    pending.clear();
+    raw_text_element.clear();
+    on_begin();
+}
+
+void HtmlScanner::feed(std::string_view chunk) {
+    pending.append(chunk);
+    scan(false);
+}
+
+void HtmlScanner::finish() {
+    scan(true);
+    pending.clear();
+    on_finish();
+}
+
+bool HtmlScanner::is_void_element(std::string_view name) {
+    static constexpr std::array<std::string_view, 14> voidElements = {
+        "area", "base", "br", "col", "embed", "hr", "img",
+        "input", "link", "meta", "param", "source", "track", "wbr"
+    };
+
+    return std::ranges::find(voidElements, name) != voidElements.end();
+}
+
+const std::string *HtmlScanner::find_attribute(std::span<const Attribute> attributes, std::string_view name) {
+    for (const Attribute &attribute: attributes) {
+        if (attribute.name == name) {
+            return &attribute.value;
+        }
+    }
+    return nullptr;
+}
+
+void HtmlScanner::decode_text(std::string_view text, std::string &out) {
+    struct NamedReference {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    static constexpr std::array<NamedReference, 6> namedReferences = {
+        {
+            {"amp", "&"}, {"lt", "<"}, {"gt", ">"}, {"quot", "\""}, {"apos", "'"},
+            {"nbsp", "\xC2\xA0"}
+        }
+    };
+
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        std::size_t amp = text.find('&', pos);
+        if (amp == npos) {
+            out.append(text, pos);
+            break;
+        }
+
+        out.append(text, pos, amp - pos);
+        pos = amp + 1;
+
+        if (pos < text.size() && text[pos] == '#') {
+            // Numeric reference, decimal or hexadecimal
+            std::size_t digits_start = pos + 1;
+            bool hex = digits_start < text.size() && (text[digits_start] == 'x' || text[digits_start] == 'X');
+            if (hex) {
+                digits_start++;
+            }
+
+            std::uint32_t code_point = 0;
+            std::size_t i = digits_start;
+            for (; i < text.size(); ++i) {
+                char c = text[i];
+                std::uint32_t digit;
+                if (c >= '0' && c <= '9') digit = c - '0';
+                else if (hex && c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+                else if (hex && c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+                else break;
+
+                code_point = std::min<std::uint32_t>(code_point * (hex ? 16 : 10) + digit, 0x110000);
+            }
+
+            if (i == digits_start) {
+                out += '&';
+                continue;
+            }
+
+            appendUtf8(code_point, out);
+            pos = (i < text.size() && text[i] == ';') ? i + 1 : i;
+            continue;
+        }
+
+        // Named reference
+        std::size_t end = pos;
+        while (end < text.size() && end - pos < 32 && isAsciiAlnum(text[end])) {
+            end++;
+        }
+
+        bool decoded = false;
+        if (end < text.size() && text[end] == ';') {
+            std::string_view name = text.substr(pos, end - pos);
+            for (const NamedReference &reference: namedReferences) {
+                if (reference.name == name) {
+                    out.append(reference.value);
+                    pos = end + 1;
+                    decoded = true;
+                    break;
+                }
+            }
+        }
+
+        if (!decoded) {
+            out += '&';
+        }
+    }
+}
+
+void HtmlScanner::scan(bool final) {
+    std::string_view input = pending;
+    std::size_t pos = 0;
+
+    while (pos < input.size()) {
+        if (!raw_text_element.empty()) {
+            std::size_t end = findRawTextEnd(input, pos, raw_text_element);
+
+            if (end == npos) {
+                // Keep back what may be the start of the end tag, continued in the next chunk
+                std::size_t text_end = input.size();
+                if (!final) {
+                    std::size_t lt = input.rfind('<');
+                    if (lt != npos && lt >= pos && input.size() - lt <= raw_text_element.size() + 2) {
+                        text_end = lt;
+                    }
+                }
+
+                emit_text(input.substr(pos, text_end - pos));
+                pos = text_end;
+                break;
+            }
+
+            emit_text(input.substr(pos, end - pos));
+            raw_text_element.clear();
+            pos = end;
+            continue;
+        }
+
+        std::size_t lt = input.find('<', pos);
+        if (lt == npos) {
+            std::size_t end = input.size();
+
+            // A character reference split across chunks is decoded once it is complete
+            if (!final) {
+                std::size_t amp = input.rfind('&');
+                if (amp != npos && amp >= pos && input.size() - amp < 40 && input.find(';', amp) == npos) {
+                    end = amp;
+                }
+            }
+
+            emit_text(input.substr(pos, end - pos));
+            pos = end;
+            break;
+        }
+
+        if (lt > pos) {
+            emit_text(input.substr(pos, lt - pos));
+            pos = lt;
+        }
+
+        std::size_t next = scan_tag(input, pos);
+        if (next == npos) {
+            // A tag cut off by the end of the page is dropped, as an HTML parser does
+            if (final) {
+                pos = input.size();
+            }
+            break;
+        }
+
+        pos = next;
+    }
+
+    pending.erase(0, pos);
+}
+
+std::size_t HtmlScanner::scan_tag(std::string_view input, std::size_t pos) {
+    if (pos + 1 >= input.size()) {
+        return npos;
+    }
+
+    char c = input[pos + 1];
+
+    // Comments, doctypes and processing instructions
+    if (c == '!' || c == '?') {
+        if (input.substr(pos, 4) == "<!--") {
+            std::size_t end = input.find("-->", pos + 4);
+            return end == npos ? npos : end + 3;
+        }
+        if (input.size() - pos < 4 && std::string_view("<!--").starts_with(input.substr(pos))) {
+            return npos;
+        }
+
+        std::size_t end = input.find('>', pos + 2);
+        return end == npos ? npos : end + 1;
+    }
+
+    // End tags
+    if (c == '/') {
+        std::size_t end = input.find('>', pos + 2);
+        if (end == npos) {
+            return npos;
+        }
+
+        if (isAsciiAlpha(input[pos + 2])) {
+            std::size_t name_end = pos + 2;
+            while (name_end < end && !isSpace(input[name_end]) && input[name_end] != '/') {
+                name_end++;
+            }
+
+            tag_name.assign(input, pos + 2, name_end - pos - 2);
+            std::ranges::transform(tag_name, tag_name.begin(), toLower);
+
+            if (!is_void_element(tag_name)) {
+                on_end_tag(tag_name);
+            }
+        }
+
+        return end + 1;
+    }
+
+    // Anything else that does not start a tag is text
+    if (!isAsciiAlpha(c)) {
+        emit_text("<");
+        return pos + 1;
+    }
+
+    // Start tags
+    std::size_t i = pos + 1;
+    while (i < input.size() && !isSpace(input[i]) && input[i] != '/' && input[i] != '>') {
+        i++;
+    }
+    if (i >= input.size()) {
+        return npos;
+    }
+
+    tag_name.assign(input, pos + 1, i - pos - 1);
+    std::ranges::transform(tag_name, tag_name.begin(), toLower);
+
+    std::size_t attribute_count = 0;
+
+    // Set when the tag ends in "/>"; a slash anywhere else is skipped like whitespace
+    bool self_closing = false;
+
+    while (true) {
+        self_closing = false;
+        while (i < input.size() && (isSpace(input[i]) || input[i] == '/')) {
+            self_closing = input[i] == '/';
+            i++;
+        }
+        if (i >= input.size()) {
+            return npos;
+        }
+        if (input[i] == '>') {
+            break;
+        }
+
+        // Attribute name
+        std::size_t name_start = i;
+        i++; // A name may start with '='
+        while (i < input.size() && !isSpace(input[i]) && input[i] != '=' && input[i] != '>' && input[i] != '/') {
+            i++;
+        }
+        std::string_view name = input.substr(name_start, i - name_start);
+
+        while (i < input.size() && isSpace(input[i])) {
+            i++;
+        }
+        if (i >= input.size()) {
+            return npos;
+        }
+
+        // Attribute value, if any
+        std::string_view value;
+        if (input[i] == '=') {
+            i++;
+            while (i < input.size() && isSpace(input[i])) {
+                i++;
+            }
+            if (i >= input.size()) {
+                return npos;
+            }
+
+            if (input[i] == '"' || input[i] == '\'') {
+                std::size_t close = input.find(input[i], i + 1);
+                if (close == npos) {
+                    return npos;
+                }
+                value = input.substr(i + 1, close - i - 1);
+                i = close + 1;
+            } else {
+                std::size_t value_start = i;
+                while (i < input.size() && !isSpace(input[i]) && input[i] != '>') {
+                    i++;
+                }
+                value = input.substr(value_start, i - value_start);
+            }
+        }
+
+        if (attribute_count == attributes.size()) {
+            attributes.emplace_back();
+        }
+
+        // Elements left over from earlier tags are overwritten so their buffers are reused. The
+        // name is lowercased into the next free element and only kept if no earlier attribute
+        // has it, since only the first of several attributes with the same name counts.
+        Attribute &attribute = attributes[attribute_count];
+        attribute.name.resize(name.size());
+        std::ranges::transform(name, attribute.name.begin(), toLower);
+
+        bool duplicate = false;
+        for (std::size_t a = 0; a < attribute_count; ++a) {
+            if (attributes[a].name == attribute.name) {
+                duplicate = true;
+                break;
+            }
+        }
+        if (duplicate) {
+            continue;
+        }
+
+        attribute.value.clear();
+        decode_text(value, attribute.value);
+        ++attribute_count;
+    }
+
+    // The vector keeps every element it ever grew to, so only the first ones belong to this tag
+    on_start_tag(tag_name, std::span<const Attribute>(attributes.data(), attribute_count), self_closing);
+
+    if (isRawTextElement(tag_name)) {
+        raw_text_element = tag_name;
+    }
+
+    return i + 1;
+}
+
+void HtmlScanner::emit_text(std::string_view text) {
+    if (text.empty()) {
+        return;
+    }
+
+    // The contents of script and style elements are not HTML text
+    if (raw_text_element == "script" || raw_text_element == "style") {
+        on_text(text);
+        return;
+    }
+
+    decoded.clear();
+    decode_text(text, decoded);
+    on_text(decoded);
+}
+
+TitleScanner::TitleScanner(StringArena &arena) : arena(arena) {
+}
+
+void TitleScanner::on_begin() {
+    title = {};
+    in_body = false;
+    in_title = false;
+    title_seen = false;
+}
+
+void TitleScanner::on_start_tag(std::string_view name, std::span<const Attribute>, bool) {
+    if (name == "body") {
+        in_body = true;
+    } else if (name == "title" && !in_body && !title_seen) {
+        in_title = true;
+        title_seen = true;
+        arena.end_string();
+    }
+}
+
+void TitleScanner::on_end_tag(std::string_view name) {
+    if (name == "head") {
+        in_body = true;
+    }
+
+    if (name == "title" && in_title) {
+        in_title = false;
+        title = arena.end_string();
+
+        // Remove " | Weeb Central" suffix
+        size_t pos = title.find(" | Weeb Central");
+        if (pos != std::string_view::npos) {
+            title = title.substr(0, pos);
+        }
+    }
+}
+
+void TitleScanner::on_text(std::string_view text) {
+    if (in_title) {
+        arena.append(text);
+    }
+}
+
+void ChapterListScanner::on_begin() {
+    chapters.clear();
+    depth = 0;
+    foreign_depth = -1;
+    link_depth = -1;
+    label_depth = -1;
+    name_depth = -1;
+}
+
+void ChapterListScanner::on_start_tag(std::string_view name, std::span<const Attribute> attributes, bool self_closing) {
+    const int element_depth = depth + 1;
+
+    const bool is_foreign = foreign_depth >= 0 || name == "svg" || name == "math";
+    const bool is_void = is_void_element(name) || (self_closing && is_foreign);
+    if (is_foreign && foreign_depth < 0 && !is_void) {
+        foreign_depth = element_depth;
+    }
+
+    if (link_depth < 0) {
+        // A link to a chapter
+        if (name == "a") {
+            const std::string *href = find_attribute(attributes, "href");
+            if (href != nullptr && href->starts_with("/chapters/")) {
+                link_depth = element_depth;
+                label_seen = false;
+                name_seen = false;
+                chapters.begin_chapter(*href);
+            }
+        }
+    } else if (!label_seen && element_depth == link_depth + 1) {
+        // The first child of the link with a "grow" class holds the label
+        const std::string *class_attr = find_attribute(attributes, "class");
+        if (class_attr != nullptr && class_attr->find("grow") != std::string::npos) {
+            label_seen = true;
+            label_depth = is_void ? -1 : element_depth;
+        }
+    } else if (label_depth >= 0 && !name_seen && element_depth == label_depth + 1) {
+        // The first element in the label holds the chapter name
+        name_seen = true;
+        name_depth = is_void ? -1 : element_depth;
+    }
+
+    if (!is_void) {
+        depth = element_depth;
+    }
+}
+
+void ChapterListScanner::on_end_tag(std::string_view) {
+    if (depth > 0) {
+        depth--;
+    }
+    close_elements();
+}
+
+void ChapterListScanner::on_text(std::string_view text) {
+    if (name_depth >= 0) {
+        chapters.append_name(text);
+    }
+}
+
+void ChapterListScanner::on_finish() {
+    depth = 0;
+    close_elements();
+
+    // The page lists the newest chapter first. Unlike the document, the stream cannot be read
+    // back to front, so the records are reversed to put Chapter 1 first.
+    chapters.reverse();
+}
+
+void ChapterListScanner::close_elements() {
+    if (foreign_depth > depth) {
+        foreign_depth = -1;
+    }
+
+    if (name_depth > depth) {
+        name_depth = -1;
+    }
+
+    if (label_depth > depth) {
+        label_depth = -1;
+    }
+
+    if (link_depth > depth) {
+        // Links without a name are dropped by the table
+        chapters.end_chapter();
+        link_depth = -1;
+    }
+}
+
+ChapterImagesScanner::ChapterImagesScanner(StringArena &arena) : arena(arena) {
+}
+
+void ChapterImagesScanner::on_begin() {
+    image_uris.clear();
+}
+
+void ChapterImagesScanner::on_start_tag(std::string_view name, std::span<const Attribute> attributes, bool) {
+    if (name != "img") {
+        return;
+    }
+
+    const std::string *src = find_attribute(attributes, "src");
+    if (src != nullptr && !src->empty()) {
+        image_uris.push_back(arena.store(*src));
+    }
+}
@@ -0,0 +1,210 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_HTMLSCANNER_H
+#define WEEBCENTRAL_DOWNLOAD_HTMLSCANNER_H
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "StringArena.h"
+#include "models/Chapter.h"
+#include "models/ChapterTable.h"
+
+/**
+ * SAX-style HTML tokenizer that reports tags and text without building a document tree.
+ *
+ * The input can be fed in chunks of any size as it arrives; only an incomplete tag at the end
+ * of a chunk is kept until the next one. Tag and attribute names are reported in lowercase, and
+ * character references in text and attribute values are decoded. Comments, doctypes and
+ * processing instructions are skipped, and the contents of script and style elements are never
+ * taken for markup.
+ *
+ * This is not a full HTML parser: misnested tags are reported as they appear rather than
+ * repaired, and only the common named character references are known. It is meant for
+ * extracting a few well-known values from pages whose structure is known in advance.
+ */
+class HtmlScanner {
+public:
+    // An attribute of a start tag
+    struct Attribute {
+        std::string name;
+        std::string value;
+    };
+
+    virtual ~HtmlScanner() = default;
+
+    /**
+     * Starts a new page, discarding anything fed before.
+     */
+    void begin();
+
+    /**
+     * Scans the next chunk of the page.
+     *
+     * @param chunk The bytes that follow the previous chunk.
+     */
+    void feed(std::string_view chunk);
+
+    /**
+     * Scans whatever is left after the last chunk.
+     */
+    void finish();
+
+    /**
+     * Returns true for elements that never have content or an end tag, such as img and br.
+     *
+     * @param name The lowercase tag name.
+     */
+    static bool is_void_element(std::string_view name);
+
+    /**
+     * Finds an attribute of a start tag by its lowercase name.
+     *
+     * @return The attribute's value, or nullptr if the tag does not have it.
+     */
+    static const std::string *find_attribute(std::span<const Attribute> attributes, std::string_view name);
+
+    /**
+     * Appends text to out with its character references decoded.
+     */
+    static void decode_text(std::string_view text, std::string &out);
+
+protected:
+    // Called after begin, so that derived scanners can reset their state
+    virtual void on_begin() {
+    }
+
+    // Called with the lowercase name and the attributes of every start tag, and whether the
+    // tag ends in "/>". HTML ignores that on its own elements, but in SVG and MathML content it
+    // means the element is already closed and no end tag follows.
+    virtual void on_start_tag(std::string_view, std::span<const Attribute>, bool) {
+    }
+
+    // Called with the lowercase name of every end tag, except those of void elements
+    virtual void on_end_tag(std::string_view) {
+    }
+
+    // Called with decoded text, which may be reported in several pieces
+    virtual void on_text(std::string_view) {
+    }
+
+    // Called after the last chunk was scanned
+    virtual void on_finish() {
+    }
+
+private:
+    // Input that could not be scanned yet because it ends in the middle of a token
+    std::string pending;
+
+    // Name of the script, style, title or textarea element whose contents are being read
+    std::string raw_text_element;
+
+    // Reused between tags to avoid allocating for every one of them
+    std::string tag_name;
+    std::vector<Attribute> attributes;
+    std::string decoded;
+
+    // Scans as much of pending as possible; with final set, nothing is left for later
+    void scan(bool final);
+
+    // Reads a tag starting at the '<' at pos; returns the position after it, or npos if the
+    // tag is not complete yet
+    std::size_t scan_tag(std::string_view input, std::size_t pos);
+
+    void emit_text(std::string_view text);
+};
+
+/**
+ * Extracts the title from a series page, matching Utils::parseMangaTitle.
+ */
+class TitleScanner : public HtmlScanner {
+public:
+    /**
+     * @param arena Receives the title; it must outlive the scanner's results.
+     */
+    explicit TitleScanner(StringArena &arena);
+
+    // The title found, valid once finish was called
+    std::string_view title;
+
+protected:
+    void on_begin() override;
+
+    void on_start_tag(std::string_view name, std::span<const Attribute> attributes, bool self_closing) override;
+
+    void on_end_tag(std::string_view name) override;
+
+    void on_text(std::string_view text) override;
+
+private:
+    StringArena &arena;
+
+    bool in_body = false; // Titles outside of the head do not count
+    bool in_title = false;
+    bool title_seen = false;
+};
+
+/**
+ * Extracts the chapters from a full-chapter-list page, matching Utils::parseChapterList.
+ */
+class ChapterListScanner : public HtmlScanner {
+public:
+    // The chapters found, in reading order once finish was called
+    ChapterTable chapters;
+
+protected:
+    void on_begin() override;
+
+    void on_start_tag(std::string_view name, std::span<const Attribute> attributes, bool self_closing) override;
+
+    void on_end_tag(std::string_view name) override;
+
+    void on_text(std::string_view text) override;
+
+    void on_finish() override;
+
+private:
+    int depth = 0; // Number of open elements
+
+    // Depth of the outermost svg or math element, or -1 outside of them; inside, "/>" closes
+    // an element, as in the icons of the chapter links
+    int foreign_depth = -1;
+
+    // Depths of the chapter link, its label element and the element holding the chapter
+    // name, or -1 while not inside one
+    int link_depth = -1;
+    int label_depth = -1;
+    int name_depth = -1;
+
+    bool label_seen = false;
+    bool name_seen = false;
+
+    void close_elements();
+};
+
+/**
+ * Extracts the image URIs from a chapter's /images page, matching Utils::parseChapterImageURIs.
+ */
+class ChapterImagesScanner : public HtmlScanner {
+public:
+    /**
+     * @param arena Receives the URIs; it must outlive the scanner's results.
+     */
+    explicit ChapterImagesScanner(StringArena &arena);
+
+    std::vector<std::string_view> image_uris;
+
+protected:
+    void on_begin() override;
+
+    void on_start_tag(std::string_view name, std::span<const Attribute> attributes, bool self_closing) override;
+
+private:
+    StringArena &arena;
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_HTMLSCANNER_H
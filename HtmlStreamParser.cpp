@@ -0,0 +1,89 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "HtmlStreamParser.h"
+
+HtmlStreamParser::~HtmlStreamParser() {
+    destroy();
+}
+
+bool HtmlStreamParser::begin() {
+    if (document) {
+        // Frees the nodes of the previous page into the document's own memory pools
+        lxb_html_document_clean(document);
+    } else {
+        document = lxb_html_document_create();
+        if (!document) {
+            return false;
+        }
+    }
+
+    parsing = lxb_html_document_parse_chunk_begin(document) == LXB_STATUS_OK;
+    if (!parsing) {
+        destroy();
+    }
+
+    return parsing;
+}
+
+bool HtmlStreamParser::feed(std::string_view chunk) {
+    if (!parsing) {
+        return false;
+    }
+
+    lxb_status_t status = lxb_html_document_parse_chunk(document,
+                                                        (const lxb_char_t *) chunk.data(),
+                                                        chunk.size());
+    if (status != LXB_STATUS_OK) {
+        // A document left in the middle of a parse is not reused
+        destroy();
+        return false;
+    }
+
+    return true;
+}
+
+lxb_html_document_t *HtmlStreamParser::finish() {
+    if (!parsing) {
+        return nullptr;
+    }
+
+    parsing = false;
+
+    if (lxb_html_document_parse_chunk_end(document) != LXB_STATUS_OK) {
+        destroy();
+        return nullptr;
+    }
+
+    return document;
+}
+
+lxb_dom_collection_t *HtmlStreamParser::collection() {
+    if (!document) {
+        return nullptr;
+    }
+
+    if (query_collection) {
+        lxb_dom_collection_clean(query_collection);
+    } else {
+        query_collection = lxb_dom_collection_make(&document->dom_document, 128);
+    }
+
+    return query_collection;
+}
+
+void HtmlStreamParser::destroy() {
+    // The collection belongs to the document, so it goes first
+    if (query_collection) {
+        lxb_dom_collection_destroy(query_collection, true);
+        query_collection = nullptr;
+    }
+
+    if (document) {
+        lxb_html_document_destroy(document);
+        document = nullptr;
+    }
+
+    parsing = false;
+}
@@ -0,0 +1,73 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_HTMLSTREAMPARSER_H
+#define WEEBCENTRAL_DOWNLOAD_HTMLSTREAMPARSER_H
+
+#include <string_view>
+
+#include "lexbor/dom/collection.h"
+#include "lexbor/html/interfaces/document.h"
+
+/**
+ * Builds a lexbor document from HTML that arrives in chunks.
+ *
+ * Wraps lexbor's chunked parser so that a page can be parsed while it is still downloading,
+ * fed straight from HttpClient::download_html_stream, instead of holding the whole body in a
+ * string and parsing it once the last byte has arrived.
+ *
+ * The parser keeps one document for its whole lifetime and cleans it between pages, so the
+ * memory lexbor has allocated for earlier pages is reused rather than freed and allocated again.
+ */
+class HtmlStreamParser {
+public:
+    HtmlStreamParser() = default;
+
+    ~HtmlStreamParser();
+
+    // The parser owns a lexbor document, so it cannot be copied
+    HtmlStreamParser(const HtmlStreamParser &) = delete;
+
+    HtmlStreamParser &operator=(const HtmlStreamParser &) = delete;
+
+    /**
+     * Starts a new page, discarding the previous document.
+     *
+     * @return Returns true if the parser is ready for chunks; otherwise, false.
+     */
+    bool begin();
+
+    /**
+     * Parses the next chunk of the page.
+     *
+     * @param chunk The bytes that follow the previous chunk.
+     * @return Returns true if the chunk was parsed; otherwise, false.
+     */
+    bool feed(std::string_view chunk);
+
+    /**
+     * Completes the document after the last chunk.
+     *
+     * @return The parsed document, or nullptr if parsing failed or was never started. It stays
+     *         owned by the parser and is valid until the next call to begin.
+     */
+    lxb_html_document_t *finish();
+
+    /**
+     * Returns an empty collection for querying the current document, reused between queries
+     * and pages.
+     *
+     * @return The collection, or nullptr if there is no document or it could not be created.
+     */
+    lxb_dom_collection_t *collection();
+
+private:
+    lxb_html_document_t *document = nullptr;
+    lxb_dom_collection_t *query_collection = nullptr;
+    bool parsing = false; // Chunks are being fed into the document
+
+    void destroy();
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_HTMLSTREAMPARSER_H
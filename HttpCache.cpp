@@ -0,0 +1,227 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "HttpCache.h"
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+#include "Storage.h"
+
+namespace {
+    // First line of every metadata file, bumped when the format changes
+    constexpr const char *metaHeader = "weebcentral-cache 1";
+
+    // Replaces line breaks so that a value always fits on its line of the metadata file
+    std::string singleLine(std::string value) {
+        for (char &c: value) {
+            if (c == '\n' || c == '\r') {
+                c = ' ';
+            }
+        }
+        return value;
+    }
+}
+
+HttpCache::HttpCache(std::filesystem::path directory) : directory(std::move(directory)) {
+}
+
+bool HttpCache::lookup(const std::string &url, Entry &entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return read_entry(url, entry);
+}
+
+bool HttpCache::replay_body(const std::string &url, const std::function<bool(std::string_view chunk)> &on_chunk) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::ifstream file(body_path(url), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::array<char, 64 * 1024> buffer;
+    while (file) {
+        file.read(buffer.data(), buffer.size());
+        std::streamsize count = file.gcount();
+        if (count > 0 && !on_chunk(std::string_view(buffer.data(), static_cast<std::size_t>(count)))) {
+            return false;
+        }
+    }
+
+    return !file.bad();
+}
+
+FILE *HttpCache::begin_body(const std::string &url) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec) {
+        return nullptr;
+    }
+
+    return fopen(temp_body_path(url).string().c_str(), "wb");
+}
+
+bool HttpCache::commit_body(const Entry &entry, FILE *file) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    bool written = Storage::syncFile(file);
+    written = fclose(file) == 0 && written;
+
+    std::error_code ec;
+    if (!written) {
+        std::filesystem::remove(temp_body_path(entry.url), ec);
+        return false;
+    }
+
+    // A response the server no longer validates must not be answered from the old entry
+    if (entry.etag.empty() && entry.last_modified.empty()) {
+        std::filesystem::remove(temp_body_path(entry.url), ec);
+        remove_entry(entry.url);
+        return false;
+    }
+
+    // The body goes first; a crash in between leaves old metadata whose validators the
+    // server no longer matches, so the next request simply fetches the page again
+    std::filesystem::rename(temp_body_path(entry.url), body_path(entry.url), ec);
+    if (ec) {
+        return false;
+    }
+
+    Entry stored = entry;
+    stored.annotation.clear();
+    return write_entry(stored);
+}
+
+void HttpCache::abort_body(const std::string &url, FILE *file) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    fclose(file);
+
+    std::error_code ec;
+    std::filesystem::remove(temp_body_path(url), ec);
+}
+
+bool HttpCache::annotate(const std::string &url, const std::string &annotation) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Entry entry;
+    if (!read_entry(url, entry)) {
+        return false;
+    }
+
+    entry.annotation = annotation;
+    return write_entry(entry);
+}
+
+std::string HttpCache::validator(const std::string &url) {
+    Entry entry;
+    if (!lookup(url, entry)) {
+        return {};
+    }
+
+    return entry.etag.empty() ? entry.last_modified : entry.etag;
+}
+
+void HttpCache::remove(const std::string &url) {
+    std::lock_guard<std::mutex> lock(mutex);
+    remove_entry(url);
+}
+
+void HttpCache::remove_entry(const std::string &url) const {
+    // The metadata goes first, so that a body left behind is never paired with validators
+    std::filesystem::path meta_path = entry_path(url);
+    meta_path += ".meta";
+
+    std::error_code ec;
+    std::filesystem::remove(meta_path, ec);
+    std::filesystem::remove(body_path(url), ec);
+}
+
+std::filesystem::path HttpCache::entry_path(const std::string &url) const {
+    // 64-bit FNV-1a of the URL
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c: url) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string name(16, '0');
+    for (int i = 15; i >= 0; --i) {
+        name[i] = digits[hash & 0xF];
+        hash >>= 4;
+    }
+
+    return directory / name;
+}
+
+std::filesystem::path HttpCache::body_path(const std::string &url) const {
+    std::filesystem::path path = entry_path(url);
+    path += ".body";
+    return path;
+}
+
+std::filesystem::path HttpCache::temp_body_path(const std::string &url) const {
+    std::filesystem::path path = entry_path(url);
+    path += ".body.tmp";
+    return path;
+}
+
+bool HttpCache::read_entry(const std::string &url, Entry &entry) const {
+    std::filesystem::path path = entry_path(url);
+    path += ".meta";
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != metaHeader) {
+        return false;
+    }
+
+    Entry loaded;
+    while (std::getline(file, line)) {
+        size_t space = line.find(' ');
+        if (space == std::string::npos) {
+            continue;
+        }
+
+        std::string key = line.substr(0, space);
+        std::string value = line.substr(space + 1);
+
+        if (key == "url") loaded.url = std::move(value);
+        else if (key == "etag") loaded.etag = std::move(value);
+        else if (key == "last-modified") loaded.last_modified = std::move(value);
+        else if (key == "annotation") loaded.annotation = std::move(value);
+    }
+
+    // Two URLs with the same hash must not serve each other's pages
+    if (loaded.url != url) {
+        return false;
+    }
+
+    entry = std::move(loaded);
+    return true;
+}
+
+bool HttpCache::write_entry(const Entry &entry) const {
+    std::filesystem::path path = entry_path(entry.url);
+    path += ".meta";
+
+    std::ostringstream out;
+    out << metaHeader << '\n';
+    out << "url " << singleLine(entry.url) << '\n';
+    out << "etag " << singleLine(entry.etag) << '\n';
+    out << "last-modified " << singleLine(entry.last_modified) << '\n';
+    out << "annotation " << singleLine(entry.annotation) << '\n';
+
+    return Storage::writeFileAtomic(path, out.str());
+}
@@ -0,0 +1,130 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_HTTPCACHE_H
+#define WEEBCENTRAL_DOWNLOAD_HTTPCACHE_H
+
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/**
+ * On-disk cache of HTML responses keyed by URL, used for conditional requests.
+ *
+ * Every entry keeps the body of the last 200 response together with its validators (ETag and
+ * Last-Modified), which HttpClient sends back as If-None-Match and If-Modified-Since. When the
+ * server answers 304 Not Modified, the body is served from the cache instead. An entry can also
+ * carry an annotation: a small piece of data derived from the body (e.g. the parsed title) that
+ * stays valid for as long as the body does, so callers can skip parsing an unchanged page.
+ *
+ * Each entry is stored as two files named after a hash of the URL. Bodies are written to a
+ * temporary file while they are received and only replace the cached body once complete.
+ */
+class HttpCache {
+public:
+    // Metadata of a cached response
+    struct Entry {
+        std::string url;
+        std::string etag;
+        std::string last_modified;
+        std::string annotation;
+    };
+
+    explicit HttpCache(std::filesystem::path directory);
+
+    /**
+     * Reads the metadata of the entry for a URL.
+     *
+     * @param url The URL of the response.
+     * @param entry Receives the metadata.
+     * @return Returns true if an entry exists for the URL; otherwise, false.
+     */
+    bool lookup(const std::string &url, Entry &entry);
+
+    /**
+     * Passes the cached body for a URL to a callback, one chunk at a time.
+     *
+     * @param url The URL of the response.
+     * @param on_chunk Receives each chunk; returning false stops the replay.
+     * @return Returns true if the whole body was read and accepted; otherwise, false.
+     */
+    bool replay_body(const std::string &url, const std::function<bool(std::string_view chunk)> &on_chunk);
+
+    /**
+     * Opens a temporary file for storing a new body for a URL while it is being received.
+     *
+     * @param url The URL of the response.
+     * @return The file, or nullptr if it could not be created. It must be passed to either
+     *         commit_body or abort_body.
+     */
+    FILE *begin_body(const std::string &url);
+
+    /**
+     * Replaces the cached response for a URL with a body written through begin_body. The
+     * annotation of the earlier entry is dropped, since it was derived from the old body.
+     *
+     * @param entry The metadata of the response; entries without a validator are not stored, and
+     *              the earlier entry is dropped.
+     * @param file The file returned by begin_body, which is closed.
+     * @return Returns true if the response was stored; otherwise, false.
+     */
+    bool commit_body(const Entry &entry, FILE *file);
+
+    /**
+     * Discards a body written through begin_body, keeping the cached response as it was.
+     *
+     * @param url The URL of the response.
+     * @param file The file returned by begin_body, which is closed.
+     */
+    void abort_body(const std::string &url, FILE *file);
+
+    /**
+     * Attaches an annotation to the entry for a URL.
+     *
+     * @param url The URL of the response.
+     * @param annotation The data derived from the cached body.
+     * @return Returns true if the entry exists and was updated; otherwise, false.
+     */
+    bool annotate(const std::string &url, const std::string &annotation);
+
+    /**
+     * Returns the strongest validator of the entry for a URL: its ETag if it has one,
+     * otherwise its Last-Modified date.
+     *
+     * @param url The URL of the response.
+     * @return The validator, or an empty string if there is no entry.
+     */
+    std::string validator(const std::string &url);
+
+    /**
+     * Drops the entry for a URL, e.g. because its body can no longer be read. The next request
+     * for the URL is then made unconditionally.
+     *
+     * @param url The URL of the response.
+     */
+    void remove(const std::string &url);
+
+private:
+    const std::filesystem::path directory;
+    std::mutex mutex;
+
+    // Path of an entry's files without extension, named after a hash of the URL
+    std::filesystem::path entry_path(const std::string &url) const;
+
+    std::filesystem::path body_path(const std::string &url) const;
+
+    std::filesystem::path temp_body_path(const std::string &url) const;
+
+    bool read_entry(const std::string &url, Entry &entry) const;
+
+    bool write_entry(const Entry &entry) const;
+
+    // Deletes an entry's files; the caller holds the mutex
+    void remove_entry(const std::string &url) const;
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_HTTPCACHE_H
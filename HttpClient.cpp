@@ -4,83 +4,1010 @@
 
 #include "HttpClient.h"
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
 #include <cstring>
 #include <curl/curl.h>
+#include <deque>
 #include <fstream>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "Storage.h"
+#include "Url.h"
+
+namespace {
+    // Returns the host part of a URL, used to group transfers for the per-host limit
+    std::string_view host_of(std::string_view url) {
+        size_t start = url.find("://");
+        start = (start == std::string_view::npos) ? 0 : start + 3;
+
+        size_t end = url.find_first_of(":/?#", start);
+        if (end == std::string_view::npos) {
+            end = url.size();
+        }
+
+        return url.substr(start, end - start);
+    }
+
+    // How long to block a host after a 429 response that did not include Retry-After
+    constexpr std::chrono::seconds default_rate_limit_delay(10);
+
+    // File next to a partial image holding the validator it was received under
+    std::string validatorPath(const std::string &temp_path) {
+        return temp_path + ".validator";
+    }
+
+    // Returns the validator of a response that If-Range accepts: a strong ETag, or else the
+    // Last-Modified date
+    std::string rangeValidator(const std::string &etag, const std::string &last_modified) {
+        if (!etag.empty() && !etag.starts_with("W/")) {
+            return etag;
+        }
+        return last_modified;
+    }
+}
 
 HttpClient::HttpClient() {
     curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    // Share connections, DNS lookups and TLS sessions between all handles for the
+    // lifetime of the client, so repeated requests to the same host skip the handshakes
+    share = curl_share_init();
+    if (share) {
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
 }
 
 HttpClient::~HttpClient() {
+    for (CURL *curl: idle_handles) {
+        curl_easy_cleanup(curl);
+    }
+    idle_handles.clear();
+
+    if (share) {
+        curl_share_cleanup(share);
+    }
+
     curl_global_cleanup();
 }
 
 // Validate HTTP/HTTPS URI
 bool HttpClient::is_valid_http_uri(const std::string &uri) {
-    CURLU *url = curl_url();
-    CURLUcode rc = curl_url_set(url, CURLUPART_URL, uri.c_str(), 0);
+    return Url::isHttpUri(uri);
+}
+
+// Download HTML content to string
+bool HttpClient::download_html(const std::string &url, std::string &out_html, bool *not_modified) {
+    const std::size_t initial_size = out_html.size();
+
+    auto on_begin = [&out_html, initial_size] {
+        // Drop the body of a failed attempt before asking again
+        out_html.resize(initial_size);
+        return true;
+    };
+    auto on_chunk = [&out_html](std::string_view chunk) {
+        out_html.append(chunk);
+        return true;
+    };
 
-    if (rc == CURLUE_OK) {
-        char *scheme = nullptr;
-        if (curl_url_get(url, CURLUPART_SCHEME, &scheme, 0) == CURLUE_OK) {
-            bool is_http = (strcmp(scheme, "http") == 0 || strcmp(scheme, "https") == 0);
-            curl_free(scheme);
-            curl_url_cleanup(url);
-            return is_http;
+    // Saves growing the string chunk by chunk when the server says how large the page is
+    const std::function<void(std::size_t length)> on_length = [&out_html, initial_size](std::size_t length) {
+        out_html.reserve(initial_size + length);
+    };
+
+    if (!fetch_html(url, on_begin, on_chunk, not_modified, &on_length)) {
+        return false;
+    }
+
+    // An unchanged page is served from the cache
+    if (not_modified && *not_modified) {
+        if (on_begin() && cache->replay_body(url, on_chunk)) {
+            return true;
         }
+
+        // The cached copy went missing or cannot be read, so it is dropped and the page asked
+        // for in full
+        cache->remove(url);
+        return fetch_html(url, on_begin, on_chunk, not_modified, &on_length);
     }
 
-    curl_url_cleanup(url);
-    return false;
+    return true;
 }
 
-// Download HTML content to string
-bool HttpClient::download_html(const std::string &url, std::string &out_html) {
-    CURL *curl = curl_easy_init();
+// Download HTML content, passing it on as it arrives
+bool HttpClient::download_html_stream(const std::string &url, const std::function<bool()> &on_begin,
+                                      const std::function<bool(std::string_view chunk)> &on_chunk,
+                                      bool *not_modified) {
+    return fetch_html(url, on_begin, on_chunk, not_modified, nullptr);
+}
+
+bool HttpClient::fetch_html(const std::string &url, const std::function<bool()> &on_begin,
+                            const std::function<bool(std::string_view chunk)> &on_chunk, bool *not_modified,
+                            const std::function<void(std::size_t length)> *on_length) {
+    if (not_modified) {
+        *not_modified = false;
+    }
+
+    CURL *curl = acquire_handle(url);
     if (!curl) return false;
 
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    TransferContext context;
+    context.client = this;
+    context.curl = curl;
+    context.host = host_of(url);
+    context.on_chunk = &on_chunk;
+    context.on_length = on_length;
+
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &out_html);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L); // Follow redirects
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0"); // Set user agent
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &context);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &context);
 
-    CURLcode res = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
+    // Pages are mostly markup and shrink several times over with gzip or brotli; an empty string
+    // offers every encoding this build of curl can decode, and curl decodes the body before it
+    // reaches write_callback
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
 
-    return res == CURLE_OK;
+    // Ask the server to answer 304 if the cached copy is still current
+    const bool use_cache = cache && not_modified;
+    bool conditional = false;
+    curl_slist *headers = nullptr;
+    if (use_cache) {
+        HttpCache::Entry cached;
+        if (cache->lookup(url, cached)) {
+            if (!cached.etag.empty()) {
+                headers = curl_slist_append(headers, ("If-None-Match: " + cached.etag).c_str());
+            }
+            if (!cached.last_modified.empty()) {
+                headers = curl_slist_append(headers, ("If-Modified-Since: " + cached.last_modified).c_str());
+            }
+            conditional = headers != nullptr;
+        }
+
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    }
+
+    RetryPolicy::Failure failure = RetryPolicy::Failure::none;
+    long response_code = 0;
+
+    for (int attempt = 1;; ++attempt) {
+        if (!on_begin()) {
+            failure = RetryPolicy::Failure::local;
+            break;
+        }
+
+        context.response_checked = false;
+        context.discard_body = false;
+        context.cache_failed = false;
+        context.content_encoded = false;
+        context.decoded_bytes = 0;
+        context.write_time = {};
+
+        // The body is copied to the cache as it arrives instead of being kept in memory
+        if (use_cache) {
+            if (context.cache_file) {
+                cache->abort_body(url, context.cache_file);
+            }
+            context.cache_file = cache->begin_body(url);
+        }
+
+        rate_limiter.acquire(context.host);
+        CURLcode res = curl_easy_perform(curl);
+        record_connection(curl, res);
+        record_html_size(curl, context);
+
+        response_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+        if (res == CURLE_OK && response_code == 304 && conditional) {
+            failure = RetryPolicy::Failure::none;
+        } else {
+            failure = classify_response(curl, context.host, res);
+        }
+        record_transfer(curl, context, "html", attempt, res);
+
+        bool retry = retry_policy.should_retry(failure, attempt);
+        record_attempt(failure, attempt, !retry);
+
+        if (!retry) {
+            break;
+        }
+
+        std::this_thread::sleep_for(retry_policy.backoff(attempt));
+    }
+
+    // The handle goes back to the pool, so it must not keep pointing at the freed list
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(headers);
+    release_handle(curl);
+
+    if (context.cache_file) {
+        if (failure == RetryPolicy::Failure::none && response_code != 304 && !context.cache_failed) {
+            HttpCache::Entry entry{url, context.etag, context.last_modified, {}};
+            cache->commit_body(entry, context.cache_file);
+        } else {
+            cache->abort_body(url, context.cache_file);
+        }
+    }
+
+    if (failure != RetryPolicy::Failure::none) {
+        return false;
+    }
+
+    if (use_cache && response_code == 304) {
+        *not_modified = true;
+    }
+
+    return true;
 }
 
 // Download image to disk
 bool HttpClient::download_image(const std::string &url, const std::string &output_path) {
-    CURL *curl = curl_easy_init();
+    CURL *curl = acquire_handle(url);
     if (!curl) return false;
 
-    FILE *fp = fopen(output_path.c_str(), "wb");
-    if (!fp) {
-        curl_easy_cleanup(curl);
-        return false;
+    TransferContext context;
+    context.client = this;
+    context.curl = curl;
+    context.host = host_of(url);
+    context.output_path = output_path;
+
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &context);
+
+    RetryPolicy::Failure failure = RetryPolicy::Failure::local;
+
+    for (int attempt = 1;; ++attempt) {
+        if (!open_image_file(curl, context)) {
+            record_attempt(RetryPolicy::Failure::local, attempt, true);
+            break;
+        }
+
+        rate_limiter.acquire(context.host);
+        CURLcode res = curl_easy_perform(curl);
+        record_connection(curl, res);
+
+        // Syncing, linking and renaming count as writing the image
+        const Metrics::clock::time_point close_start = Metrics::clock::now();
+        failure = close_image_file(curl, context, res);
+        context.write_time += Metrics::clock::now() - close_start;
+        record_transfer(curl, context, "image", attempt, res);
+        bool retry = retry_policy.should_retry(failure, attempt);
+        record_attempt(failure, attempt, !retry);
+
+        if (!retry) {
+            break;
+        }
+
+        std::this_thread::sleep_for(retry_policy.backoff(attempt));
+    }
+
+    release_handle(curl);
+
+    return failure == RetryPolicy::Failure::none;
+}
+
+// Download a batch of images concurrently
+bool HttpClient::download_images(std::vector<ImageDownload> &downloads,
+                                 const std::function<void(std::size_t index)> &on_complete) {
+    CURLM *multi = curl_multi_init();
+    if (!multi) return false;
+
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(max_transfers));
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(max_transfers_per_host));
+
+    // State of a single transfer, kept alive while curl writes into it
+    struct ImageTransfer {
+        std::size_t index = 0;
+        TransferContext context;
+    };
+
+    std::deque<std::size_t> pending;
+    std::vector<int> attempts(downloads.size(), 0);
+
+    // Earliest time each image may be attempted again after a failure
+    std::vector<std::chrono::steady_clock::time_point> not_before(downloads.size());
+    for (std::size_t i = 0; i < downloads.size(); ++i) {
+        downloads[i].success = false;
+        pending.push_back(i);
+    }
+
+    std::unordered_map<CURL *, std::unique_ptr<ImageTransfer> > in_flight;
+    bool all_succeeded = true;
+
+    auto finish = [&](CURL *curl, CURLcode res) {
+        std::unique_ptr<ImageTransfer> transfer = std::move(in_flight.at(curl));
+        in_flight.erase(curl);
+
+        const std::size_t index = transfer->index;
+        ImageDownload &download = downloads[index];
+
+        record_connection(curl, res);
+        const Metrics::clock::time_point close_start = Metrics::clock::now();
+        RetryPolicy::Failure failure = close_image_file(curl, transfer->context, res);
+        transfer->context.write_time += Metrics::clock::now() - close_start;
+
+        // A body that outgrew the memory budget is on disk now, and later attempts resume from there
+        download.in_memory = transfer->context.out_body != nullptr;
+        download.problem = failure == RetryPolicy::Failure::corrupt
+                               ? ImageCheck::describe(transfer->context.problem, transfer->context.check.format())
+                               : std::string_view();
+        record_transfer(curl, transfer->context, "image", attempts[index], res);
+
+        curl_multi_remove_handle(multi, curl);
+        release_handle(curl);
+        rate_limiter.end_transfer(transfer->context.host);
+
+        bool retry = retry_policy.should_retry(failure, attempts[index]);
+        record_attempt(failure, attempts[index], !retry);
+
+        // Try again after the backoff; the transfer resumes from the partial file
+        if (retry) {
+            not_before[index] = std::chrono::steady_clock::now() + retry_policy.backoff(attempts[index]);
+            pending.push_front(index);
+            return;
+        }
+
+        download.success = failure == RetryPolicy::Failure::none;
+        all_succeeded = all_succeeded && download.success;
+
+        if (on_complete) {
+            on_complete(index);
+        }
+    };
+
+    while (!pending.empty() || !in_flight.empty()) {
+        // Longest we may sleep before a rate limited host can be asked again
+        auto wait = std::chrono::milliseconds(1000);
+
+        const auto now = std::chrono::steady_clock::now();
+
+        // Start transfers in batch order, skipping hosts that are at their limit. The per-host
+        // limit is shared with every other batch running on the client at the same time.
+        for (auto it = pending.begin(); it != pending.end() && in_flight.size() < max_transfers;) {
+            ImageDownload &download = downloads[*it];
+            std::string_view host = host_of(download.url);
+
+            // Still backing off after a failed attempt
+            if (not_before[*it] > now) {
+                wait = std::min(wait, std::chrono::ceil<std::chrono::milliseconds>(not_before[*it] - now));
+                ++it;
+                continue;
+            }
+
+            if (!rate_limiter.try_begin_transfer(host, max_transfers_per_host)) {
+                // A slot may be freed by another batch, which this loop would not notice
+                wait = std::min(wait, std::chrono::milliseconds(50));
+                ++it;
+                continue;
+            }
+
+            RateLimiter::clock::duration host_wait = rate_limiter.try_acquire(host);
+            if (host_wait > RateLimiter::clock::duration::zero()) {
+                rate_limiter.end_transfer(host);
+                wait = std::min(wait, std::chrono::ceil<std::chrono::milliseconds>(host_wait));
+                ++it;
+                continue;
+            }
+
+            std::size_t index = *it;
+            it = pending.erase(it);
+            attempts[index]++;
+
+            auto transfer = std::make_unique<ImageTransfer>();
+            transfer->index = index;
+            transfer->context.client = this;
+            transfer->context.host = host;
+            transfer->context.output_path = download.output_path;
+            transfer->context.out_body = download.in_memory ? &download.body : nullptr;
+            transfer->context.out_validator = &download.validator;
+            transfer->context.staged = download.staged;
+
+            CURL *curl = acquire_handle(download.url);
+            transfer->context.curl = curl;
+            if (!curl || !open_image_file(curl, transfer->context)) {
+                if (curl) release_handle(curl);
+                rate_limiter.end_transfer(host);
+                record_attempt(RetryPolicy::Failure::local, attempts[index], true);
+                all_succeeded = false;
+                if (on_complete) on_complete(index);
+                continue;
+            }
+
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer->context);
+
+            in_flight[curl] = std::move(transfer);
+
+            if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+                finish(curl, CURLE_FAILED_INIT);
+            }
+        }
+
+        if (in_flight.empty()) {
+            // Everything left is waiting on the rate limiter or a backoff
+            if (!pending.empty()) {
+                std::this_thread::sleep_for(wait);
+            }
+            continue;
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        int messages = 0;
+        while (CURLMsg *msg = curl_multi_info_read(multi, &messages)) {
+            if (msg->msg == CURLMSG_DONE) {
+                finish(msg->easy_handle, msg->data.result);
+            }
+        }
+
+        if (running > 0) {
+            curl_multi_poll(multi, nullptr, 0, static_cast<int>(wait.count()), nullptr);
+        }
+    }
+
+    curl_multi_cleanup(multi);
+
+    return all_succeeded;
+}
+
+void HttpClient::set_concurrency(std::size_t max_transfers, std::size_t max_per_host) {
+    this->max_transfers = std::max<std::size_t>(max_transfers, 1);
+    max_transfers_per_host = std::max<std::size_t>(max_per_host, 1);
+}
+
+void HttpClient::set_rate_limits(const RateLimiter::Limits &limits) {
+    rate_limiter.set_limits(limits);
+}
+
+void HttpClient::set_retry_policy(const RetryPolicy::Settings &settings) {
+    retry_policy = RetryPolicy(settings);
+}
+
+void HttpClient::set_trailer_check(bool enabled) {
+    check_trailers = enabled;
+}
+
+bool HttpClient::get_trailer_check() const {
+    return check_trailers;
+}
+
+RetryStats HttpClient::retry_stats() {
+    std::lock_guard<std::mutex> lock(retry_stats_mutex);
+    return retry_statistics;
+}
+
+void HttpClient::set_cache(HttpCache *http_cache) {
+    cache = http_cache;
+}
+
+HttpCache *HttpClient::get_cache() const {
+    return cache;
+}
+
+void HttpClient::set_image_store(ImageStore *store) {
+    image_store = store;
+}
+
+ImageStore *HttpClient::get_image_store() const {
+    return image_store;
+}
+
+void HttpClient::set_memory_budget(MemoryBudget *budget) {
+    memory_budget = budget;
+}
+
+MemoryBudget *HttpClient::get_memory_budget() const {
+    return memory_budget;
+}
+
+void HttpClient::set_metrics(Metrics *run_metrics) {
+    metrics = run_metrics;
+}
+
+Metrics *HttpClient::get_metrics() const {
+    return metrics;
+}
+
+HttpClient::ConnectionStats HttpClient::connection_stats() const {
+    return {connections_opened.load(), connections_reused.load()};
+}
+
+HttpClient::HtmlStats HttpClient::html_stats() const {
+    return {html_responses.load(), html_compressed.load(), html_received_bytes.load(), html_decoded_bytes.load()};
+}
+
+CURL *HttpClient::acquire_handle(const std::string &url) {
+    CURL *curl = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(idle_handles_mutex);
+        if (!idle_handles.empty()) {
+            curl = idle_handles.back();
+            idle_handles.pop_back();
+        }
+    }
+
+    if (curl) {
+        // Clears the options from the previous request but keeps the handle's caches
+        curl_easy_reset(curl);
+    } else {
+        curl = curl_easy_init();
+        if (!curl) return nullptr;
+    }
+
+    if (share) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
     }
 
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, nullptr); // Use default
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0");
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L); // Follow redirects
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0"); // Set user agent
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L); // Keep pooled connections alive between chapters
+
+    // Turn stalled connections into timeouts that the retry policy can act on
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 60L);
+
+    return curl;
+}
+
+void HttpClient::release_handle(CURL *curl) {
+    std::lock_guard<std::mutex> lock(idle_handles_mutex);
+    idle_handles.push_back(curl);
+}
+
+void HttpClient::record_connection(CURL *curl, CURLcode result) {
+    // Number of new connections the last transfer had to make, zero when it reused one
+    long num_connects = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &num_connects) != CURLE_OK) {
+        return;
+    }
+
+    if (num_connects > 0) {
+        connections_opened += static_cast<std::size_t>(num_connects);
+    } else if (result == CURLE_OK) {
+        connections_reused++;
+    }
+}
+
+void HttpClient::record_html_size(CURL *curl, const TransferContext &context) {
+    // Body bytes as they came over the network, before curl decompressed them
+    curl_off_t received = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &received) != CURLE_OK || received <= 0) {
+        return;
+    }
+
+    html_responses++;
+    if (context.content_encoded) {
+        html_compressed++;
+    }
+    html_received_bytes += static_cast<std::uint64_t>(received);
+    html_decoded_bytes += context.decoded_bytes;
+}
+
+void HttpClient::share_lock(CURL *, curl_lock_data data, curl_lock_access, void *userp) {
+    static_cast<HttpClient *>(userp)->share_mutexes[data].lock();
+}
+
+void HttpClient::share_unlock(CURL *, curl_lock_data data, void *userp) {
+    static_cast<HttpClient *>(userp)->share_mutexes[data].unlock();
+}
+
+bool HttpClient::open_image_file(CURL *curl, TransferContext &context) {
+    context.response_checked = false;
+    context.discard_body = false;
+    context.write_time = {};
+    context.check.reset(ImageCheck::format_of(context.output_path));
+    context.problem = ImageCheck::Problem::none;
+    context.etag.clear();
+    context.last_modified.clear();
+    context.range_validator.clear();
+
+    if (context.out_body) {
+        // Bytes received by a failed attempt are kept and only the rest is requested
+        context.resume_from = static_cast<curl_off_t>(context.out_body->size());
+        if (context.resume_from > 0 && context.out_validator) {
+            context.range_validator = *context.out_validator;
+        }
+        if (context.range_validator.empty()) {
+            discard_partial(context);
+            context.resume_from = 0;
+        }
+        context.check.update(*context.out_body);
+    } else {
+        context.temp_path = context.output_path + ".part";
+
+        // Bytes left behind by an interrupted transfer are kept and only the rest is requested
+        std::error_code ec;
+        std::uintmax_t partial_size = std::filesystem::file_size(context.temp_path, ec);
+        context.resume_from = ec ? 0 : static_cast<curl_off_t>(partial_size);
+
+        // Without the validator it was received under, a partial file could belong to an older
+        // version of the image
+        if (context.resume_from > 0) {
+            std::ifstream validator_file(validatorPath(context.temp_path), std::ios::binary);
+            std::getline(validator_file, context.range_validator);
+            if (context.range_validator.empty()) {
+                discard_partial(context);
+                context.resume_from = 0;
+            }
+        }
+
+        // The store needs the hash of the whole image, including what an earlier attempt received
+        if (image_store && !context.staged) {
+            context.hasher.reset();
+            if (context.resume_from > 0 && !ImageStore::hash_file(context.temp_path, context.hasher)) {
+                context.hasher.reset();
+                context.resume_from = 0;
+            }
+        }
+
+        // The check only needs the first and last bytes of what an earlier attempt received
+        if (context.resume_from > 0 &&
+            !context.check.resume(context.temp_path, static_cast<std::uint64_t>(context.resume_from))) {
+            context.hasher.reset();
+            context.check.restart();
+            context.resume_from = 0;
+        }
+
+        context.out_file = fopen(context.temp_path.c_str(), context.resume_from > 0 ? "ab" : "wb");
+        if (!context.out_file) {
+            return false;
+        }
+    }
+
+    // The server sends the rest only if the image is still the one the partial data came from;
+    // otherwise it answers 200, which curl rejects with CURLE_RANGE_ERROR
+    if (context.resume_from > 0) {
+        context.range_headers = curl_slist_append(nullptr, ("If-Range: " + context.range_validator).c_str());
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, context.range_headers);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &context);
+
+    curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, context.resume_from);
+    return true;
+}
+
+RetryPolicy::Failure HttpClient::close_image_file(CURL *curl, TransferContext &context, CURLcode result) {
+    // The handle goes back to the pool, so it must not keep pointing at the freed list
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(context.range_headers);
+    context.range_headers = nullptr;
+
+    bool written = context.out_body != nullptr;
+    if (context.out_file) {
+        written = Storage::syncFile(context.out_file);
+        written = fclose(context.out_file) == 0 && written;
+        context.out_file = nullptr;
+    }
+
+    long response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+    std::error_code ec;
+
+    // The partial image does not fit the image on the server any more, or the server sent the
+    // whole image again because it changed or it ignores ranges, so start over
+    if (context.resume_from > 0 &&
+        (result == CURLE_RANGE_ERROR || (result == CURLE_OK && response_code == 416))) {
+        discard_partial(context);
+        return RetryPolicy::Failure::range_rejected;
+    }
+
+    RetryPolicy::Failure failure = classify_response(curl, context.host, result);
+    if (failure == RetryPolicy::Failure::none && !written) {
+        failure = RetryPolicy::Failure::local;
+    }
+
+    // A resumed transfer announces the length of the rest of the image only
+    if (failure == RetryPolicy::Failure::none) {
+        curl_off_t length = -1;
+        curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        const std::int64_t expected_size = length >= 0 ? context.resume_from + length : -1;
+
+        context.problem = context.check.finish(expected_size, check_trailers);
+        if (context.problem != ImageCheck::Problem::none) {
+            failure = RetryPolicy::Failure::corrupt;
+        }
+    }
+
+    // Nothing of a corrupt image is worth resuming from
+    if (failure == RetryPolicy::Failure::corrupt) {
+        discard_partial(context);
+        return failure;
+    }
+
+    // A partial image is kept for the next attempt to resume from, under the validator of the
+    // response it came from; an error response leaves the earlier validator in place
+    if (failure != RetryPolicy::Failure::none) {
+        std::string validator = context.range_validator;
+        if (response_code == 200 || response_code == 206) {
+            validator = rangeValidator(context.etag, context.last_modified);
+        }
+
+        const std::uintmax_t partial_size = context.out_body
+                                                ? context.out_body->size()
+                                                : std::filesystem::file_size(context.temp_path, ec);
+        if (ec || partial_size == 0 || validator.empty()) {
+            discard_partial(context);
+        } else if (context.out_body) {
+            if (context.out_validator) {
+                *context.out_validator = validator;
+            }
+        } else if (!Storage::writeFileAtomic(validatorPath(context.temp_path), validator + "\n")) {
+            discard_partial(context);
+        }
+        return failure;
+    }
+
+    if (context.out_body) {
+        if (context.out_validator) {
+            context.out_validator->clear();
+        }
+        return failure;
+    }
+
+    std::filesystem::remove(validatorPath(context.temp_path), ec);
+
+    // Content that is already in the store is linked to instead of being kept twice. A staged
+    // image is removed once it is in its archive, so it must not become the store's copy.
+    if (image_store && !context.staged && image_store->adopt(context.temp_path, context.output_path, context.hasher)) {
+        return failure;
+    }
 
-    CURLcode res = curl_easy_perform(curl);
+    // Only a complete image ever appears under its final name
+    std::filesystem::rename(context.temp_path, context.output_path, ec);
+    return ec ? RetryPolicy::Failure::local : RetryPolicy::Failure::none;
+}
+
+bool HttpClient::spill_body(TransferContext &context) {
+    context.temp_path = context.output_path + ".part";
+    context.out_file = fopen(context.temp_path.c_str(), "wb");
+    if (!context.out_file) {
+        return false;
+    }
+
+    std::string &body = *context.out_body;
+    if (image_store && !context.staged) {
+        context.hasher.reset();
+        context.hasher.update(body);
+    }
+
+    const bool written = fwrite(body.data(), 1, body.size(), context.out_file) == body.size();
+
+    if (memory_budget) {
+        memory_budget->release(body.size());
+        memory_budget->record_spill();
+    }
+    std::string().swap(body);
+    context.out_body = nullptr;
+
+    return written;
+}
+
+void HttpClient::discard_partial(TransferContext &context) {
+    if (context.out_body) {
+        drop_body(context);
+        if (context.out_validator) {
+            context.out_validator->clear();
+        }
+        return;
+    }
+
+    std::error_code ec;
+    std::filesystem::remove(context.temp_path, ec);
+    std::filesystem::remove(validatorPath(context.temp_path), ec);
+}
+
+void HttpClient::drop_body(TransferContext &context) {
+    if (memory_budget) {
+        memory_budget->release(context.out_body->size());
+    }
+    std::string().swap(*context.out_body);
+}
+
+RetryPolicy::Failure HttpClient::classify_response(CURL *curl, std::string_view host, CURLcode result) {
+    long response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+    if (result == CURLE_OK) {
+        handle_rate_limited(curl, host);
+    }
+
+    return RetryPolicy::classify(result, response_code);
+}
+
+void HttpClient::record_attempt(RetryPolicy::Failure failure, int attempt, bool final) {
+    std::lock_guard<std::mutex> lock(retry_stats_mutex);
+    RetryPolicy::record(retry_statistics, failure, attempt, final);
+}
+
+void HttpClient::record_transfer(CURL *curl, const TransferContext &context, std::string_view kind, int attempt,
+                                 CURLcode result) {
+    if (!metrics) {
+        return;
+    }
+
+    // curl reports each phase as the time from the start of the attempt to its end
+    auto seconds = [curl](CURLINFO info) {
+        curl_off_t microseconds = 0;
+        curl_easy_getinfo(curl, info, &microseconds);
+        return static_cast<double>(microseconds) / 1e6;
+    };
+
+    char *url = nullptr;
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
+
+    long num_connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &num_connects);
+
+    curl_off_t bytes = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+
+    Metrics::Transfer transfer;
+    transfer.kind = kind;
+    transfer.url = url ? std::string_view(url) : std::string_view();
+    transfer.attempt = attempt;
+    transfer.result = static_cast<int>(result);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &transfer.status);
+    transfer.reused_connection = num_connects == 0 && result == CURLE_OK;
+    transfer.bytes = static_cast<std::uint64_t>(std::max<curl_off_t>(bytes, 0));
+    transfer.name_lookup = seconds(CURLINFO_NAMELOOKUP_TIME_T);
+    transfer.connect = seconds(CURLINFO_CONNECT_TIME_T);
+    transfer.tls = seconds(CURLINFO_APPCONNECT_TIME_T);
+    transfer.pretransfer = seconds(CURLINFO_PRETRANSFER_TIME_T);
+    transfer.first_byte = seconds(CURLINFO_STARTTRANSFER_TIME_T);
+    transfer.total = seconds(CURLINFO_TOTAL_TIME_T);
+    transfer.write = std::chrono::duration<double>(context.write_time).count();
+
+    metrics->record_transfer(transfer);
+}
+
+bool HttpClient::handle_rate_limited(CURL *curl, std::string_view host) {
+    long response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+    // Seconds the server asked us to wait, parsed by curl from Retry-After (0 if absent)
+    curl_off_t retry_after = 0;
+    curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after);
+
+    if (response_code != 429 && !(response_code == 503 && retry_after > 0)) {
+        return false;
+    }
 
-    fclose(fp);
-    curl_easy_cleanup(curl);
+    std::chrono::seconds delay = retry_after > 0 ? std::chrono::seconds(retry_after) : default_rate_limit_delay;
+    rate_limiter.penalize(host, delay);
 
-    return res == CURLE_OK;
+    return true;
 }
 
-// Callback for writing HTML to string
+// Callback for capturing the validators and the encoding of a response
+size_t HttpClient::header_callback(char *buffer, size_t size, size_t nitems, void *userp) {
+    size_t total_size = size * nitems;
+    TransferContext *context = static_cast<TransferContext *>(userp);
+
+    std::string_view line(buffer, total_size);
+
+    // A status line starts a new response (after a redirect or a retry), whose validators replace
+    // those of the previous one
+    if (line.starts_with("HTTP/")) {
+        context->etag.clear();
+        context->last_modified.clear();
+        context->content_encoded = false;
+        return total_size;
+    }
+
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+        return total_size;
+    }
+
+    std::string_view name = line.substr(0, colon);
+    std::string_view value = line.substr(colon + 1);
+
+    size_t first = value.find_first_not_of(" \t");
+    size_t last = value.find_last_not_of(" \t\r\n");
+    value = first == std::string_view::npos ? std::string_view() : value.substr(first, last - first + 1);
+
+    auto is_header = [&name](std::string_view expected) {
+        return name.size() == expected.size() &&
+               std::equal(name.begin(), name.end(), expected.begin(), [](char a, char b) {
+                   return std::tolower(static_cast<unsigned char>(a)) == b;
+               });
+    };
+
+    if (is_header("etag")) {
+        context->etag = value;
+    } else if (is_header("last-modified")) {
+        context->last_modified = value;
+    } else if (is_header("content-encoding")) {
+        context->content_encoded = !value.empty() && value != "identity";
+    }
+
+    return total_size;
+}
+
+// Callback for passing a response body on to a callback or writing it to a file
 size_t HttpClient::write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
     size_t total_size = size * nmemb;
-    std::string *str = static_cast<std::string *>(userp);
-    str->append(static_cast<char *>(contents), total_size);
+    TransferContext *context = static_cast<TransferContext *>(userp);
+
+    if (!context->response_checked) {
+        context->response_checked = true;
+
+        long response_code = 0;
+        curl_easy_getinfo(context->curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+        // Error pages must not end up in the image file or reach the HTML consumer
+        context->discard_body = response_code < 200 || response_code >= 300;
+
+        // The length of a compressed body says little about the size of the page
+        curl_off_t length = -1;
+        if (context->on_length && !context->discard_body && !context->content_encoded &&
+            curl_easy_getinfo(context->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK &&
+            length > 0) {
+            (*context->on_length)(static_cast<std::size_t>(length));
+        }
+
+    }
+
+    context->decoded_bytes += total_size;
+
+    // An image body is only kept in memory while the budget has room for it; past that, it
+    // continues in the partial file like any other image
+    MemoryBudget *budget = context->client->memory_budget;
+    if (context->out_body && !context->discard_body && budget && !budget->try_reserve(total_size) &&
+        !context->client->spill_body(*context)) {
+        return 0;
+    }
+
+    if (context->discard_body) {
+        // Still read, so that the connection can be reused
+    } else if (context->out_file) {
+        const bool timed = context->client->metrics != nullptr;
+        const Metrics::clock::time_point write_start = timed ? Metrics::clock::now() : Metrics::clock::time_point();
+
+        if (fwrite(contents, 1, total_size, context->out_file) != total_size) {
+            return 0; // Makes curl abort the transfer with CURLE_WRITE_ERROR
+        }
+
+        if (timed) {
+            context->write_time += Metrics::clock::now() - write_start;
+        }
+
+        if (context->client->image_store && !context->staged) {
+            context->hasher.update(std::string_view(static_cast<char *>(contents), total_size));
+        }
+        context->check.update(std::string_view(static_cast<char *>(contents), total_size));
+    } else if (context->out_body) {
+        context->out_body->append(static_cast<char *>(contents), total_size);
+        context->check.update(std::string_view(static_cast<char *>(contents), total_size));
+    } else {
+        // Caching is best effort; a failed write only means the page is not cached
+        if (context->cache_file && !context->cache_failed &&
+            fwrite(contents, 1, total_size, context->cache_file) != total_size) {
+            context->cache_failed = true;
+        }
+
+        if (!(*context->on_chunk)(std::string_view(static_cast<char *>(contents), total_size))) {
+            return 0;
+        }
+    }
+
+    context->client->rate_limiter.consume_bytes(context->host, total_size);
     return total_size;
 }
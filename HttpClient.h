@@ -5,14 +5,53 @@
 #ifndef WEEBCENTRAL_DOWNLOAD_HTTPCLIENT_H
 #define WEEBCENTRAL_DOWNLOAD_HTTPCLIENT_H
 
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "HttpCache.h"
+#include "ImageCheck.h"
+#include "ImageStore.h"
+#include "MemoryBudget.h"
+#include "Metrics.h"
+#include "RateLimiter.h"
+#include "RetryPolicy.h"
+#include "models/ImageDownload.h"
 
 class HttpClient {
 public:
+    // Counts of how transfers obtained their connection
+    struct ConnectionStats {
+        std::size_t opened = 0; // Transfers that had to open a fresh connection (TCP + TLS handshake)
+        std::size_t reused = 0; // Transfers that were served over an already open connection
+    };
+
+    // Body sizes of the HTML responses received, as sent over the network and after decompression
+    struct HtmlStats {
+        std::size_t responses = 0;
+        std::size_t compressed = 0; // Responses sent with a Content-Encoding
+        std::uint64_t received_bytes = 0;
+        std::uint64_t decoded_bytes = 0;
+    };
+
     HttpClient();
 
     ~HttpClient();
 
+    // The client owns curl handles, so it cannot be copied
+    HttpClient(const HttpClient &) = delete;
+
+    HttpClient &operator=(const HttpClient &) = delete;
+
     /**
      * Checks if the given URI is a valid HTTP URI.
      *
@@ -32,11 +71,48 @@ public:
      * in the provided output string. It performs a network request and ensures the
      * content is fetched correctly if the given URL is valid and accessible.
      *
+     * Transient failures (timeouts, dropped connections, 5xx and 429 responses) are retried
+     * according to the retry policy. Any response other than 2xx counts as a failure.
+     *
+     * If a cache is set and not_modified is given, the request is made conditional on the
+     * validators of the cached copy. A 304 response is then answered from the cache and reported
+     * through not_modified, and a new 200 response with validators replaces the cached copy. If
+     * the cached copy cannot be read, its entry is dropped and the page requested again in full.
+     *
+     * The page is requested compressed if curl supports it, and out_html is reserved to the
+     * size of an uncompressed response up front.
+     *
      * @param url The URL from which to download the HTML content.
      * @param out_html A reference to a string where the downloaded HTML content will be stored.
+     * @param not_modified Optional; set to true if the content was served from the cache because
+     *                     the server reported it unchanged, otherwise set to false.
      * @return Returns true if the HTML content is successfully downloaded; otherwise, false.
      */
-    bool download_html(const std::string &url, std::string &out_html);
+    bool download_html(const std::string &url, std::string &out_html, bool *not_modified = nullptr);
+
+    /**
+     * Downloads the HTML content from the specified URL, passing the body on as it arrives.
+     *
+     * This behaves like download_html, but instead of collecting the body in a string, each chunk
+     * is handed to on_chunk as soon as curl receives it, so the caller can parse the page while it
+     * is still downloading. Bodies of error responses are never passed on. Every attempt starts
+     * with a call to on_begin, which must discard whatever the previous attempt delivered.
+     *
+     * After a 304 response nothing is passed on; the caller decides whether the cached body is
+     * needed at all and can replay it with HttpCache::replay_body.
+     *
+     * The body is requested with every Content-Encoding curl can decode, and the chunks are
+     * passed on decompressed.
+     *
+     * @param url The URL from which to download the HTML content.
+     * @param on_begin Called before the body of each attempt; returning false aborts the download.
+     * @param on_chunk Called with each chunk of the body; returning false aborts the download.
+     * @param not_modified Optional; set to true if the server reported the cached copy unchanged.
+     * @return Returns true if the whole body was downloaded and accepted; otherwise, false.
+     */
+    bool download_html_stream(const std::string &url, const std::function<bool()> &on_begin,
+                              const std::function<bool(std::string_view chunk)> &on_chunk,
+                              bool *not_modified = nullptr);
 
     /**
      * Downloads an image from the specified URL and saves it to the specified output path.
@@ -46,14 +122,296 @@ public:
      * the operation is successful if the URL is valid and accessible, and the output path
      * is writable.
      *
+     * The data is first written to output_path + ".part", synced to disk and only then
+     * renamed to output_path, so the final name never holds a truncated image. If a partial
+     * file is left by an earlier attempt, only the missing bytes are requested with a Range
+     * request, made conditional with If-Range on the validator the partial file was received
+     * under (kept next to it in output_path + ".part.validator"). A partial file without a
+     * validator, or one the server no longer sends a range of, is discarded and the image is
+     * downloaded from the start. Transient failures are retried according to the retry policy, and any response
+     * other than 2xx counts as a failure, so error pages are never saved as images.
+     *
+     * The image is checked with an ImageCheck as it arrives: it must start with the signature of
+     * the format its extension names and have the announced length (and, if trailer checks are
+     * on, end with its format's trailer). An image that fails is discarded and counts as a
+     * transient failure, so it is downloaded again from the start.
+     *
      * @param url The URL from which to download the image.
      * @param output_path The file path where the downloaded image will be saved.
      * @return Returns true if the image is successfully downloaded and saved; otherwise, false.
      */
     bool download_image(const std::string &url, const std::string &output_path);
 
+    /**
+     * Downloads a batch of images concurrently using the curl multi interface.
+     *
+     * Up to the configured number of transfers are kept in flight at once, with no more
+     * than the per-host limit going to any single host. Transfers are started in the order
+     * they appear in the batch, and each image is written to its output_path exactly as
+     * download_image would write and check it, or kept in its body if in_memory is set. While a memory
+     * budget is set, a body that would go over it is moved to output_path instead and in_memory
+     * is cleared, so the caller finds the image on disk. The success flag of every entry is
+     * updated, and so is its problem, which tells why the last attempt was not a valid image.
+     *
+     * @param downloads The images to download.
+     * @param on_complete Optional callback invoked as each transfer finishes, with the index
+     *                    of the entry in downloads.
+     * @return Returns true if every image was downloaded successfully; otherwise, false.
+     */
+    bool download_images(std::vector<ImageDownload> &downloads,
+                         const std::function<void(std::size_t index)> &on_complete = nullptr);
+
+    /**
+     * Sets how many transfers download_images keeps in flight.
+     *
+     * @param max_transfers Maximum number of concurrent transfers overall (at least 1).
+     * @param max_per_host Maximum number of concurrent transfers to a single host (at least 1).
+     */
+    void set_concurrency(std::size_t max_transfers, std::size_t max_per_host);
+
+    /**
+     * Sets the per-host request and bandwidth limits applied to every request of the client.
+     *
+     * @param limits The limits to apply.
+     */
+    void set_rate_limits(const RateLimiter::Limits &limits);
+
+    /**
+     * Sets how often and after how long failed requests are attempted again.
+     *
+     * @param settings The retry settings.
+     */
+    void set_retry_policy(const RetryPolicy::Settings &settings);
+
+    /**
+     * Sets whether downloaded images must also end with the trailer of their format, such as the
+     * end of image marker of a JPEG. Off by default, as some servers pad their images.
+     *
+     * @param enabled Whether to check trailers.
+     */
+    void set_trailer_check(bool enabled);
+
+    /**
+     * Returns whether downloaded images must also end with the trailer of their format.
+     *
+     * @return Returns true if trailers are checked; otherwise, false.
+     */
+    bool get_trailer_check() const;
+
+    /**
+     * Sets the cache used for conditional HTML requests.
+     *
+     * @param http_cache The cache, or nullptr to disable conditional requests. It must outlive
+     *                   the client.
+     */
+    void set_cache(HttpCache *http_cache);
+
+    /**
+     * Returns the cache used for conditional HTML requests.
+     *
+     * @return The cache, or nullptr if none is set.
+     */
+    HttpCache *get_cache() const;
+
+    /**
+     * Sets the store that downloaded images are deduplicated against. Images are hashed as they
+     * arrive and handed to the store once complete.
+     *
+     * @param store The store, or nullptr to keep every image as a file of its own. It must
+     *              outlive the client.
+     */
+    void set_image_store(ImageStore *store);
+
+    /**
+     * Returns the store that downloaded images are deduplicated against.
+     *
+     * @return The store, or nullptr if none is set.
+     */
+    ImageStore *get_image_store() const;
+
+    /**
+     * Sets the budget that image bodies kept in memory count against.
+     *
+     * @param budget The budget, or nullptr to keep in_memory bodies in memory whatever their
+     *               size. It must outlive the client.
+     */
+    void set_memory_budget(MemoryBudget *budget);
+
+    /**
+     * Returns the budget that image bodies kept in memory count against.
+     *
+     * @return The budget, or nullptr if none is set.
+     */
+    MemoryBudget *get_memory_budget() const;
+
+    /**
+     * Sets the metrics that the timings of every request attempt are recorded to.
+     *
+     * @param run_metrics The metrics, or nullptr to record nothing. They must outlive the client.
+     */
+    void set_metrics(Metrics *run_metrics);
+
+    /**
+     * Returns the metrics that request timings are recorded to.
+     *
+     * @return The metrics, or nullptr if none are set.
+     */
+    Metrics *get_metrics() const;
+
+    /**
+     * Returns the attempt statistics of all requests made so far.
+     *
+     * @return A snapshot of the retry counters.
+     */
+    RetryStats retry_stats();
+
+    /**
+     * Returns how many transfers so far opened a new connection and how many
+     * reused a pooled one.
+     *
+     * @return A snapshot of the connection counters.
+     */
+    ConnectionStats connection_stats() const;
+
+    /**
+     * Returns how many bytes of HTML were received so far and how many they decompressed to.
+     *
+     * @return A snapshot of the HTML size counters.
+     */
+    HtmlStats html_stats() const;
+
 private:
-    // Callback for writing HTML to string
+    // Destination of a transfer's body, passed to write_callback
+    struct TransferContext {
+        HttpClient *client = nullptr;
+        CURL *curl = nullptr;
+        std::string_view host;
+
+        // HTML downloads, passed on as they arrive and copied to the cache if cache_file is set
+        const std::function<bool(std::string_view chunk)> *on_chunk = nullptr;
+        FILE *cache_file = nullptr;
+        bool cache_failed = false; // Writing to cache_file failed, so the copy is incomplete
+
+        // Called once per attempt with the Content-Length of an uncompressed HTML response
+        const std::function<void(std::size_t length)> *on_length = nullptr;
+
+        // Validators of the response, captured by header_callback for the cache
+        std::string etag;
+        std::string last_modified;
+        bool content_encoded = false; // The response has a Content-Encoding other than identity
+        std::uint64_t decoded_bytes = 0; // Body bytes of the attempt after decompression
+
+        // Image downloads, written to temp_path and renamed to output_path once complete, or
+        // kept in out_body if it is set, for as long as the memory budget allows
+        FILE *out_file = nullptr;
+        std::string *out_body = nullptr;
+        std::string *out_validator = nullptr; // Where the validator of a partial out_body is kept
+        std::string output_path;
+        std::string temp_path;
+        curl_off_t resume_from = 0; // Size of the partial image the transfer continues
+        std::string range_validator; // Validator the partial image was received under, sent as If-Range
+        curl_slist *range_headers = nullptr;
+        ImageStore::Hasher hasher; // Hash of the image file so far, kept while an image store is set
+        bool staged = false; // The image file is staged for an archive and kept out of the image store
+        ImageCheck check; // Signature, trailer and length of the image so far
+        ImageCheck::Problem problem = ImageCheck::Problem::none; // What was wrong with the last attempt
+
+        // Time the current attempt spent writing to disk, measured while metrics are set
+        Metrics::clock::duration write_time{};
+
+        bool response_checked = false; // The status of the response was looked at
+        bool discard_body = false; // The response is an error page
+    };
+
+    // Shared connection pool, DNS cache and TLS session cache used by every handle
+    CURLSH *share = nullptr;
+
+    // One mutex per kind of shared data, used by the share lock callbacks
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> share_mutexes;
+
+    // Easy handles that are not currently performing a transfer
+    std::vector<CURL *> idle_handles;
+    std::mutex idle_handles_mutex;
+
+    std::size_t max_transfers = 1;
+    std::size_t max_transfers_per_host = 1;
+
+    RateLimiter rate_limiter;
+    RetryPolicy retry_policy;
+    bool check_trailers = false;
+
+    HttpCache *cache = nullptr;
+    ImageStore *image_store = nullptr;
+    MemoryBudget *memory_budget = nullptr;
+    Metrics *metrics = nullptr;
+
+    RetryStats retry_statistics;
+    std::mutex retry_stats_mutex;
+
+    std::atomic<std::size_t> connections_opened{0};
+    std::atomic<std::size_t> connections_reused{0};
+
+    std::atomic<std::size_t> html_responses{0};
+    std::atomic<std::size_t> html_compressed{0};
+    std::atomic<std::uint64_t> html_received_bytes{0};
+    std::atomic<std::uint64_t> html_decoded_bytes{0};
+
+    // Downloads an HTML page for download_html and download_html_stream; on_length is optional
+    bool fetch_html(const std::string &url, const std::function<bool()> &on_begin,
+                    const std::function<bool(std::string_view chunk)> &on_chunk, bool *not_modified,
+                    const std::function<void(std::size_t length)> *on_length);
+
+    // Takes an idle easy handle (or creates one) and prepares it for a request to url
+    CURL *acquire_handle(const std::string &url);
+
+    // Returns an easy handle to the idle list so its connection can be reused
+    void release_handle(CURL *curl);
+
+    // Updates the connection counters from a finished transfer
+    void record_connection(CURL *curl, CURLcode result);
+
+    // Updates the HTML size counters from a finished attempt
+    void record_html_size(CURL *curl, const TransferContext &context);
+
+    // Opens the partial file of an image download, resuming with a Range request if it has data
+    bool open_image_file(CURL *curl, TransferContext &context);
+
+    // Closes the partial file of an image download and renames it to its final name if the
+    // transfer succeeded and the image passed its check; the partial file is kept on other
+    // failures so the next attempt can resume
+    RetryPolicy::Failure close_image_file(CURL *curl, TransferContext &context, CURLcode result);
+
+    // Drops the partial image of a download, in memory or on disk, together with its validator
+    void discard_partial(TransferContext &context);
+
+    // Moves an image body that no longer fits the memory budget to the partial file, where the
+    // rest of the transfer goes too
+    bool spill_body(TransferContext &context);
+
+    // Empties the body of an in-memory image download, giving its memory back to the budget
+    void drop_body(TransferContext &context);
+
+    // Classifies a finished attempt, honoring any rate limiting the server asked for
+    RetryPolicy::Failure classify_response(CURL *curl, std::string_view host, CURLcode result);
+
+    void record_attempt(RetryPolicy::Failure failure, int attempt, bool final);
+
+    // Records the timings of a finished attempt to the metrics, if any are set
+    void record_transfer(CURL *curl, const TransferContext &context, std::string_view kind, int attempt,
+                         CURLcode result);
+
+    // Blocks the host in the rate limiter if the last response was a 429 (or a 503 with
+    // Retry-After); returns true if it was, meaning the request should be sent again
+    bool handle_rate_limited(CURL *curl, std::string_view host);
+
+    static void share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userp);
+
+    static void share_unlock(CURL *handle, curl_lock_data data, void *userp);
+
+    // Callback for capturing the validators and the encoding of a response
+    static size_t header_callback(char *buffer, size_t size, size_t nitems, void *userp);
+
+    // Callback for passing a response body on to a callback or writing it to a file
     static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp);
 };
 
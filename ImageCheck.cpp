@@ -0,0 +1,211 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "ImageCheck.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+
+namespace {
+    constexpr unsigned char jpegSignature[] = {0xFF, 0xD8, 0xFF};
+    constexpr unsigned char jpegTrailer[] = {0xFF, 0xD9}; // End of image marker
+    constexpr unsigned char pngSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    constexpr unsigned char pngTrailer[] = {'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82}; // IEND chunk and its CRC
+    constexpr unsigned char riffSignature[] = {'R', 'I', 'F', 'F'}; // Followed by the size, then "WEBP"
+    constexpr unsigned char webpSignature[] = {'W', 'E', 'B', 'P'};
+    constexpr unsigned char gif87Signature[] = {'G', 'I', 'F', '8', '7', 'a'};
+    constexpr unsigned char gif89Signature[] = {'G', 'I', 'F', '8', '9', 'a'};
+    constexpr unsigned char gifTrailer[] = {0x3B};
+
+    // Whether the first bytes of an image, of which available were received, hold prefix at offset at
+    template<std::size_t Size, std::size_t N>
+    bool startsWith(const std::array<unsigned char, Size> &head, std::uint64_t available,
+                    const unsigned char (&prefix)[N], std::size_t at = 0) {
+        return available >= at + N && std::memcmp(head.data() + at, prefix, N) == 0;
+    }
+
+    // Whether the last bytes of an image, of which available were received, end with suffix
+    template<std::size_t Size, std::size_t N>
+    bool endsWith(const std::array<unsigned char, Size> &tail, std::uint64_t available,
+                  const unsigned char (&suffix)[N]) {
+        return available >= N && std::memcmp(tail.data() + Size - N, suffix, N) == 0;
+    }
+}
+
+ImageCheck::Format ImageCheck::format_of(std::string_view path) {
+    const std::size_t dot = path.find_last_of("./\\");
+    if (dot == std::string_view::npos || path[dot] != '.') {
+        return Format::unknown;
+    }
+
+    std::array<char, 5> extension{};
+    const std::string_view name = path.substr(dot + 1);
+    if (name.size() > extension.size()) {
+        return Format::unknown;
+    }
+    std::ranges::transform(name, extension.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    const std::string_view lower(extension.data(), name.size());
+    if (lower == "jpg" || lower == "jpeg") {
+        return Format::jpeg;
+    }
+    if (lower == "png") {
+        return Format::png;
+    }
+    if (lower == "webp") {
+        return Format::webp;
+    }
+    if (lower == "gif") {
+        return Format::gif;
+    }
+    return Format::unknown;
+}
+
+std::string_view ImageCheck::describe(Problem problem, Format format) {
+    switch (problem) {
+        case Problem::none:
+            return "valid";
+        case Problem::empty:
+            return "empty";
+        case Problem::wrong_format:
+            switch (format) {
+                case Format::jpeg:
+                    return "not a JPEG image";
+                case Format::png:
+                    return "not a PNG image";
+                case Format::webp:
+                    return "not a WebP image";
+                case Format::gif:
+                    return "not a GIF image";
+                default:
+                    return "not an image";
+            }
+        case Problem::wrong_length:
+            return "length does not match Content-Length";
+        case Problem::truncated:
+            return "truncated";
+    }
+    return "invalid";
+}
+
+void ImageCheck::reset(Format expected) {
+    this->expected = expected;
+    restart();
+}
+
+void ImageCheck::restart() {
+    head.fill(0);
+    tail.fill(0);
+    total = 0;
+}
+
+void ImageCheck::update(std::string_view data) {
+    const auto *bytes = reinterpret_cast<const unsigned char *>(data.data());
+
+    if (total < kept) {
+        const std::size_t count = std::min<std::size_t>(kept - total, data.size());
+        std::memcpy(head.data() + total, bytes, count);
+    }
+
+    // The tail keeps the last bytes at its end, whether they arrived in one chunk or many
+    if (data.size() >= kept) {
+        std::memcpy(tail.data(), bytes + data.size() - kept, kept);
+    } else if (!data.empty()) {
+        std::memmove(tail.data(), tail.data() + data.size(), kept - data.size());
+        std::memcpy(tail.data() + kept - data.size(), bytes, data.size());
+    }
+
+    total += data.size();
+}
+
+bool ImageCheck::resume(const std::filesystem::path &path, std::uint64_t size) {
+    restart();
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::array<char, kept> bytes{};
+    const std::size_t head_size = static_cast<std::size_t>(std::min<std::uint64_t>(size, kept));
+    if (!file.read(bytes.data(), static_cast<std::streamsize>(head_size))) {
+        return false;
+    }
+    update(std::string_view(bytes.data(), head_size));
+
+    // Everything between the first and last bytes only counts towards the length
+    if (size > head_size) {
+        const std::size_t tail_size = static_cast<std::size_t>(std::min<std::uint64_t>(size - head_size, kept));
+        file.seekg(static_cast<std::streamoff>(size - tail_size));
+        if (!file.read(bytes.data(), static_cast<std::streamsize>(tail_size))) {
+            return false;
+        }
+        total = size - tail_size;
+        update(std::string_view(bytes.data(), tail_size));
+    }
+
+    return true;
+}
+
+ImageCheck::Problem ImageCheck::finish(std::int64_t expected_size, bool check_trailer) const {
+    if (total == 0) {
+        return Problem::empty;
+    }
+
+    if (expected_size >= 0 && total != static_cast<std::uint64_t>(expected_size)) {
+        return Problem::wrong_length;
+    }
+
+    switch (expected) {
+        case Format::jpeg:
+            if (!startsWith(head, total, jpegSignature)) {
+                return Problem::wrong_format;
+            }
+            if (check_trailer && !endsWith(tail, total, jpegTrailer)) {
+                return Problem::truncated;
+            }
+            break;
+        case Format::png:
+            if (!startsWith(head, total, pngSignature)) {
+                return Problem::wrong_format;
+            }
+            if (check_trailer && !endsWith(tail, total, pngTrailer)) {
+                return Problem::truncated;
+            }
+            break;
+        case Format::webp: {
+            if (!startsWith(head, total, riffSignature) || !startsWith(head, total, webpSignature, 8)) {
+                return Problem::wrong_format;
+            }
+
+            // The RIFF header gives the size of everything after its first 8 bytes, little endian
+            std::uint64_t riff_size = 0;
+            for (int i = 7; i >= 4; --i) {
+                riff_size = riff_size << 8 | head[i];
+            }
+            if (check_trailer && riff_size + 8 != total) {
+                return Problem::truncated;
+            }
+            break;
+        }
+        case Format::gif:
+            if (!startsWith(head, total, gif87Signature) && !startsWith(head, total, gif89Signature)) {
+                return Problem::wrong_format;
+            }
+            if (check_trailer && !endsWith(tail, total, gifTrailer)) {
+                return Problem::truncated;
+            }
+            break;
+        case Format::unknown:
+            break;
+    }
+
+    return Problem::none;
+}
+
+ImageCheck::Format ImageCheck::format() const {
+    return expected;
+}
@@ -0,0 +1,107 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_IMAGECHECK_H
+#define WEEBCENTRAL_DOWNLOAD_IMAGECHECK_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+/**
+ * Checks that a downloaded image is what its file name says it is, fed as the bytes arrive.
+ *
+ * Only the first and last few bytes of the image are kept, so checking costs no memory and no
+ * second read of the file. The first bytes must hold the signature of the format the extension
+ * names (JPEG, PNG, WebP or GIF), which catches HTML error pages and empty bodies sent with a
+ * 200, and the image must have the length the server announced. Optionally, the last bytes must
+ * hold the format's trailer (the JPEG end of image marker, the PNG IEND chunk, the GIF trailer
+ * or, for WebP, a RIFF size matching the length), which catches images cut short by a server
+ * that closed the connection without an error. Other extensions are only checked for length.
+ */
+class ImageCheck {
+public:
+    enum class Format {
+        unknown,
+        jpeg,
+        png,
+        webp,
+        gif
+    };
+
+    // What is wrong with an image
+    enum class Problem {
+        none,
+        empty, // No bytes were received
+        wrong_format, // The image does not start with the signature of its format
+        wrong_length, // The image is not as long as the server said it would be
+        truncated // The image does not end with the trailer of its format
+    };
+
+    /**
+     * Returns the format an image file name stands for.
+     *
+     * @param path The file name or path of the image; only its extension is looked at.
+     * @return The format, or Format::unknown for an extension that is not checked.
+     */
+    static Format format_of(std::string_view path);
+
+    /**
+     * Returns a short description of a problem for messages, e.g. "not a JPEG image".
+     */
+    static std::string_view describe(Problem problem, Format format);
+
+    /**
+     * Starts checking a new image, forgetting everything given so far.
+     *
+     * @param expected The format the image must be in.
+     */
+    void reset(Format expected);
+
+    /**
+     * Starts the current image over, e.g. when a server sends it from the start again.
+     */
+    void restart();
+
+    /**
+     * Feeds the bytes that follow those given so far.
+     *
+     * @param data The next bytes.
+     */
+    void update(std::string_view data);
+
+    /**
+     * Feeds the part of an image received by an earlier attempt, reading only its first and last
+     * bytes instead of the whole file.
+     *
+     * @param path The partial file.
+     * @param size The size of the partial file.
+     * @return Returns true if the file could be read; otherwise, false.
+     */
+    bool resume(const std::filesystem::path &path, std::uint64_t size);
+
+    /**
+     * Checks everything given since the last reset.
+     *
+     * @param expected_size The length the server announced, or a negative value if unknown.
+     * @param check_trailer Whether the image must end with the trailer of its format.
+     * @return Problem::none if the image passed every check, otherwise the first problem found.
+     */
+    Problem finish(std::int64_t expected_size, bool check_trailer) const;
+
+    Format format() const;
+
+private:
+    // Enough for the longest signature (WebP's 12 bytes) and trailer (PNG's 8 bytes)
+    static constexpr std::size_t kept = 12;
+
+    Format expected = Format::unknown;
+    std::array<unsigned char, kept> head{};
+    std::array<unsigned char, kept> tail{}; // The last bytes given, oldest first
+    std::uint64_t total = 0;
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_IMAGECHECK_H
@@ -0,0 +1,244 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "ImageStore.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // Constants of XXH64
+    constexpr std::uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    constexpr std::uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr std::uint64_t prime3 = 0x165667B19E3779F9ULL;
+    constexpr std::uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+    constexpr std::uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+    std::uint64_t rotateLeft(std::uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    // XXH64 reads its input as little endian words, whatever the machine
+    std::uint64_t read64(const unsigned char *p) {
+        std::uint64_t value = 0;
+        for (int i = 7; i >= 0; --i) {
+            value = value << 8 | p[i];
+        }
+        return value;
+    }
+
+    std::uint32_t read32(const unsigned char *p) {
+        return static_cast<std::uint32_t>(p[0]) | static_cast<std::uint32_t>(p[1]) << 8 |
+               static_cast<std::uint32_t>(p[2]) << 16 | static_cast<std::uint32_t>(p[3]) << 24;
+    }
+
+    std::uint64_t round(std::uint64_t accumulator, std::uint64_t input) {
+        accumulator += input * prime2;
+        return rotateLeft(accumulator, 31) * prime1;
+    }
+
+    std::uint64_t mergeRound(std::uint64_t hash, std::uint64_t accumulator) {
+        hash ^= round(0, accumulator);
+        return hash * prime1 + prime4;
+    }
+
+    void consumeStripe(std::array<std::uint64_t, 4> &accumulators, const unsigned char *stripe) {
+        for (std::size_t lane = 0; lane < 4; ++lane) {
+            accumulators[lane] = round(accumulators[lane], read64(stripe + lane * 8));
+        }
+    }
+}
+
+ImageStore::Hasher::Hasher() {
+    reset();
+}
+
+void ImageStore::Hasher::reset() {
+    // Seed 0
+    accumulators = {prime1 + prime2, prime2, 0, 0 - prime1};
+    buffered = 0;
+    total = 0;
+}
+
+void ImageStore::Hasher::update(std::string_view data) {
+    const auto *p = reinterpret_cast<const unsigned char *>(data.data());
+    std::size_t length = data.size();
+    total += length;
+
+    // Complete a stripe left over from the previous chunk first
+    if (buffered > 0) {
+        std::size_t take = std::min(length, buffer.size() - buffered);
+        std::memcpy(buffer.data() + buffered, p, take);
+        buffered += take;
+        p += take;
+        length -= take;
+
+        if (buffered < buffer.size()) {
+            return;
+        }
+        consumeStripe(accumulators, buffer.data());
+        buffered = 0;
+    }
+
+    for (; length >= buffer.size(); p += buffer.size(), length -= buffer.size()) {
+        consumeStripe(accumulators, p);
+    }
+
+    std::memcpy(buffer.data(), p, length);
+    buffered = length;
+}
+
+std::uint64_t ImageStore::Hasher::digest() const {
+    std::uint64_t hash;
+    if (total >= buffer.size()) {
+        hash = rotateLeft(accumulators[0], 1) + rotateLeft(accumulators[1], 7) +
+               rotateLeft(accumulators[2], 12) + rotateLeft(accumulators[3], 18);
+        for (std::uint64_t accumulator: accumulators) {
+            hash = mergeRound(hash, accumulator);
+        }
+    } else {
+        hash = prime5;
+    }
+
+    hash += total;
+
+    const unsigned char *p = buffer.data();
+    std::size_t length = buffered;
+    for (; length >= 8; p += 8, length -= 8) {
+        hash ^= round(0, read64(p));
+        hash = rotateLeft(hash, 27) * prime1 + prime4;
+    }
+    if (length >= 4) {
+        hash ^= static_cast<std::uint64_t>(read32(p)) * prime1;
+        hash = rotateLeft(hash, 23) * prime2 + prime3;
+        p += 4;
+        length -= 4;
+    }
+    for (; length > 0; ++p, --length) {
+        hash ^= *p * prime5;
+        hash = rotateLeft(hash, 11) * prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::uint64_t ImageStore::Hasher::size() const {
+    return total;
+}
+
+ImageStore::ImageStore(std::filesystem::path directory) : directory(std::move(directory)) {
+}
+
+bool ImageStore::hash_file(const std::filesystem::path &path, Hasher &hasher) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::array<char, 64 * 1024> chunk;
+    while (file) {
+        file.read(chunk.data(), chunk.size());
+        hasher.update(std::string_view(chunk.data(), static_cast<std::size_t>(file.gcount())));
+    }
+
+    return !file.bad();
+}
+
+bool ImageStore::adopt(const std::filesystem::path &downloaded_path, const std::filesystem::path &output_path,
+                       const Hasher &hasher) {
+    const std::filesystem::path object = object_path(hasher);
+    std::error_code ec;
+
+    // Known content: the download is only needed until the link exists
+    std::uintmax_t object_size = std::filesystem::file_size(object, ec);
+    if (!ec && object_size == hasher.size()) {
+        if (!link(object, output_path)) {
+            return false;
+        }
+
+        std::filesystem::remove(downloaded_path, ec);
+        linked++;
+        bytes_saved += hasher.size();
+        return true;
+    }
+
+    std::filesystem::create_directories(object.parent_path(), ec);
+    if (ec) {
+        return false;
+    }
+
+    // Fails if the store is on another file system, where it could not be linked to anyway
+    std::filesystem::rename(downloaded_path, object, ec);
+    if (ec) {
+        return false;
+    }
+
+    if (!link(object, output_path)) {
+        std::filesystem::rename(object, downloaded_path, ec);
+        return false;
+    }
+
+    stored++;
+    return true;
+}
+
+ImageStore::Stats ImageStore::stats() const {
+    return {stored.load(), linked.load(), bytes_saved.load()};
+}
+
+std::filesystem::path ImageStore::object_path(const Hasher &hasher) const {
+    char name[48];
+    const std::uint64_t hash = hasher.digest();
+    std::snprintf(name, sizeof(name), "%016llx-%llu", static_cast<unsigned long long>(hash),
+                  static_cast<unsigned long long>(hasher.size()));
+    return directory / std::string_view(name, 2) / name;
+}
+
+bool ImageStore::link(const std::filesystem::path &object, const std::filesystem::path &output_path) {
+    std::error_code ec;
+
+    // A truncated image that is downloaded again is replaced
+    std::filesystem::remove(output_path, ec);
+
+    std::filesystem::create_hard_link(object, output_path, ec);
+    if (!ec) {
+        return true;
+    }
+
+#ifdef __linux__
+    // File systems like btrfs and XFS can share the blocks of a copy instead
+    int source = ::open(object.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source >= 0) {
+        int target = ::open(output_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        bool cloned = target >= 0 && ::ioctl(target, FICLONE, source) == 0;
+        if (target >= 0) {
+            cloned = ::close(target) == 0 && cloned;
+        }
+        ::close(source);
+
+        if (cloned) {
+            return true;
+        }
+        std::filesystem::remove(output_path, ec);
+    }
+#endif
+
+    // A copy would save nothing, so the caller keeps its own file instead
+    return false;
+}
@@ -0,0 +1,117 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_IMAGESTORE_H
+#define WEEBCENTRAL_DOWNLOAD_IMAGESTORE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+/**
+ * Content-addressed store that keeps a single copy of every distinct image.
+ *
+ * Downloaded images are identified by a 64-bit XXH64 hash of their contents together with
+ * their size. The first time some content is seen, the file moves into the store; the chapter
+ * folder gets a hard link to it, or a reflink where the file system cannot hard link. Images
+ * that repeat across chapters and series, such as credit pages, then take up disk space only
+ * once. Where neither kind of link is possible, images are kept as plain files as before.
+ *
+ * Objects are named <hash>-<size> in one of 256 subfolders picked by the first byte of the
+ * hash. The store must be on the same file system as the download folders for links to work.
+ */
+class ImageStore {
+public:
+    /**
+     * Streaming XXH64 hash of an image's contents, fed as the bytes arrive.
+     */
+    class Hasher {
+    public:
+        Hasher();
+
+        /**
+         * Starts over, forgetting everything hashed so far.
+         */
+        void reset();
+
+        /**
+         * Hashes the bytes that follow those given so far.
+         *
+         * @param data The next bytes.
+         */
+        void update(std::string_view data);
+
+        /**
+         * Returns the hash of every byte given since the last reset.
+         */
+        std::uint64_t digest() const;
+
+        /**
+         * Returns how many bytes were given since the last reset.
+         */
+        std::uint64_t size() const;
+
+    private:
+        std::array<std::uint64_t, 4> accumulators{};
+        std::array<unsigned char, 32> buffer{}; // Bytes not yet forming a full 32-byte stripe
+        std::size_t buffered = 0;
+        std::uint64_t total = 0;
+    };
+
+    // Counters of what the store saved so far
+    struct Stats {
+        std::size_t stored = 0; // Images whose content was new
+        std::size_t linked = 0; // Images whose content was already in the store
+        std::uint64_t bytes_saved = 0; // Size of the linked images
+    };
+
+    explicit ImageStore(std::filesystem::path directory);
+
+    /**
+     * Hashes the contents of a file, e.g. the part of an image received by an earlier run.
+     *
+     * @param path The file to read.
+     * @param hasher Receives the file's contents.
+     * @return Returns true if the whole file was read; otherwise, false.
+     */
+    static bool hash_file(const std::filesystem::path &path, Hasher &hasher);
+
+    /**
+     * Puts a completely downloaded image in its place, keeping one copy per content.
+     *
+     * If the store already holds the content, the downloaded file is deleted and output_path
+     * is linked to the stored copy. Otherwise the file moves into the store and output_path
+     * is linked to it.
+     *
+     * @param downloaded_path The complete, synced download.
+     * @param output_path Where the image belongs in its chapter folder.
+     * @param hasher The hash of the download's contents.
+     * @return Returns true if output_path now holds the image; false if nothing was changed,
+     *         in which case downloaded_path is still there.
+     */
+    bool adopt(const std::filesystem::path &downloaded_path, const std::filesystem::path &output_path,
+               const Hasher &hasher);
+
+    /**
+     * Returns the counters of the store.
+     */
+    Stats stats() const;
+
+private:
+    const std::filesystem::path directory;
+
+    std::atomic<std::size_t> stored{0};
+    std::atomic<std::size_t> linked{0};
+    std::atomic<std::uint64_t> bytes_saved{0};
+
+    std::filesystem::path object_path(const Hasher &hasher) const;
+
+    // Makes output_path another name for the stored object
+    static bool link(const std::filesystem::path &object, const std::filesystem::path &output_path);
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_IMAGESTORE_H
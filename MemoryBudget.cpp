@@ -0,0 +1,41 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "MemoryBudget.h"
+
+MemoryBudget::MemoryBudget(std::uint64_t limit) : limit(limit) {
+}
+
+bool MemoryBudget::try_reserve(std::size_t bytes) {
+    std::uint64_t current = used.load();
+    do {
+        if (current + bytes > limit) {
+            return false;
+        }
+    } while (!used.compare_exchange_weak(current, current + bytes));
+
+    // Another thread may have raised the peak in the meantime; only ever move it up
+    const std::uint64_t now_used = current + bytes;
+    std::uint64_t previous_peak = peak.load();
+    while (now_used > previous_peak && !peak.compare_exchange_weak(previous_peak, now_used)) {
+    }
+
+    return true;
+}
+
+void MemoryBudget::release(std::size_t bytes) {
+    used -= bytes;
+}
+
+void MemoryBudget::record_spill() {
+    ++spilled;
+}
+
+MemoryBudget::Stats MemoryBudget::stats() const {
+    Stats stats;
+    stats.limit = limit;
+    stats.peak = peak.load();
+    stats.spilled = spilled.load();
+    return stats;
+}
@@ -0,0 +1,64 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_MEMORYBUDGET_H
+#define WEEBCENTRAL_DOWNLOAD_MEMORYBUDGET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Caps how many bytes of downloaded bodies are held in memory at the same time, across every
+ * worker and transfer of a run.
+ *
+ * Memory is reserved before a chunk is kept and released once it has been written out. A
+ * reservation that does not fit is refused rather than waited for, so the caller falls back to
+ * writing the body to disk; nothing ever blocks on the budget, which keeps a transfer that holds
+ * memory from waiting on one that needs it.
+ *
+ * All methods are thread-safe.
+ */
+class MemoryBudget {
+public:
+    struct Stats {
+        std::uint64_t limit = 0;
+        std::uint64_t peak = 0; // Most bytes that were held at the same time
+        std::size_t spilled = 0; // Bodies that were written to disk because the budget was used up
+    };
+
+    /**
+     * @param limit The most bytes that may be held at the same time; 0 keeps nothing in memory.
+     */
+    explicit MemoryBudget(std::uint64_t limit);
+
+    /**
+     * Reserves memory for bytes that are about to be kept, if the budget still has room for them.
+     *
+     * @param bytes The number of bytes.
+     * @return Returns true if the bytes were reserved; false if they would go over the limit.
+     */
+    bool try_reserve(std::size_t bytes);
+
+    /**
+     * Gives back memory reserved by try_reserve once the bytes are no longer held.
+     *
+     * @param bytes The number of bytes, at most what is reserved.
+     */
+    void release(std::size_t bytes);
+
+    // Counts a body that went to disk because try_reserve refused it
+    void record_spill();
+
+    Stats stats() const;
+
+private:
+    const std::uint64_t limit;
+
+    std::atomic<std::uint64_t> used{0};
+    std::atomic<std::uint64_t> peak{0};
+    std::atomic<std::size_t> spilled{0};
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_MEMORYBUDGET_H
@@ -0,0 +1,365 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "Metrics.h"
+
+#include <algorithm>
+
+#include "Url.h"
+
+namespace {
+    // What the calling thread is working on, set by Metrics::Label
+    thread_local std::string currentLabel;
+
+    // Small sequential thread numbers read better in a trace than native thread IDs
+    std::atomic<int> nextThreadId{1};
+
+    int threadId() {
+        thread_local const int id = nextThreadId++;
+        return id;
+    }
+
+    void appendJsonString(std::string &out, std::string_view text) {
+        out += '"';
+        for (char c: text) {
+            switch (c) {
+                case '"':
+                    out += "\\\"";
+                    break;
+                case '\\':
+                    out += "\\\\";
+                    break;
+                case '\n':
+                    out += "\\n";
+                    break;
+                case '\r':
+                    out += "\\r";
+                    break;
+                case '\t':
+                    out += "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char escaped[8];
+                        std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+                        out += escaped;
+                    } else {
+                        out += c;
+                    }
+            }
+        }
+        out += '"';
+    }
+
+    void appendNumber(std::string &out, double value, int decimals = 3) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.*f", decimals, value);
+        out += text;
+    }
+
+    void appendField(std::string &out, std::string_view name, std::string_view value) {
+        out += ",\"";
+        out += name;
+        out += "\":";
+        appendJsonString(out, value);
+    }
+
+    void appendField(std::string &out, std::string_view name, double value, int decimals = 3) {
+        out += ",\"";
+        out += name;
+        out += "\":";
+        appendNumber(out, value, decimals);
+    }
+
+    void appendField(std::string &out, std::string_view name, std::uint64_t value) {
+        out += ",\"";
+        out += name;
+        out += "\":";
+        out += std::to_string(value);
+    }
+
+    // Phases of a transfer, in seconds, from the times at which curl saw each of them end
+    struct Phases {
+        double dns;
+        double connect;
+        double tls;
+        double wait;
+        double receive;
+    };
+
+    Phases phasesOf(const Metrics::Transfer &transfer) {
+        Phases phases{};
+        phases.dns = transfer.name_lookup;
+        phases.connect = transfer.connect > 0 ? std::max(transfer.connect - transfer.name_lookup, 0.0) : 0;
+        phases.tls = transfer.tls > 0 ? std::max(transfer.tls - transfer.connect, 0.0) : 0;
+        if (transfer.first_byte > 0) {
+            phases.wait = std::max(transfer.first_byte - transfer.pretransfer, 0.0);
+            phases.receive = std::max(transfer.total - transfer.first_byte, 0.0);
+        }
+        return phases;
+    }
+
+    bool isStorageStage(std::string_view stage) {
+        return stage == "manifest" || stage == "index" || stage == "archive";
+    }
+}
+
+Metrics::Label::Label(std::string_view label) : previous(std::move(currentLabel)) {
+    currentLabel = label;
+}
+
+Metrics::Label::~Label() {
+    currentLabel = std::move(previous);
+}
+
+Metrics::Span::Span(Metrics *metrics, std::string_view stage, std::string_view detail)
+    : metrics(metrics), stage(stage), detail(detail), start(clock::now()) {
+}
+
+Metrics::Span::~Span() {
+    if (metrics) {
+        metrics->record_stage(stage, detail, clock::now() - start);
+    }
+}
+
+Metrics::Metrics() : start(clock::now()) {
+}
+
+Metrics::~Metrics() {
+    close();
+}
+
+bool Metrics::open(const std::string &log_path, const std::string &trace_path) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!log_path.empty()) {
+        log_file = fopen(log_path.c_str(), "w");
+        if (!log_file) {
+            return false;
+        }
+        logging = true;
+    }
+
+    if (!trace_path.empty()) {
+        trace_file = fopen(trace_path.c_str(), "w");
+        if (!trace_file) {
+            return false;
+        }
+
+        // The JSON array form of the format stays readable even if the run never closes it
+        std::fputs("[\n", trace_file);
+        first_trace_event = true;
+        tracing = true;
+    }
+
+    return true;
+}
+
+void Metrics::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    logging = false;
+    tracing = false;
+
+    if (log_file) {
+        std::string line = "{\"type\":\"totals\"";
+        appendField(line, "time", timestamp(clock::now()) / 1e6);
+        appendField(line, "transfers", static_cast<std::uint64_t>(sums.transfers));
+        appendField(line, "bytes", sums.bytes);
+        appendField(line, "dns_ms", sums.dns * 1000);
+        appendField(line, "connect_ms", sums.connect * 1000);
+        appendField(line, "tls_ms", sums.tls * 1000);
+        appendField(line, "wait_ms", sums.wait * 1000);
+        appendField(line, "receive_ms", sums.receive * 1000);
+        appendField(line, "write_ms", sums.write * 1000);
+        appendField(line, "parse_ms", sums.parse * 1000);
+        appendField(line, "storage_ms", sums.storage * 1000);
+        line += "}\n";
+        std::fputs(line.c_str(), log_file);
+
+        fclose(log_file);
+        log_file = nullptr;
+    }
+
+    if (trace_file) {
+        std::fputs("\n]\n", trace_file);
+        fclose(trace_file);
+        trace_file = nullptr;
+    }
+}
+
+void Metrics::name_thread(std::string_view name) {
+    std::string event = "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(threadId()) +
+                        ",\"args\":{\"name\":";
+    appendJsonString(event, name);
+    event += "}}";
+
+    std::lock_guard<std::mutex> lock(mutex);
+    write_trace_event(event);
+}
+
+void Metrics::record_transfer(const Transfer &transfer) {
+    const clock::time_point end = clock::now();
+    const Phases phases = phasesOf(transfer);
+
+    std::string line;
+    if (logging) {
+        line = "{\"type\":\"transfer\"";
+        appendField(line, "time", timestamp(end) / 1e6);
+        appendField(line, "series", currentLabel);
+        appendField(line, "kind", transfer.kind);
+        appendField(line, "url", transfer.url);
+        appendField(line, "attempt", static_cast<std::uint64_t>(transfer.attempt));
+        appendField(line, "result", static_cast<std::uint64_t>(transfer.result));
+        appendField(line, "status", static_cast<std::uint64_t>(transfer.status));
+        line += ",\"reused\":";
+        line += transfer.reused_connection ? "true" : "false";
+        appendField(line, "bytes", transfer.bytes);
+        appendField(line, "dns_ms", phases.dns * 1000);
+        appendField(line, "connect_ms", phases.connect * 1000);
+        appendField(line, "tls_ms", phases.tls * 1000);
+        appendField(line, "wait_ms", phases.wait * 1000);
+        appendField(line, "receive_ms", phases.receive * 1000);
+        appendField(line, "total_ms", transfer.total * 1000);
+        appendField(line, "write_ms", transfer.write * 1000);
+        line += "}\n";
+    }
+
+    // Concurrent transfers overlap on one thread, so they are async events rather than spans
+    std::string events;
+    if (tracing) {
+        const std::string id = std::to_string(next_transfer_id++);
+        const std::string tid = std::to_string(threadId());
+        const double end_us = timestamp(end);
+        const double start_us = end_us - transfer.total * 1e6;
+
+        auto event = [&](char phase, std::string_view name, double at, bool with_args) {
+            if (!events.empty()) {
+                events += ",\n";
+            }
+            events += "{\"name\":";
+            appendJsonString(events, name);
+            events += ",\"cat\":\"http\",\"ph\":\"";
+            events += phase;
+            events += "\",\"id\":" + id + ",\"pid\":1,\"tid\":" + tid + ",\"ts\":";
+            appendNumber(events, at, 1);
+            if (with_args) {
+                events += ",\"args\":{\"url\":";
+                appendJsonString(events, transfer.url);
+                appendField(events, "series", currentLabel);
+                appendField(events, "status", static_cast<std::uint64_t>(transfer.status));
+                appendField(events, "bytes", transfer.bytes);
+                appendField(events, "attempt", static_cast<std::uint64_t>(transfer.attempt));
+                appendField(events, "write_ms", transfer.write * 1000);
+                events += "}";
+            }
+            events += "}";
+        };
+
+        auto phase = [&](std::string_view name, double from, double to) {
+            if (to > from) {
+                event('b', name, start_us + from * 1e6, false);
+                event('e', name, start_us + to * 1e6, false);
+            }
+        };
+
+        std::string name(transfer.kind);
+        name += ' ';
+        name += Url::filename(transfer.url);
+
+        event('b', name, start_us, true);
+        phase("dns", 0, transfer.name_lookup);
+        phase("connect", transfer.name_lookup, transfer.connect);
+        if (transfer.tls > 0) {
+            phase("tls", transfer.connect, transfer.tls);
+        }
+        if (transfer.first_byte > 0) {
+            phase("wait", transfer.pretransfer, transfer.first_byte);
+            phase("receive", transfer.first_byte, transfer.total);
+        }
+        event('e', name, end_us, false);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    sums.transfers++;
+    sums.bytes += transfer.bytes;
+    sums.dns += phases.dns;
+    sums.connect += phases.connect;
+    sums.tls += phases.tls;
+    sums.wait += phases.wait;
+    sums.receive += phases.receive;
+    sums.write += transfer.write;
+
+    // The files may have been opened or closed since the record was formatted
+    if (log_file && !line.empty()) {
+        std::fputs(line.c_str(), log_file);
+    }
+    if (trace_file && !events.empty()) {
+        write_trace_event(events);
+    }
+}
+
+void Metrics::record_stage(std::string_view stage, std::string_view detail, clock::duration duration) {
+    const clock::time_point end = clock::now();
+    const double seconds = std::chrono::duration<double>(duration).count();
+
+    std::string line;
+    if (logging) {
+        line = "{\"type\":\"stage\"";
+        appendField(line, "time", timestamp(end) / 1e6);
+        appendField(line, "series", currentLabel);
+        appendField(line, "stage", stage);
+        appendField(line, "detail", detail);
+        appendField(line, "ms", seconds * 1000);
+        line += "}\n";
+    }
+
+    std::string event;
+    if (tracing) {
+        event = "{\"name\":";
+        appendJsonString(event, stage);
+        event += ",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":1,\"tid\":" + std::to_string(threadId()) + ",\"ts\":";
+        appendNumber(event, timestamp(end) - seconds * 1e6, 1);
+        event += ",\"dur\":";
+        appendNumber(event, seconds * 1e6, 1);
+        event += ",\"args\":{\"detail\":";
+        appendJsonString(event, detail);
+        appendField(event, "series", currentLabel);
+        event += "}}";
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stage == "parse") {
+        sums.parse += seconds;
+    } else if (isStorageStage(stage)) {
+        sums.storage += seconds;
+    }
+
+    if (log_file && !line.empty()) {
+        std::fputs(line.c_str(), log_file);
+    }
+    if (trace_file && !event.empty()) {
+        write_trace_event(event);
+    }
+}
+
+Metrics::Totals Metrics::totals() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sums;
+}
+
+double Metrics::timestamp(clock::time_point time) const {
+    return std::chrono::duration<double, std::micro>(time - start).count();
+}
+
+void Metrics::write_trace_event(const std::string &event) {
+    if (!trace_file) {
+        return;
+    }
+
+    if (!first_trace_event) {
+        std::fputs(",\n", trace_file);
+    }
+    std::fputs(event.c_str(), trace_file);
+    first_trace_event = false;
+}
@@ -0,0 +1,184 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_METRICS_H
+#define WEEBCENTRAL_DOWNLOAD_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/**
+ * Records where the time of a run goes, per request and per stage.
+ *
+ * Every HTTP attempt is recorded with curl's timings split into phases: DNS lookup, TCP
+ * connect, TLS handshake, waiting for the first byte and receiving the body, plus the time
+ * spent writing it to disk. Stages such as parsing a page, saving a manifest or writing an
+ * archive are recorded as spans. Both are attributed to the series the recording thread is
+ * working on, set with a Label.
+ *
+ * Records go to an optional JSON lines log, one object per line, and to an optional trace
+ * in the Chrome trace_event format that chrome://tracing and Perfetto open. Totals are always
+ * kept for the run summary. All methods may be called from any thread.
+ */
+class Metrics {
+public:
+    using clock = std::chrono::steady_clock;
+
+    // Timings of one HTTP attempt, in seconds from the start of the attempt as curl reports
+    // them; each is the time at which that phase ended
+    struct Transfer {
+        std::string_view kind; // "html" or "image"
+        std::string_view url;
+        int attempt = 1;
+        int result = 0; // The CURLcode of the attempt
+        long status = 0;
+        bool reused_connection = false;
+        std::uint64_t bytes = 0; // Body bytes received
+        double name_lookup = 0;
+        double connect = 0;
+        double tls = 0; // 0 if the connection was not encrypted or was reused
+        double pretransfer = 0;
+        double first_byte = 0;
+        double total = 0;
+        double write = 0; // Time spent writing the body to disk, not part of the phases above
+    };
+
+    // Summed phases of every recorded attempt, in seconds; attempts run concurrently, so
+    // these can add up to more than the run took
+    struct Totals {
+        std::size_t transfers = 0;
+        std::uint64_t bytes = 0;
+        double dns = 0;
+        double connect = 0;
+        double tls = 0;
+        double wait = 0; // From sending the request to the first byte of the response
+        double receive = 0;
+        double write = 0;
+        double parse = 0;
+        double storage = 0; // Manifests, indexes and archives
+    };
+
+    /**
+     * Names the series or chapter the calling thread works on, for the records it makes
+     * while the label is in scope.
+     */
+    class Label {
+    public:
+        explicit Label(std::string_view label);
+
+        ~Label();
+
+        Label(const Label &) = delete;
+
+        Label &operator=(const Label &) = delete;
+
+    private:
+        std::string previous;
+    };
+
+    /**
+     * Records the time from its construction to its destruction as a stage span.
+     */
+    class Span {
+    public:
+        /**
+         * @param metrics The metrics to record to, or nullptr to record nothing.
+         * @param stage The kind of work, e.g. "manifest".
+         * @param detail What the work was on, e.g. a file name; may be empty.
+         */
+        Span(Metrics *metrics, std::string_view stage, std::string_view detail = {});
+
+        ~Span();
+
+        Span(const Span &) = delete;
+
+        Span &operator=(const Span &) = delete;
+
+    private:
+        Metrics *metrics;
+        std::string_view stage;
+        std::string_view detail;
+        clock::time_point start;
+    };
+
+    Metrics();
+
+    ~Metrics();
+
+    // The metrics own open files, so they cannot be copied
+    Metrics(const Metrics &) = delete;
+
+    Metrics &operator=(const Metrics &) = delete;
+
+    /**
+     * Starts writing records to files. Either path may be empty to not write that file.
+     *
+     * @param log_path File to write the JSON lines log to.
+     * @param trace_path File to write the Chrome trace to.
+     * @return Returns true if the files could be created; otherwise, false.
+     */
+    bool open(const std::string &log_path, const std::string &trace_path);
+
+    /**
+     * Writes the totals to the log and completes both files.
+     */
+    void close();
+
+    /**
+     * Names the calling thread in the trace.
+     *
+     * @param name The name shown for the thread, e.g. "download 1".
+     */
+    void name_thread(std::string_view name);
+
+    /**
+     * Records a finished HTTP attempt. It is placed in the trace as ending now.
+     *
+     * @param transfer The timings of the attempt.
+     */
+    void record_transfer(const Transfer &transfer);
+
+    /**
+     * Records a stage that ended now and took the given time.
+     *
+     * @param stage The kind of work, e.g. "parse".
+     * @param detail What the work was on; may be empty.
+     * @param duration How long the work took.
+     */
+    void record_stage(std::string_view stage, std::string_view detail, clock::duration duration);
+
+    /**
+     * Returns the totals of everything recorded so far.
+     */
+    Totals totals();
+
+private:
+    const clock::time_point start;
+
+    std::mutex mutex; // Guards the files and the totals
+    FILE *log_file = nullptr;
+    FILE *trace_file = nullptr;
+    bool first_trace_event = true;
+    Totals sums;
+
+    // Whether the files are open, so records are only formatted for them outside the mutex when
+    // they will be written; the files themselves are only touched with the mutex held
+    std::atomic<bool> logging{false};
+    std::atomic<bool> tracing{false};
+
+    std::atomic<std::uint64_t> next_transfer_id{1};
+
+    // Microseconds since the metrics were created
+    double timestamp(clock::time_point time) const;
+
+    // Appends one event object to the trace; the mutex must be held
+    void write_trace_event(const std::string &event);
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_METRICS_H
@@ -0,0 +1,197 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "PageExtractor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "AllocationCounter.h"
+#include "Utils.h"
+
+namespace {
+    // Describes the first difference between the results of the two parsers, or returns an
+    // empty string if there is none
+    template<typename Results, typename Describe>
+    std::string compareResults(const Results &dom, const Results &scan, Describe describe) {
+        std::size_t count = std::min(dom.size(), scan.size());
+        for (std::size_t i = 0; i < count; ++i) {
+            if (describe(dom[i]) != describe(scan[i])) {
+                return "entry " + std::to_string(i + 1) + " is \"" + describe(dom[i]) + "\" with the document parser"
+                       + " but \"" + describe(scan[i]) + "\" with the scanner";
+            }
+        }
+
+        if (dom.size() != scan.size()) {
+            return "the document parser found " + std::to_string(dom.size()) + " entries but the scanner found "
+                   + std::to_string(scan.size());
+        }
+
+        return {};
+    }
+
+    // Adds the allocations made by the calling thread while it is in scope, and the time it
+    // was in scope, to the counters of the current page
+    class WorkScope {
+    public:
+        WorkScope(std::uint64_t &allocations, std::chrono::steady_clock::duration &time)
+            : allocations(allocations), time(time), start_allocations(AllocationCounter::threadAllocations()),
+              start_time(std::chrono::steady_clock::now()) {
+        }
+
+        ~WorkScope() {
+            allocations += AllocationCounter::threadAllocations() - start_allocations;
+            time += std::chrono::steady_clock::now() - start_time;
+        }
+
+    private:
+        std::uint64_t &allocations;
+        std::chrono::steady_clock::duration &time;
+        const std::uint64_t start_allocations;
+        const std::chrono::steady_clock::time_point start_time;
+    };
+}
+
+PageExtractor::PageExtractor(ParserMode mode)
+    : mode(mode),
+      title_scanner(arena),
+      images_scanner(arena) {
+}
+
+bool PageExtractor::begin(Page page) {
+    WorkScope scope(page_allocations, page_time);
+
+    this->page = page;
+    arena.reset();
+    title = {};
+    chapters.clear();
+    image_uris.clear();
+    mismatch.clear();
+
+    if (uses_scanner()) {
+        scanner().begin();
+    }
+
+    return !uses_dom() || dom_parser.begin();
+}
+
+bool PageExtractor::feed(std::string_view chunk) {
+    WorkScope scope(page_allocations, page_time);
+
+    if (uses_scanner()) {
+        scanner().feed(chunk);
+    }
+
+    return !uses_dom() || dom_parser.feed(chunk);
+}
+
+bool PageExtractor::finish() {
+    bool success = true;
+
+    {
+        WorkScope scope(page_allocations, page_time);
+
+        if (uses_scanner()) {
+            scanner().finish();
+        }
+
+        if (uses_dom()) {
+            lxb_html_document_t *document = dom_parser.finish();
+            if (document) {
+                extract_dom(document);
+            } else {
+                success = false;
+            }
+        }
+
+        if (success && mode == ParserMode::scan) {
+            title = title_scanner.title;
+            chapters.swap(chapter_scanner.chapters);
+            image_uris.swap(images_scanner.image_uris);
+        } else if (success && mode == ParserMode::verify) {
+            compare_results();
+        }
+    }
+
+    // Attempts that were retried count towards the page that finally finished
+    if (statistics.pages == 0) {
+        statistics.first_page_allocations = page_allocations;
+    }
+    statistics.pages++;
+    statistics.allocations += page_allocations;
+    statistics.time += page_time;
+    page_allocations = 0;
+    last_time = page_time;
+    page_time = {};
+
+    return success;
+}
+
+const PageExtractor::Stats &PageExtractor::stats() const {
+    return statistics;
+}
+
+std::chrono::steady_clock::duration PageExtractor::last_page_time() const {
+    return last_time;
+}
+
+HtmlScanner &PageExtractor::scanner() {
+    switch (page) {
+        case Page::series:
+            return title_scanner;
+        case Page::chapter_list:
+            return chapter_scanner;
+        default:
+            return images_scanner;
+    }
+}
+
+bool PageExtractor::uses_dom() const {
+    return mode != ParserMode::scan;
+}
+
+bool PageExtractor::uses_scanner() const {
+    return mode != ParserMode::dom;
+}
+
+void PageExtractor::extract_dom(lxb_html_document_t *document) {
+    lxb_dom_collection_t *collection = dom_parser.collection();
+    if (!collection) {
+        return;
+    }
+
+    switch (page) {
+        case Page::series:
+            title = arena.store(Utils::parseMangaTitle(document, collection));
+            break;
+        case Page::chapter_list:
+            Utils::parseChapterList(document, collection, chapters);
+            break;
+        case Page::chapter_images:
+            Utils::parseChapterImageURIs(document, collection, arena, image_uris);
+            break;
+    }
+}
+
+void PageExtractor::compare_results() {
+    switch (page) {
+        case Page::series:
+            if (title != title_scanner.title) {
+                mismatch = "the title is \"" + std::string(title) + "\" with the document parser but \"" +
+                           std::string(title_scanner.title) + "\" with the scanner";
+            }
+            break;
+        case Page::chapter_list:
+            mismatch = compareResults(chapters, chapter_scanner.chapters, [](const Chapter &chapter) {
+                return std::string(chapter.name) + " -> " + std::string(chapter.url);
+            });
+            break;
+        case Page::chapter_images:
+            mismatch = compareResults(image_uris, images_scanner.image_uris, [](std::string_view uri) {
+                return std::string(uri);
+            });
+            break;
+    }
+}
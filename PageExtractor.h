@@ -0,0 +1,131 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_PAGEEXTRACTOR_H
+#define WEEBCENTRAL_DOWNLOAD_PAGEEXTRACTOR_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "HtmlScanner.h"
+#include "HtmlStreamParser.h"
+#include "StringArena.h"
+#include "models/ChapterTable.h"
+#include "models/Options.h"
+
+/**
+ * Extracts the title, the chapter list or the image list from pages as they stream in.
+ *
+ * Depending on the parser mode, a page is parsed into a lexbor document that is then queried
+ * with the Utils functions, or scanned by an HtmlScanner that never builds a document. In verify
+ * mode both run on the same chunks; the result of the document is used and any difference
+ * between the two is reported.
+ *
+ * An extractor is meant to be kept for many pages: the lexbor document, the scanners and the
+ * arena holding the extracted strings are all reused, so once they have grown to the size of
+ * the largest page, extracting further pages hardly allocates at all. The results of a page
+ * view strings in the arena or the chapter table and are valid until the next call to begin.
+ */
+class PageExtractor {
+public:
+    // Which page is being extracted
+    enum class Page {
+        series, // A series' main page, for its title
+        chapter_list, // A series' full-chapter-list page
+        chapter_images // A chapter's /images page
+    };
+
+    // Allocations made while extracting pages, as counted by AllocationCounter, and the time
+    // spent parsing them
+    struct Stats {
+        std::size_t pages = 0;
+        std::uint64_t allocations = 0;
+        std::uint64_t first_page_allocations = 0; // Made while the buffers were still growing
+        std::chrono::steady_clock::duration time{};
+    };
+
+    explicit PageExtractor(ParserMode mode);
+
+    // The scanners refer to the extractor's own arena, so it cannot be copied
+    PageExtractor(const PageExtractor &) = delete;
+
+    PageExtractor &operator=(const PageExtractor &) = delete;
+
+    /**
+     * Starts a new page, discarding the results of the previous one.
+     *
+     * @param page Which page follows.
+     * @return Returns true if the extractor is ready for chunks; otherwise, false.
+     */
+    bool begin(Page page);
+
+    /**
+     * Parses the next chunk of the page.
+     *
+     * @param chunk The bytes that follow the previous chunk.
+     * @return Returns true if the chunk was parsed; otherwise, false.
+     */
+    bool feed(std::string_view chunk);
+
+    /**
+     * Completes the page and extracts its title, chapters or image URIs.
+     *
+     * @return Returns true if the page could be parsed; otherwise, false.
+     */
+    bool finish();
+
+    /**
+     * Returns the allocations made by the extractor so far.
+     */
+    const Stats &stats() const;
+
+    /**
+     * Returns the time spent parsing the page that last finished, not counting the time spent
+     * waiting for its chunks to arrive.
+     */
+    std::chrono::steady_clock::duration last_page_time() const;
+
+    // Filled by finish for a series page
+    std::string_view title;
+
+    // Filled by finish for a chapter list page, in reading order
+    ChapterTable chapters;
+
+    // Filled by finish for an images page
+    std::vector<std::string_view> image_uris;
+
+    // Set by finish in verify mode if the two parsers disagree, describing the first difference
+    std::string mismatch;
+
+private:
+    const ParserMode mode;
+    Page page = Page::series;
+
+    StringArena arena;
+    HtmlStreamParser dom_parser;
+    TitleScanner title_scanner;
+    ChapterListScanner chapter_scanner;
+    ChapterImagesScanner images_scanner;
+
+    Stats statistics;
+    std::uint64_t page_allocations = 0; // Allocations made for the current page so far
+    std::chrono::steady_clock::duration page_time{}; // Time spent on the current page so far
+    std::chrono::steady_clock::duration last_time{};
+
+    HtmlScanner &scanner();
+
+    bool uses_dom() const;
+
+    bool uses_scanner() const;
+
+    void extract_dom(lxb_html_document_t *document);
+
+    void compare_results();
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_PAGEEXTRACTOR_H
@@ -0,0 +1,127 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "RateLimiter.h"
+
+#include <algorithm>
+#include <thread>
+
+RateLimiter::RateLimiter() : RateLimiter(Limits{}) {
+}
+
+RateLimiter::RateLimiter(Limits limits) : limits(limits) {
+    this->limits.request_burst = std::max(limits.request_burst, 1.0);
+}
+
+void RateLimiter::set_limits(Limits limits) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->limits = limits;
+    this->limits.request_burst = std::max(limits.request_burst, 1.0);
+}
+
+RateLimiter::clock::duration RateLimiter::try_acquire(std::string_view host) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const clock::time_point now = clock::now();
+    Bucket &bucket = refill(host, now);
+
+    if (now < bucket.blocked_until) {
+        return bucket.blocked_until - now;
+    }
+
+    // Wait for the byte bucket to pay off the debt of the previous responses
+    if (limits.bytes_per_second > 0 && bucket.byte_tokens < 0) {
+        return std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(-bucket.byte_tokens / limits.bytes_per_second));
+    }
+
+    if (limits.requests_per_second > 0) {
+        if (bucket.request_tokens < 1) {
+            return std::chrono::duration_cast<clock::duration>(
+                std::chrono::duration<double>((1 - bucket.request_tokens) / limits.requests_per_second));
+        }
+
+        bucket.request_tokens -= 1;
+    }
+
+    return clock::duration::zero();
+}
+
+void RateLimiter::acquire(std::string_view host) {
+    for (;;) {
+        clock::duration wait = try_acquire(host);
+        if (wait <= clock::duration::zero()) {
+            return;
+        }
+
+        std::this_thread::sleep_for(wait);
+    }
+}
+
+void RateLimiter::consume_bytes(std::string_view host, std::size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (limits.bytes_per_second <= 0) {
+        return;
+    }
+
+    Bucket &bucket = refill(host, clock::now());
+    bucket.byte_tokens -= static_cast<double>(bytes);
+}
+
+bool RateLimiter::try_begin_transfer(std::string_view host, std::size_t max_transfers) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Bucket &bucket = refill(host, clock::now());
+    if (bucket.active_transfers >= max_transfers) {
+        return false;
+    }
+
+    bucket.active_transfers++;
+    return true;
+}
+
+void RateLimiter::end_transfer(std::string_view host) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Bucket &bucket = refill(host, clock::now());
+    if (bucket.active_transfers > 0) {
+        bucket.active_transfers--;
+    }
+}
+
+void RateLimiter::penalize(std::string_view host, clock::duration delay) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const clock::time_point now = clock::now();
+    Bucket &bucket = refill(host, now);
+    bucket.blocked_until = std::max(bucket.blocked_until, now + delay);
+
+    // Start again from an empty bucket so the block is not followed by a burst
+    bucket.request_tokens = 0;
+}
+
+RateLimiter::Bucket &RateLimiter::refill(std::string_view host, clock::time_point now) {
+    auto it = buckets.find(host);
+
+    if (it == buckets.end()) {
+        // New hosts start with a full bucket
+        Bucket bucket;
+        bucket.request_tokens = limits.request_burst;
+        bucket.byte_tokens = limits.bytes_per_second;
+        bucket.last_refill = now;
+        return buckets.emplace(std::string(host), bucket).first->second;
+    }
+
+    Bucket &bucket = it->second;
+    const double elapsed = std::chrono::duration<double>(now - bucket.last_refill).count();
+    bucket.last_refill = now;
+
+    bucket.request_tokens = std::min(limits.request_burst,
+                                     bucket.request_tokens + elapsed * limits.requests_per_second);
+    bucket.byte_tokens = std::min(limits.bytes_per_second,
+                                  bucket.byte_tokens + elapsed * limits.bytes_per_second);
+
+    return bucket;
+}
@@ -0,0 +1,125 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_RATELIMITER_H
+#define WEEBCENTRAL_DOWNLOAD_RATELIMITER_H
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * Per-host token buckets limiting how fast requests are started and bytes are received.
+ *
+ * Every host gets a request bucket that refills at requests_per_second up to request_burst
+ * tokens, and a byte bucket that refills at bytes_per_second up to one second worth of bytes.
+ * A request may start when a request token is available and the byte bucket is not in debt;
+ * received bytes are charged afterwards and may push the byte bucket negative, which holds
+ * back the following requests until it has paid off. A host can also be blocked outright for
+ * a while, which is how 429 responses and Retry-After headers are honored. Finally, the number
+ * of transfers in flight to a host is capped across all threads.
+ *
+ * All methods are thread-safe.
+ */
+class RateLimiter {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct Limits {
+        double requests_per_second = 0; // 0 means unlimited
+        double request_burst = 1; // How many requests may start back to back after an idle period
+        double bytes_per_second = 0; // 0 means unlimited
+    };
+
+    RateLimiter();
+
+    explicit RateLimiter(Limits limits);
+
+    /**
+     * Replaces the limits. Existing buckets keep their current fill level.
+     *
+     * @param limits The new limits.
+     */
+    void set_limits(Limits limits);
+
+    /**
+     * Takes a request token for the host if one is available right now.
+     *
+     * @param host The host the request goes to.
+     * @return Zero if the request may start now (the token has been taken); otherwise how
+     *         long to wait before asking again.
+     */
+    clock::duration try_acquire(std::string_view host);
+
+    /**
+     * Waits until a request to the host may start and takes the token.
+     *
+     * @param host The host the request goes to.
+     */
+    void acquire(std::string_view host);
+
+    /**
+     * Charges bytes received from the host against its byte bucket.
+     *
+     * @param host The host the bytes came from.
+     * @param bytes The number of bytes received.
+     */
+    void consume_bytes(std::string_view host, std::size_t bytes);
+
+    /**
+     * Claims one of the host's concurrent transfer slots, shared by every caller of the limiter.
+     *
+     * @param host The host the transfer goes to.
+     * @param max_transfers The most transfers allowed in flight to the host at once.
+     * @return Returns true if a slot was claimed; false if the host is at its limit.
+     */
+    bool try_begin_transfer(std::string_view host, std::size_t max_transfers);
+
+    /**
+     * Releases a slot claimed by try_begin_transfer.
+     *
+     * @param host The host the transfer went to.
+     */
+    void end_transfer(std::string_view host);
+
+    /**
+     * Blocks all requests to the host for the given time, e.g. after a 429 response.
+     * A shorter delay never shortens an existing block.
+     *
+     * @param host The host to block.
+     * @param delay How long to block the host for.
+     */
+    void penalize(std::string_view host, clock::duration delay);
+
+private:
+    struct Bucket {
+        double request_tokens = 0;
+        double byte_tokens = 0;
+        clock::time_point last_refill;
+        clock::time_point blocked_until;
+        std::size_t active_transfers = 0;
+    };
+
+    // Lets the bucket map be searched by string_view without building a std::string
+    struct HostHash {
+        using is_transparent = void;
+
+        std::size_t operator()(std::string_view host) const {
+            return std::hash<std::string_view>{}(host);
+        }
+    };
+
+    Limits limits;
+    std::unordered_map<std::string, Bucket, HostHash, std::equal_to<>> buckets;
+    std::mutex mutex;
+
+    // Finds or creates the host's bucket and tops it up for the time since the last refill
+    Bucket &refill(std::string_view host, clock::time_point now);
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_RATELIMITER_H
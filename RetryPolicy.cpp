@@ -0,0 +1,147 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "RetryPolicy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+RetryPolicy::RetryPolicy() : RetryPolicy(Settings{}) {
+}
+
+RetryPolicy::RetryPolicy(Settings settings) : settings(settings) {
+    this->settings.max_attempts = std::max(settings.max_attempts, 1);
+}
+
+RetryPolicy::Failure RetryPolicy::classify(CURLcode result, long response_code) {
+    switch (result) {
+        case CURLE_OK:
+            break;
+        case CURLE_OPERATION_TIMEDOUT:
+            return Failure::timeout;
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+            return Failure::connection;
+        case CURLE_WRITE_ERROR:
+            return Failure::local;
+        case CURLE_RANGE_ERROR:
+            // The server would not send the rest of a partial image; it is requested in full
+            return Failure::range_rejected;
+        default:
+            // Anything else points at a problem with the request itself
+            return Failure::client_error;
+    }
+
+    if (response_code >= 200 && response_code < 300) {
+        return Failure::none;
+    }
+
+    if (response_code == 429) {
+        return Failure::rate_limited;
+    }
+
+    if (response_code == 408) {
+        return Failure::timeout;
+    }
+
+    // 501 Not Implemented and 505 HTTP Version Not Supported will not change on a retry
+    if (response_code >= 500 && response_code != 501 && response_code != 505) {
+        return Failure::server_error;
+    }
+
+    return Failure::client_error;
+}
+
+bool RetryPolicy::is_retryable(Failure failure) {
+    switch (failure) {
+        case Failure::timeout:
+        case Failure::connection:
+        case Failure::rate_limited:
+        case Failure::server_error:
+        case Failure::range_rejected:
+        case Failure::corrupt:
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::chrono::milliseconds RetryPolicy::backoff(int attempt) const {
+    // base_delay * 2^(attempt - 1), capped at max_delay
+    const double exponential = static_cast<double>(settings.base_delay.count()) *
+                               std::pow(2.0, std::clamp(attempt - 1, 0, 30));
+    const auto ceiling = static_cast<long long>(std::min(exponential,
+                                                         static_cast<double>(settings.max_delay.count())));
+
+    thread_local std::mt19937_64 generator{std::random_device{}()};
+    std::uniform_int_distribution<long long> distribution(0, std::max(ceiling, 0LL));
+
+    return std::chrono::milliseconds(distribution(generator));
+}
+
+bool RetryPolicy::should_retry(Failure failure, int attempt) const {
+    return is_retryable(failure) && attempt < settings.max_attempts;
+}
+
+void RetryPolicy::record(RetryStats &stats, Failure failure, int attempt, bool final) {
+    stats.attempts++;
+
+    if (attempt == 1) {
+        stats.requests++;
+    } else {
+        stats.retries++;
+    }
+
+    switch (failure) {
+        case Failure::none:
+            break;
+        case Failure::timeout:
+            stats.timeouts++;
+            break;
+        case Failure::connection:
+            stats.connection_errors++;
+            break;
+        case Failure::rate_limited:
+            stats.rate_limited++;
+            break;
+        case Failure::server_error:
+            stats.server_errors++;
+            break;
+        case Failure::client_error:
+            stats.client_errors++;
+            break;
+        case Failure::corrupt:
+            stats.corrupt++;
+            break;
+        default:
+            stats.other_errors++;
+            break;
+    }
+
+    if (!final) {
+        return;
+    }
+
+    if (failure == Failure::none) {
+        if (attempt > 1) {
+            stats.recovered++;
+        }
+    } else if (is_retryable(failure)) {
+        stats.exhausted++;
+    } else {
+        stats.fatal++;
+    }
+}
+
+const RetryPolicy::Settings &RetryPolicy::get_settings() const {
+    return settings;
+}
@@ -0,0 +1,112 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_RETRYPOLICY_H
+#define WEEBCENTRAL_DOWNLOAD_RETRYPOLICY_H
+
+#include <chrono>
+#include <cstddef>
+
+#include <curl/curl.h>
+
+// Counters describing how requests fared across all of their attempts
+struct RetryStats {
+    std::size_t requests = 0; // Requests made, however many attempts each took
+    std::size_t attempts = 0; // Attempts made in total
+    std::size_t retries = 0; // Attempts that were repeats of a failed attempt
+    std::size_t recovered = 0; // Requests that succeeded after at least one retry
+    std::size_t exhausted = 0; // Requests that still failed after the last allowed attempt
+    std::size_t fatal = 0; // Requests that failed with an error not worth retrying
+
+    // Failed attempts by cause
+    std::size_t timeouts = 0;
+    std::size_t connection_errors = 0;
+    std::size_t rate_limited = 0;
+    std::size_t server_errors = 0;
+    std::size_t client_errors = 0;
+    std::size_t corrupt = 0; // Responses that were not a valid image
+    std::size_t other_errors = 0;
+};
+
+/**
+ * Decides which failed requests are worth repeating and how long to wait before doing so.
+ *
+ * Timeouts, dropped connections, 5xx responses, 429 responses and images that arrived corrupt
+ * are transient and retried; anything else (e.g. a 404, or a file that cannot be written) fails
+ * straight away. The wait between attempts grows exponentially from base_delay up to max_delay,
+ * and a random amount of it is used ("full jitter") so that transfers failing together do not
+ * retry in lockstep.
+ */
+class RetryPolicy {
+public:
+    // Why an attempt failed
+    enum class Failure {
+        none, // The attempt succeeded
+        timeout, // Connecting or receiving took too long
+        connection, // The connection could not be made or was dropped
+        rate_limited, // 429 Too Many Requests
+        server_error, // 5xx response
+        client_error, // 4xx response other than 429
+        range_rejected, // 416 or CURLE_RANGE_ERROR for a resumed image; the partial file was discarded
+        corrupt, // The response was not a valid image; it was discarded
+        local // The response could not be stored
+    };
+
+    struct Settings {
+        int max_attempts = 5;
+        std::chrono::milliseconds base_delay{500};
+        std::chrono::milliseconds max_delay{30000};
+    };
+
+    RetryPolicy();
+
+    explicit RetryPolicy(Settings settings);
+
+    /**
+     * Classifies the result of an attempt.
+     *
+     * @param result The curl result of the attempt.
+     * @param response_code The HTTP status of the response, or 0 if none was received.
+     * @return Failure::none for a 2xx response, otherwise the cause of the failure.
+     */
+    static Failure classify(CURLcode result, long response_code);
+
+    /**
+     * @param failure The cause of a failed attempt.
+     * @return Returns true if repeating the request may succeed.
+     */
+    static bool is_retryable(Failure failure);
+
+    /**
+     * Returns how long to wait before the next attempt.
+     *
+     * @param attempt The number of the attempt that just failed, starting at 1.
+     * @return A random delay between zero and the capped exponential backoff for the attempt.
+     */
+    std::chrono::milliseconds backoff(int attempt) const;
+
+    /**
+     * @param failure The cause of the failed attempt.
+     * @param attempt The number of the attempt that just failed, starting at 1.
+     * @return Returns true if the request should be attempted again.
+     */
+    bool should_retry(Failure failure, int attempt) const;
+
+    /**
+     * Adds the outcome of one attempt to the statistics.
+     *
+     * @param stats The statistics to update.
+     * @param failure The cause of the attempt's failure, or Failure::none.
+     * @param attempt The number of the attempt, starting at 1.
+     * @param final Whether no further attempt will be made for the request.
+     */
+    static void record(RetryStats &stats, Failure failure, int attempt, bool final);
+
+    const Settings &get_settings() const;
+
+private:
+    Settings settings;
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_RETRYPOLICY_H
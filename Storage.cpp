@@ -0,0 +1,312 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "Storage.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string_view>
+
+#include "ImageCheck.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+    // First line of every manifest, bumped when the format changes
+    constexpr const char *manifestHeader = "weebcentral-manifest 1";
+
+    // First line of every series index, bumped when the format changes
+    constexpr const char *indexHeader = "weebcentral-index 1";
+
+    // First line of the daemon's job queue, bumped when the format changes
+    constexpr const char *queueHeader = "weebcentral-queue 1";
+
+    // Splits a line on tabs
+    std::vector<std::string> splitFields(const std::string &line) {
+        std::vector<std::string> fields;
+        std::size_t start = 0;
+
+        while (true) {
+            std::size_t tab = line.find('\t', start);
+            fields.push_back(line.substr(start, tab - start));
+            if (tab == std::string::npos) {
+                break;
+            }
+            start = tab + 1;
+        }
+
+        return fields;
+    }
+}
+
+bool Storage::syncFile(FILE *fp) {
+    if (fflush(fp) != 0) {
+        return false;
+    }
+
+#ifdef _WIN32
+    return _commit(_fileno(fp)) == 0;
+#else
+    return fsync(fileno(fp)) == 0;
+#endif
+}
+
+bool Storage::writeFileAtomic(const std::filesystem::path &path, const std::string &contents) {
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp";
+
+    FILE *fp = fopen(temp_path.string().c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+
+    bool written = fwrite(contents.data(), 1, contents.size(), fp) == contents.size();
+    written = syncFile(fp) && written;
+    written = fclose(fp) == 0 && written;
+
+    std::error_code ec;
+    if (written) {
+        std::filesystem::rename(temp_path, path, ec);
+    }
+
+    if (!written || ec) {
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+
+    return true;
+}
+
+bool Storage::loadChapterManifest(const std::filesystem::path &folder, ChapterManifest &manifest) {
+    std::ifstream file(folder / manifestFileName, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != manifestHeader) {
+        return false;
+    }
+
+    if (!std::getline(file, line) || !line.starts_with("complete ")) {
+        return false;
+    }
+
+    ChapterManifest loaded;
+    loaded.complete = line == "complete 1";
+
+    while (std::getline(file, line)) {
+        if (line.empty()) {
+            continue;
+        }
+
+        // state, size, filename, url
+        std::vector<std::string> fields = splitFields(line);
+        if (fields.size() != 4) {
+            return false;
+        }
+
+        // Older versions read any state other than done as pending, so "corrupt" needs no new header
+        ManifestImage image;
+        image.done = fields[0] == "done";
+        image.corrupt = fields[0] == "corrupt";
+        image.filename = fields[2];
+        image.url = fields[3];
+
+        try {
+            image.size = std::stoull(fields[1]);
+        } catch (const std::exception &) {
+            return false;
+        }
+
+        loaded.images.push_back(std::move(image));
+    }
+
+    manifest = std::move(loaded);
+    return true;
+}
+
+bool Storage::saveChapterManifest(const std::filesystem::path &folder, const ChapterManifest &manifest) {
+    std::ostringstream out;
+    out << manifestHeader << '\n';
+    out << "complete " << (manifest.complete ? 1 : 0) << '\n';
+
+    for (const ManifestImage &image: manifest.images) {
+        out << (image.done ? "done" : image.corrupt ? "corrupt" : "pending") << '\t' << image.size << '\t'
+                << image.filename << '\t' << image.url << '\n';
+    }
+
+    return writeFileAtomic(folder / manifestFileName, out.str());
+}
+
+std::size_t Storage::verifyChapterManifest(const std::filesystem::path &folder, ChapterManifest &manifest) {
+    std::size_t missing = 0;
+
+    for (ManifestImage &image: manifest.images) {
+        if (image.done) {
+            std::error_code ec;
+            std::uintmax_t size = std::filesystem::file_size(folder / image.filename, ec);
+            image.done = !ec && size == image.size;
+        }
+
+        if (!image.done) {
+            missing++;
+        }
+    }
+
+    manifest.complete = missing == 0 && !manifest.images.empty();
+    return missing;
+}
+
+std::size_t Storage::adoptChapterFolder(const std::filesystem::path &folder, ChapterManifest &manifest,
+                                       bool check_trailers) {
+    std::size_t missing = 0;
+    ImageCheck check;
+
+    for (ManifestImage &image: manifest.images) {
+        const std::filesystem::path path = folder / image.filename;
+
+        // Only the first and last bytes of each file are read
+        std::error_code ec;
+        const std::uintmax_t size = std::filesystem::file_size(path, ec);
+        check.reset(ImageCheck::format_of(image.filename));
+        image.done = !ec && check.resume(path, size) &&
+                     check.finish(-1, check_trailers) == ImageCheck::Problem::none;
+        image.size = image.done ? size : 0;
+
+        if (!image.done) {
+            missing++;
+        }
+    }
+
+    manifest.complete = missing == 0 && !manifest.images.empty();
+    return missing;
+}
+
+bool Storage::loadSeriesIndex(const std::filesystem::path &folder, SeriesIndex &index) {
+    std::ifstream file(folder / indexFileName, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != indexHeader) {
+        return false;
+    }
+
+    SeriesIndex loaded;
+
+    while (std::getline(file, line)) {
+        if (line.empty()) {
+            continue;
+        }
+
+        // chapter id, state, name
+        std::vector<std::string> fields = splitFields(line);
+        if (fields.size() == 2 && fields[0] == "synced") {
+            loaded.synced_validator = std::move(fields[1]);
+            continue;
+        }
+        if (fields.size() != 3) {
+            return false;
+        }
+
+        // Older versions read any state other than complete as incomplete, so "corrupt" needs no new header
+        IndexedChapter chapter;
+        chapter.complete = fields[1] == "complete";
+        chapter.corrupt = fields[1] == "corrupt";
+        chapter.name = std::move(fields[2]);
+        loaded.chapters[std::move(fields[0])] = std::move(chapter);
+    }
+
+    index = std::move(loaded);
+    return true;
+}
+
+bool Storage::saveSeriesIndex(const std::filesystem::path &folder, const SeriesIndex &index) {
+    // Chapter IDs are ULIDs, so sorting them keeps the file in release order
+    std::vector<const std::pair<const std::string, IndexedChapter> *> entries;
+    entries.reserve(index.chapters.size());
+    for (const auto &entry: index.chapters) {
+        entries.push_back(&entry);
+    }
+    std::ranges::sort(entries, {}, [](const auto *entry) { return std::string_view(entry->first); });
+
+    std::ostringstream out;
+    out << indexHeader << '\n';
+
+    if (!index.synced_validator.empty()) {
+        out << "synced" << '\t' << index.synced_validator << '\n';
+    }
+
+    for (const auto *entry: entries) {
+        // Keep the name on one line and out of the way of the field separator
+        std::string name = entry->second.name;
+        std::ranges::replace_if(name, [](char c) { return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+
+        const IndexedChapter &chapter = entry->second;
+        out << entry->first << '\t' << (chapter.complete ? "complete" : chapter.corrupt ? "corrupt" : "incomplete")
+                << '\t' << name << '\n';
+    }
+
+    return writeFileAtomic(folder / indexFileName, out.str());
+}
+
+bool Storage::loadSyncQueue(const std::filesystem::path &path, std::vector<SyncJob> &jobs) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != queueHeader) {
+        return false;
+    }
+
+    std::vector<SyncJob> loaded;
+
+    while (std::getline(file, line)) {
+        if (line.empty()) {
+            continue;
+        }
+
+        // uri, state, next run, last run, failures
+        std::vector<std::string> fields = splitFields(line);
+        if (fields.size() != 5) {
+            return false;
+        }
+
+        SyncJob job;
+        job.uri = std::move(fields[0]);
+        job.running = fields[1] == "running";
+        try {
+            job.next_run = std::stoll(fields[2]);
+            job.last_run = std::stoll(fields[3]);
+            job.failures = static_cast<unsigned>(std::stoul(fields[4]));
+        } catch (const std::exception &) {
+            return false;
+        }
+        loaded.push_back(std::move(job));
+    }
+
+    jobs = std::move(loaded);
+    return true;
+}
+
+bool Storage::saveSyncQueue(const std::filesystem::path &path, const std::vector<SyncJob> &jobs) {
+    std::ostringstream out;
+    out << queueHeader << '\n';
+
+    for (const SyncJob &job: jobs) {
+        out << job.uri << '\t' << (job.running ? "running" : "waiting") << '\t' << job.next_run << '\t'
+                << job.last_run << '\t' << job.failures << '\n';
+    }
+
+    return writeFileAtomic(path, out.str());
+}
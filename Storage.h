@@ -0,0 +1,121 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_STORAGE_H
+#define WEEBCENTRAL_DOWNLOAD_STORAGE_H
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "models/ChapterManifest.h"
+#include "models/SeriesIndex.h"
+#include "models/SyncJob.h"
+
+namespace Storage {
+    // Name of the manifest file kept in every chapter folder
+    inline constexpr const char *manifestFileName = ".weebcentral-manifest";
+
+    // Name of the index file kept in every series folder
+    inline constexpr const char *indexFileName = ".weebcentral-index";
+
+    /**
+     * Flushes a file's buffers and asks the operating system to write it to disk.
+     *
+     * @param fp The file to sync.
+     * @return Returns true if the data reached the disk; otherwise, false.
+     */
+    bool syncFile(FILE *fp);
+
+    /**
+     * Replaces the contents of a file so that readers see either the old or the new contents,
+     * never a mix. The data is written to a temporary file next to the target, synced to disk
+     * and then renamed over the target.
+     *
+     * @param path The file to write.
+     * @param contents The new contents of the file.
+     * @return Returns true if the file was written; otherwise, false.
+     */
+    bool writeFileAtomic(const std::filesystem::path &path, const std::string &contents);
+
+    /**
+     * Reads the manifest of a chapter folder.
+     *
+     * @param folder The chapter folder.
+     * @param manifest Receives the manifest.
+     * @return Returns true if a valid manifest was read; false if it is missing or unreadable.
+     */
+    bool loadChapterManifest(const std::filesystem::path &folder, ChapterManifest &manifest);
+
+    /**
+     * Writes the manifest of a chapter folder atomically.
+     *
+     * @param folder The chapter folder.
+     * @param manifest The manifest to write.
+     * @return Returns true if the manifest was written; otherwise, false.
+     */
+    bool saveChapterManifest(const std::filesystem::path &folder, const ChapterManifest &manifest);
+
+    /**
+     * Marks every image recorded as done whose file is missing or does not have the recorded
+     * size as not done, so that it is downloaded again.
+     *
+     * @param folder The chapter folder.
+     * @param manifest The manifest to check.
+     * @return The number of images that still need to be downloaded.
+     */
+    std::size_t verifyChapterManifest(const std::filesystem::path &folder, ChapterManifest &manifest);
+
+    /**
+     * Marks every image of a fresh manifest as done whose file is already in the chapter folder
+     * and passes the image check, recording its size. Used for folders downloaded by versions
+     * that kept no manifest, so that only their missing or broken images are downloaded.
+     *
+     * @param folder The chapter folder.
+     * @param manifest The manifest built from the chapter's image list.
+     * @param check_trailers Whether the files must also end with the trailer of their format.
+     * @return The number of images that still need to be downloaded.
+     */
+    std::size_t adoptChapterFolder(const std::filesystem::path &folder, ChapterManifest &manifest,
+                                   bool check_trailers);
+
+    /**
+     * Reads the chapter index of a series folder.
+     *
+     * @param folder The series folder.
+     * @param index Receives the index.
+     * @return Returns true if a valid index was read; false if it is missing or unreadable.
+     */
+    bool loadSeriesIndex(const std::filesystem::path &folder, SeriesIndex &index);
+
+    /**
+     * Writes the chapter index of a series folder atomically, ordered by chapter ID.
+     *
+     * @param folder The series folder.
+     * @param index The index to write.
+     * @return Returns true if the index was written; otherwise, false.
+     */
+    bool saveSeriesIndex(const std::filesystem::path &folder, const SeriesIndex &index);
+
+    /**
+     * Reads the daemon's job queue.
+     *
+     * @param path The queue file.
+     * @param jobs Receives the jobs, in the order they were saved.
+     * @return Returns true if a valid queue was read; false if it is missing or unreadable.
+     */
+    bool loadSyncQueue(const std::filesystem::path &path, std::vector<SyncJob> &jobs);
+
+    /**
+     * Writes the daemon's job queue atomically.
+     *
+     * @param path The queue file.
+     * @param jobs The jobs to write.
+     * @return Returns true if the queue was written; otherwise, false.
+     */
+    bool saveSyncQueue(const std::filesystem::path &path, const std::vector<SyncJob> &jobs);
+}
+
+#endif //WEEBCENTRAL_DOWNLOAD_STORAGE_H
@@ -0,0 +1,83 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "StringArena.h"
+
+#include <algorithm>
+#include <cstring>
+
+StringArena::StringArena(std::size_t block_size) : block_size(block_size == 0 ? 1 : block_size) {
+}
+
+std::string_view StringArena::store(std::string_view text) {
+    // A string that was being built is completed first, so the two do not run into each other
+    end_string();
+    append(text);
+    return end_string();
+}
+
+void StringArena::append(std::string_view text) {
+    if (text.empty()) {
+        return;
+    }
+
+    reserve(text.size());
+    std::memcpy(blocks[current].data.get() + used, text.data(), text.size());
+    used += text.size();
+}
+
+std::string_view StringArena::end_string() {
+    if (blocks.empty()) {
+        return {};
+    }
+
+    std::string_view result(blocks[current].data.get() + string_start, used - string_start);
+    string_start = used;
+    return result;
+}
+
+void StringArena::reset() {
+    current = 0;
+    used = 0;
+    string_start = 0;
+}
+
+std::size_t StringArena::capacity() const {
+    std::size_t total = 0;
+    for (const Block &block: blocks) {
+        total += block.size;
+    }
+    return total;
+}
+
+void StringArena::reserve(std::size_t extra) {
+    if (!blocks.empty() && used + extra <= blocks[current].size) {
+        return;
+    }
+
+    const std::size_t length = blocks.empty() ? 0 : used - string_start;
+    const std::size_t needed = length + extra;
+
+    // Move on to the next block that is large enough, adding one if there is none
+    std::size_t next = blocks.empty() ? 0 : current + 1;
+    while (next < blocks.size() && blocks[next].size < needed) {
+        next++;
+    }
+
+    if (next == blocks.size()) {
+        Block block;
+        block.size = std::max(block_size, needed);
+        block.data = std::make_unique<char[]>(block.size);
+        blocks.push_back(std::move(block));
+    }
+
+    // The partial string moves along so that it stays contiguous
+    if (length > 0) {
+        std::memcpy(blocks[next].data.get(), blocks[current].data.get() + string_start, length);
+    }
+
+    current = next;
+    used = length;
+    string_start = 0;
+}
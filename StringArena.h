@@ -0,0 +1,75 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_STRINGARENA_H
+#define WEEBCENTRAL_DOWNLOAD_STRINGARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/**
+ * Stores strings back to back in large blocks, for values that all live as long as one page.
+ *
+ * Strings are handed out as string_views that stay valid until the next reset. reset keeps the
+ * blocks, so once the arena has grown to the size of the largest page, extracting the strings of
+ * further pages allocates nothing.
+ */
+class StringArena {
+public:
+    explicit StringArena(std::size_t block_size = 64 * 1024);
+
+    /**
+     * Copies a string into the arena.
+     *
+     * @param text The string to copy.
+     * @return A view of the copy.
+     */
+    std::string_view store(std::string_view text);
+
+    /**
+     * Appends to the string being built, which is started by the first append after a call
+     * to end_string or reset. Useful for text that arrives in pieces.
+     *
+     * @param text The piece to append.
+     */
+    void append(std::string_view text);
+
+    /**
+     * Completes the string being built.
+     *
+     * @return A view of the string, empty if nothing was appended.
+     */
+    std::string_view end_string();
+
+    /**
+     * Releases every string at once, keeping the blocks for reuse.
+     */
+    void reset();
+
+    /**
+     * Returns the total size of the blocks held by the arena.
+     */
+    std::size_t capacity() const;
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        std::size_t size = 0;
+    };
+
+    const std::size_t block_size;
+
+    std::vector<Block> blocks;
+    std::size_t current = 0; // Block being filled
+    std::size_t used = 0; // Bytes used in the current block
+    std::size_t string_start = 0; // Offset in the current block of the string being built
+
+    // Makes room for extra more bytes after the string being built, moving it to another
+    // block if the current one is full
+    void reserve(std::size_t extra);
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_STRINGARENA_H
@@ -0,0 +1,400 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "SyncDaemon.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "Storage.h"
+
+namespace {
+    // Set by SIGINT and SIGTERM
+    volatile std::sig_atomic_t stopRequested = 0;
+
+    void requestStop(int signal) {
+        stopRequested = 1;
+
+        // A second signal ends the process without waiting for the sync in progress
+        std::signal(signal, SIG_DFL);
+    }
+
+    // How often the watch list is read again
+    constexpr std::chrono::seconds watchListRefresh(60);
+
+    // Delay before the first retry of a series whose sync failed, doubled on every further failure
+    constexpr std::chrono::seconds firstRetryDelay(300);
+
+    // Formats a number of seconds for the status report, e.g. "1h 05m" or "42s"
+    std::string formatDuration(std::int64_t seconds) {
+        seconds = std::max<std::int64_t>(seconds, 0);
+
+        char text[32];
+        if (seconds >= 3600) {
+            std::snprintf(text, sizeof(text), "%lldh %02lldm", static_cast<long long>(seconds / 3600),
+                          static_cast<long long>(seconds % 3600 / 60));
+        } else if (seconds >= 60) {
+            std::snprintf(text, sizeof(text), "%lldm %02llds", static_cast<long long>(seconds / 60),
+                          static_cast<long long>(seconds % 60));
+        } else {
+            std::snprintf(text, sizeof(text), "%llds", static_cast<long long>(seconds));
+        }
+        return text;
+    }
+}
+
+SyncDaemon::SyncDaemon(HttpClient &http_client, const Settings &settings)
+    : http_client(http_client), settings(settings), started(clock::now()) {
+}
+
+SyncDaemon::~SyncDaemon() {
+    stop_status_server();
+}
+
+bool SyncDaemon::run(const std::function<std::vector<std::string>()> &watch_list,
+                     const std::function<bool(const std::string &uri)> &sync) {
+    // Series from an earlier run keep their schedule
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // A queue that cannot be read is kept as a backup and rebuilt from the watch list, so every
+        // series is synced once straight away and then keeps to its schedule again
+        std::error_code ec;
+        if (std::filesystem::exists(settings.queue_path, ec) && !Storage::loadSyncQueue(settings.queue_path, jobs)) {
+            std::filesystem::path backup_path = settings.queue_path;
+            backup_path += ".bak";
+            std::filesystem::rename(settings.queue_path, backup_path, ec);
+            if (ec) {
+                std::cerr << "Error: Could not read the job queue " << settings.queue_path << " or move it to "
+                        << backup_path << ": " << ec.message() << std::endl;
+                return false;
+            }
+
+            std::cerr << "Warning: Could not read the job queue " << settings.queue_path << ", kept it as "
+                    << backup_path << " and starting a new one from the watch list" << std::endl;
+            jobs.clear();
+        }
+
+        // A sync that was cut short is started again straight away
+        for (SyncJob &job: jobs) {
+            if (job.running) {
+                job.running = false;
+                job.next_run = 0;
+            }
+        }
+    }
+
+    update_jobs(watch_list());
+    if (!save_queue()) {
+        std::cerr << "Error: Could not write the job queue " << settings.queue_path << std::endl;
+        return false;
+    }
+
+    if (!settings.status_socket.empty() && !start_status_server()) {
+        return false;
+    }
+
+    stopRequested = 0;
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    std::cout << "Watching " << jobs.size() << " series, syncing each about every "
+            << formatDuration(settings.interval.count()) << "." << std::endl;
+
+    clock::time_point next_refresh = clock::now() + watchListRefresh;
+
+    while (!stopRequested) {
+        const clock::time_point now = clock::now();
+
+        if (now >= next_refresh) {
+            if (update_jobs(watch_list())) {
+                save_queue();
+            }
+            next_refresh = now + watchListRefresh;
+        }
+
+        // The series that has been due for the longest goes first
+        std::size_t due = jobs.size();
+        std::string uri;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (std::size_t i = 0; i < jobs.size(); ++i) {
+                const bool is_due = jobs[i].next_run <= unix_time(now);
+                if (is_due && (due == jobs.size() || jobs[i].next_run < jobs[due].next_run)) {
+                    due = i;
+                }
+            }
+
+            if (due < jobs.size()) {
+                jobs[due].running = true;
+                uri = jobs[due].uri;
+                current_uri = uri;
+                current_started = now;
+            }
+        }
+
+        // Nothing is due; look again in a second, which also notices a stop request soon enough
+        if (due == jobs.size()) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+
+        save_queue();
+
+        std::cout << "\nSyncing " << uri << std::endl;
+        const bool succeeded = sync(uri);
+
+        std::int64_t next_run = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            SyncJob &job = jobs[due];
+            job.running = false;
+            job.last_run = unix_time(clock::now());
+            schedule(job, succeeded, job.last_run);
+            next_run = job.next_run;
+            current_uri.clear();
+        }
+
+        if (!save_queue()) {
+            std::cerr << "Warning: Could not write the job queue " << settings.queue_path << std::endl;
+        }
+
+        std::cout << (succeeded ? "Synced " : "Sync failed for ") << uri << ", next sync in "
+                << formatDuration(next_run - unix_time(clock::now())) << "." << std::endl;
+    }
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    stop_status_server();
+
+    std::cout << "\nDaemon stopped." << std::endl;
+    return true;
+}
+
+bool SyncDaemon::update_jobs(const std::vector<std::string> &watched) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<SyncJob> updated;
+    updated.reserve(watched.size());
+    bool changed = false;
+
+    for (const std::string &uri: watched) {
+        if (std::ranges::any_of(updated, [&uri](const SyncJob &job) { return job.uri == uri; })) {
+            continue;
+        }
+
+        auto existing = std::ranges::find(jobs, uri, &SyncJob::uri);
+        if (existing != jobs.end()) {
+            updated.push_back(std::move(*existing));
+        } else {
+            // A series new to the list is synced right away
+            SyncJob job;
+            job.uri = uri;
+            updated.push_back(std::move(job));
+            changed = true;
+        }
+    }
+
+    changed = changed || updated.size() != jobs.size();
+    jobs = std::move(updated);
+    return changed;
+}
+
+void SyncDaemon::schedule(SyncJob &job, bool succeeded, std::int64_t now) {
+    std::chrono::seconds delay = settings.interval;
+
+    if (succeeded) {
+        job.failures = 0;
+    } else {
+        job.failures++;
+        delay = std::min<std::chrono::seconds>(delay, firstRetryDelay * (1 << std::min(job.failures - 1, 16u)));
+    }
+
+    // Up to a tenth either way, so that series added together drift apart
+    thread_local std::mt19937_64 generator{std::random_device{}()};
+    std::uniform_real_distribution<double> jitter(0.9, 1.1);
+
+    job.next_run = now + static_cast<std::int64_t>(static_cast<double>(delay.count()) * jitter(generator));
+}
+
+bool SyncDaemon::save_queue() {
+    std::vector<SyncJob> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        snapshot = jobs;
+    }
+
+    return Storage::saveSyncQueue(settings.queue_path, snapshot);
+}
+
+bool SyncDaemon::start_status_server() {
+#ifdef _WIN32
+    std::cerr << "Warning: The status socket is not supported on Windows" << std::endl;
+    return true;
+#else
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (settings.status_socket.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: The status socket path is too long: " << settings.status_socket << std::endl;
+        return false;
+    }
+    std::memcpy(address.sun_path, settings.status_socket.c_str(), settings.status_socket.size() + 1);
+
+    // A socket left behind by a daemon that was killed refuses connections and is replaced. One
+    // that is answered belongs to a daemon that is still running and is left alone.
+    std::error_code ec;
+    if (std::filesystem::is_socket(settings.status_socket, ec)) {
+        const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        int probe_error = 0;
+        if (probe >= 0) {
+            probe_error = connect(probe, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0 ? 0 : errno;
+            close(probe);
+        }
+
+        if (probe >= 0 && probe_error == 0) {
+            std::cerr << "Error: The status socket " << settings.status_socket
+                    << " is in use; is another daemon running?" << std::endl;
+            return false;
+        }
+        if (probe_error == ECONNREFUSED) {
+            std::filesystem::remove(settings.status_socket, ec);
+        }
+    }
+
+    status_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (status_socket < 0 ||
+        bind(status_socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(status_socket, 8) != 0) {
+        std::cerr << "Error: Could not create the status socket " << settings.status_socket << ": "
+                << std::strerror(errno) << std::endl;
+        if (status_socket >= 0) {
+            close(status_socket);
+            status_socket = -1;
+        }
+        return false;
+    }
+
+    status_stopping = false;
+    status_thread = std::thread(&SyncDaemon::serve_status, this);
+    return true;
+#endif
+}
+
+void SyncDaemon::stop_status_server() {
+#ifndef _WIN32
+    if (status_thread.joinable()) {
+        status_stopping = true;
+        status_thread.join();
+    }
+
+    if (status_socket >= 0) {
+        close(status_socket);
+        status_socket = -1;
+
+        std::error_code ec;
+        std::filesystem::remove(settings.status_socket, ec);
+    }
+#endif
+}
+
+void SyncDaemon::serve_status() {
+#ifndef _WIN32
+    while (!status_stopping) {
+        // Wakes up twice a second to notice that the daemon stopped
+        pollfd listener{status_socket, POLLIN, 0};
+        if (poll(&listener, 1, 500) <= 0) {
+            continue;
+        }
+
+        int client = accept(status_socket, nullptr, nullptr);
+        if (client < 0) {
+            continue;
+        }
+
+        // A client that goes away early must not kill the process with SIGPIPE
+#ifdef MSG_NOSIGNAL
+        constexpr int flags = MSG_NOSIGNAL;
+#else
+        constexpr int flags = 0;
+#endif
+
+        const std::string report = status_report();
+        std::size_t sent = 0;
+        while (sent < report.size()) {
+            ssize_t result = send(client, report.data() + sent, report.size() - sent, flags);
+            if (result <= 0) {
+                break;
+            }
+            sent += static_cast<std::size_t>(result);
+        }
+
+        close(client);
+    }
+#endif
+}
+
+std::string SyncDaemon::status_report() {
+    const clock::time_point now = clock::now();
+    const std::int64_t now_seconds = unix_time(now);
+
+    std::ostringstream out;
+    out << "weebcentral-download daemon, up " << formatDuration(now_seconds - unix_time(started)) << "\n";
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (current_uri.empty()) {
+        std::int64_t next_run = std::numeric_limits<std::int64_t>::max();
+        for (const SyncJob &job: jobs) {
+            next_run = std::min(next_run, job.next_run);
+        }
+        out << "State: waiting";
+        if (!jobs.empty()) {
+            out << ", next sync in " << formatDuration(next_run - now_seconds);
+        }
+        out << "\n";
+    } else {
+        out << "State: syncing " << current_uri << " for " << formatDuration(now_seconds - unix_time(current_started))
+                << "\n";
+    }
+
+    const HttpClient::ConnectionStats connection_stats = http_client.connection_stats();
+    const RetryStats retry_stats = http_client.retry_stats();
+    out << "Connections: " << connection_stats.opened << " opened, " << connection_stats.reused << " reused\n";
+    out << "Requests: " << retry_stats.requests << " in " << retry_stats.attempts << " attempts\n";
+
+    out << "Series:\n";
+    for (const SyncJob &job: jobs) {
+        out << "  " << job.uri << ": ";
+        if (job.running) {
+            out << "syncing";
+        } else {
+            out << "next sync in " << formatDuration(job.next_run - now_seconds);
+        }
+        if (job.last_run > 0) {
+            out << ", last synced " << formatDuration(now_seconds - job.last_run) << " ago";
+        }
+        if (job.failures > 0) {
+            out << ", " << job.failures << (job.failures == 1 ? " failure" : " failures in a row");
+        }
+        out << "\n";
+    }
+
+    return out.str();
+}
+
+std::int64_t SyncDaemon::unix_time(clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+}
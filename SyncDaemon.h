@@ -0,0 +1,110 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_SYNCDAEMON_H
+#define WEEBCENTRAL_DOWNLOAD_SYNCDAEMON_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HttpClient.h"
+#include "models/SyncJob.h"
+
+/**
+ * Keeps a list of series in sync for as long as the process runs.
+ *
+ * Every watched series is synced once per interval, give or take a random tenth of it so that
+ * the polls of many series spread out instead of hitting the site together. A series whose sync
+ * fails is tried again sooner, backing off up to the interval. The client, and with it its
+ * connection pool, DNS cache and TLS sessions, stays alive between polls, so a series that did
+ * not change costs no more than the conditional requests for its pages.
+ *
+ * The schedule is kept in a job queue file that is rewritten whenever it changes. After a
+ * restart, series are synced when they were due, and a sync that was cut short is started
+ * again straight away; the chapter manifests make it continue where it stopped.
+ *
+ * If a status socket is set, every connection to it is answered with a plain text report of
+ * what the daemon is doing and when each series is due (Unix domain sockets only; not on
+ * Windows). SIGINT and SIGTERM stop the daemon once the series being synced is done; a second
+ * signal ends the process straight away.
+ */
+class SyncDaemon {
+public:
+    struct Settings {
+        std::chrono::seconds interval{3600}; // Time between two syncs of a series
+        std::filesystem::path queue_path = ".weebcentral-queue";
+        std::string status_socket; // Path of the status socket, empty for none
+    };
+
+    /**
+     * @param http_client The client every sync goes through, whose counters the status reports.
+     * @param settings The schedule and the files of the daemon.
+     */
+    SyncDaemon(HttpClient &http_client, const Settings &settings);
+
+    ~SyncDaemon();
+
+    // The daemon owns the status thread, so it cannot be copied
+    SyncDaemon(const SyncDaemon &) = delete;
+
+    SyncDaemon &operator=(const SyncDaemon &) = delete;
+
+    /**
+     * Syncs the watched series on schedule until the process is asked to stop.
+     *
+     * @param watch_list Returns the URIs of the series to watch. It is called again every minute,
+     *                   so series can be added and removed while the daemon runs.
+     * @param sync Syncs one series, returning true if it succeeded.
+     * @return Returns false if the job queue or the status socket could not be set up;
+     *         otherwise, true once the daemon was stopped.
+     */
+    bool run(const std::function<std::vector<std::string>()> &watch_list,
+             const std::function<bool(const std::string &uri)> &sync);
+
+private:
+    using clock = std::chrono::system_clock;
+
+    HttpClient &http_client;
+    const Settings settings;
+    const clock::time_point started;
+
+    // The schedule and what the daemon is doing, shared with the status thread
+    std::mutex mutex;
+    std::vector<SyncJob> jobs;
+    std::string current_uri; // The series being synced, empty while waiting
+    clock::time_point current_started;
+
+    std::thread status_thread;
+    std::atomic<bool> status_stopping{false};
+    int status_socket = -1;
+
+    // Adds the series that were added to the watch list and drops those that were removed;
+    // returns true if anything changed
+    bool update_jobs(const std::vector<std::string> &watched);
+
+    // Sets when a job runs next from the outcome of the sync that just finished
+    void schedule(SyncJob &job, bool succeeded, std::int64_t now);
+
+    bool save_queue();
+
+    bool start_status_server();
+
+    void stop_status_server();
+
+    // Answers the connections to the status socket until the daemon stops
+    void serve_status();
+
+    std::string status_report();
+
+    static std::int64_t unix_time(clock::time_point time);
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_SYNCDAEMON_H
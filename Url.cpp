@@ -0,0 +1,193 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "Url.h"
+
+namespace {
+    constexpr std::string_view host = "weebcentral.com";
+
+    bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    bool isAlpha(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    bool isHexDigit(char c) {
+        return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+    }
+
+    // Characters of series IDs; real ones are ULIDs, but anything in this set is taken
+    bool isIdChar(char c) {
+        return isDigit(c) || (c >= 'A' && c <= 'Z');
+    }
+
+    // Like find_first_of, but compares inline instead of calling memchr for every character
+    template<std::size_t N>
+    std::size_t findAny(std::string_view text, const char (&set)[N], std::size_t from = 0) {
+        for (std::size_t i = from; i < text.size(); ++i) {
+            for (std::size_t j = 0; j + 1 < N; ++j) {
+                if (text[i] == set[j]) {
+                    return i;
+                }
+            }
+        }
+        return std::string_view::npos;
+    }
+
+    // Compares ASCII text ignoring case, for URL schemes
+    bool equalsIgnoreCase(std::string_view text, std::string_view lower) {
+        if (text.size() != lower.size()) {
+            return false;
+        }
+        for (std::size_t i = 0; i < text.size(); ++i) {
+            char c = text[i];
+            if (c >= 'A' && c <= 'Z') {
+                c = static_cast<char>(c - 'A' + 'a');
+            }
+            if (c != lower[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool isValidHost(std::string_view name) {
+        if (name.empty()) {
+            return false;
+        }
+
+        // IPv6 literal, e.g. [::1]
+        if (name.front() == '[') {
+            if (name.size() < 3 || name.back() != ']') {
+                return false;
+            }
+            for (char c: name.substr(1, name.size() - 2)) {
+                if (!isHexDigit(c) && c != ':' && c != '.') {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Host names and IPv4 addresses, maybe percent-encoded; bytes above ASCII are
+        // international domain names
+        for (char c: name) {
+            if (!isAlpha(c) && !isDigit(c) && c != '-' && c != '.' && c != '_' && c != '~' && c != '%' &&
+                static_cast<unsigned char>(c) < 0x80) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool isValidPort(std::string_view port) {
+        if (port.size() > 5) {
+            return false;
+        }
+
+        unsigned value = 0;
+        for (char c: port) {
+            if (!isDigit(c)) {
+                return false;
+            }
+            value = value * 10 + static_cast<unsigned>(c - '0');
+        }
+        return value <= 65535;
+    }
+}
+
+bool Url::isHttpUri(std::string_view uri) {
+    const std::size_t scheme_end = uri.find("://");
+    if (scheme_end == std::string_view::npos) {
+        return false;
+    }
+
+    const std::string_view scheme = uri.substr(0, scheme_end);
+    if (!equalsIgnoreCase(scheme, "http") && !equalsIgnoreCase(scheme, "https")) {
+        return false;
+    }
+
+    // Spaces and control characters are not allowed anywhere
+    for (char c: uri) {
+        const auto byte = static_cast<unsigned char>(c);
+        if (byte <= 0x20 || byte == 0x7F) {
+            return false;
+        }
+    }
+
+    const std::string_view rest = uri.substr(scheme_end + 3);
+    std::string_view authority = rest.substr(0, findAny(rest, "/?#"));
+
+    // User name and password, if any
+    const std::size_t at = authority.rfind('@');
+    if (at != std::string_view::npos) {
+        authority.remove_prefix(at + 1);
+    }
+
+    // The port follows the last ':' that is not inside an IPv6 literal
+    const std::size_t bracket = authority.rfind(']');
+    const std::size_t colon = authority.rfind(':');
+    if (colon != std::string_view::npos && (bracket == std::string_view::npos || colon > bracket)) {
+        return isValidPort(authority.substr(colon + 1)) && isValidHost(authority.substr(0, colon));
+    }
+
+    return isValidHost(authority);
+}
+
+std::string_view Url::seriesId(std::string_view url) {
+    constexpr std::string_view marker = "weebcentral.com/series/";
+
+    for (std::size_t start = url.find(marker); start != std::string_view::npos;
+         start = url.find(marker, start + 1)) {
+        std::size_t begin = start + marker.size();
+        std::size_t end = begin;
+        while (end < url.size() && isIdChar(url[end])) {
+            ++end;
+        }
+
+        if (end > begin) {
+            return url.substr(begin, end - begin);
+        }
+    }
+
+    return {};
+}
+
+std::string_view Url::chapterId(std::string_view url) {
+    constexpr std::string_view marker = "/chapters/";
+    std::size_t start = url.find(marker);
+    if (start == std::string_view::npos) {
+        return {};
+    }
+
+    start += marker.size();
+    const std::size_t end = findAny(url, "/?#", start);
+    return url.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start);
+}
+
+std::string_view Url::withoutQuery(std::string_view url) {
+    return url.substr(0, findAny(url, "?#"));
+}
+
+std::string_view Url::filename(std::string_view url) {
+    url = withoutQuery(url);
+
+    const std::size_t slash = url.rfind('/');
+    return slash == std::string_view::npos ? url : url.substr(slash + 1);
+}
+
+std::string Url::rebase(std::string_view url, std::string_view base_url) {
+    const std::size_t start = url.find(host);
+    if (start == std::string_view::npos) {
+        return std::string(url);
+    }
+
+    std::string rebased;
+    rebased.reserve(base_url.size() + url.size() - start - host.size());
+    rebased.append(base_url);
+    rebased.append(url.substr(start + host.size()));
+    return rebased;
+}
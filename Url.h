@@ -0,0 +1,72 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_URL_H
+#define WEEBCENTRAL_DOWNLOAD_URL_H
+
+#include <string>
+#include <string_view>
+
+/**
+ * Small URL helpers for the handful of URL shapes the site uses.
+ *
+ * They run for every series, chapter and image, so they are written by hand instead of with
+ * std::regex or curl's URL API, and except for rebase they return views into the given URL
+ * rather than allocating.
+ */
+namespace Url {
+    /**
+     * Checks that a URI is an absolute http or https URL with a host. This accepts what curl's
+     * URL parser accepts, except that the "//" and the host cannot be left out.
+     *
+     * @param uri The URI to check.
+     * @return Returns true if the URI is a valid HTTP/HTTPS URL; otherwise, false.
+     */
+    bool isHttpUri(std::string_view uri);
+
+    /**
+     * Extracts the series ID from a series URL (e.g. "https://weebcentral.com/series/<series_id>/Title").
+     * Series IDs are ULIDs, 26 characters of upper case letters and digits.
+     *
+     * @param url The series URL.
+     * @return A view of the series ID in url, or an empty view if url is not a series URL.
+     */
+    std::string_view seriesId(std::string_view url);
+
+    /**
+     * Extracts the chapter ID from a chapter URL (e.g. "/chapters/<chapter_id>").
+     *
+     * @param url The chapter URL, relative or absolute.
+     * @return A view of the chapter ID in url, or an empty view if url is not a chapter URL.
+     */
+    std::string_view chapterId(std::string_view url);
+
+    /**
+     * Drops the query and fragment of a URL.
+     *
+     * @param url The URL.
+     * @return A view of url up to its first '?' or '#'.
+     */
+    std::string_view withoutQuery(std::string_view url);
+
+    /**
+     * Returns the last segment of a URL's path, e.g. "001-001.png" for
+     * "https://example.com/manga/Title/001-001.png?v=2".
+     *
+     * @param url The URL.
+     * @return A view of the file name in url, empty if the path ends in '/'.
+     */
+    std::string_view filename(std::string_view url);
+
+    /**
+     * Points a Weeb Central URL at another origin, keeping its path and query.
+     *
+     * @param url A URL on weebcentral.com.
+     * @param base_url The origin to use instead (e.g. "http://127.0.0.1:8080").
+     * @return The URL on base_url, or url unchanged if it is not on weebcentral.com.
+     */
+    std::string rebase(std::string_view url, std::string_view base_url);
+}
+
+#endif //WEEBCENTRAL_DOWNLOAD_URL_H
@@ -4,11 +4,18 @@
 
 #include <iostream>
 #include <string>
-#include <regex>
 #include <filesystem>
 #include <fstream>
-#include <unordered_set>
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #include "Utils.h"
 
@@ -17,121 +24,195 @@
 #include "lexbor/html/interfaces/document.h"
 #include "models/Chapter.h"
 
+namespace {
+    // Characters invalid in file names on Windows/Linux/macOS, including / and \ since
+    // sanitizeFolderName works on folder *names* (not paths)
+    constexpr std::string_view invalidCharList = "<>:\"/\\|?*";
+
+    constexpr std::array<bool, 128> invalidChars = [] {
+        std::array<bool, 128> table{};
+        for (unsigned char c: invalidCharList) {
+            table[c] = true;
+        }
+        return table;
+    }();
+
+    // Printable ASCII that is kept as it is
+    bool isPlainByte(unsigned char c) {
+        return c >= 32 && c < 127 && !invalidChars[c];
+    }
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    constexpr std::size_t blockSize = 16;
+
+    // Returns true if all 16 bytes at p are plain, checking them at once
+    bool isPlainBlock(const char *p) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+
+        // Bytes of 0x80 and above are negative as signed bytes, so this also fails them
+        __m128i bad = _mm_cmplt_epi8(bytes, _mm_set1_epi8(32));
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(127)));
+        for (char c: invalidCharList) {
+            bad = _mm_or_si128(bad, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+        }
+        return _mm_movemask_epi8(bad) == 0;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    constexpr std::size_t blockSize = 16;
+
+    // Returns true if all 16 bytes at p are plain, checking them at once
+    bool isPlainBlock(const char *p) {
+        const uint8x16_t bytes = vld1q_u8(reinterpret_cast<const std::uint8_t *>(p));
+
+        uint8x16_t bad = vorrq_u8(vcltq_u8(bytes, vdupq_n_u8(32)), vcgeq_u8(bytes, vdupq_n_u8(127)));
+        for (char c: invalidCharList) {
+            bad = vorrq_u8(bad, vceqq_u8(bytes, vdupq_n_u8(static_cast<std::uint8_t>(c))));
+        }
+        return vmaxvq_u8(bad) == 0;
+    }
+#else
+    constexpr std::size_t blockSize = 8;
+
+    // Returns true if all 8 bytes at p are plain, checking them at once as one 64-bit word
+    bool isPlainBlock(const char *p) {
+        constexpr std::uint64_t ones = 0x0101010101010101ULL;
+        constexpr std::uint64_t highBits = 0x8080808080808080ULL;
+
+        std::uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+
+        // Sets the high bit of the result if any byte of x is below n (n <= 128) or zero
+        auto hasLess = [](std::uint64_t x, std::uint64_t n) {
+            return (x - ones * n) & ~x & highBits;
+        };
+
+        std::uint64_t bad = (word & highBits) | hasLess(word, 32) | hasLess(word ^ (ones * 127), 1);
+        for (char c: invalidCharList) {
+            bad |= hasLess(word ^ (ones * static_cast<unsigned char>(c)), 1);
+        }
+        return bad == 0;
+    }
+#endif
+
+    // Returns true for the names Windows reserves for devices, ignoring ASCII case
+    bool isReservedName(std::string_view name) {
+        auto upper = [](char c) {
+            return c >= 'a' && c <= 'z' ? static_cast<char>(c - 'a' + 'A') : c;
+        };
+
+        if (name.size() == 3) {
+            const char text[] = {upper(name[0]), upper(name[1]), upper(name[2]), '\0'};
+            const std::string_view base(text, 3);
+            return base == "CON" || base == "PRN" || base == "AUX" || base == "NUL";
+        }
+
+        if (name.size() == 4 && name[3] >= '1' && name[3] <= '9') {
+            const char text[] = {upper(name[0]), upper(name[1]), upper(name[2]), '\0'};
+            const std::string_view base(text, 3);
+            return base == "COM" || base == "LPT";
+        }
+
+        return false;
+    }
+
+    // Removes trailing dots and spaces, which are invalid at the end of names on Windows
+    void trimTrailingDotsAndSpaces(std::string &name) {
+        while (!name.empty() && (name.back() == '.' || name.back() == ' ')) {
+            name.pop_back();
+        }
+    }
+}
+
 // Helper function to sanitize folder names for cross-platform compatibility
-std::string Utils::sanitizeFolderName(const std::string &name) {
+std::string Utils::sanitizeFolderName(std::string_view name) {
     if (name.empty()) {
         return {};
     }
 
     std::string sanitized;
-    sanitized.reserve(name.size());
+    sanitized.reserve(name.size() + 1);
 
-    // Remove characters invalid on Windows/Linux/macOS
-    // Including / and \ since we're sanitizing folder *names* (not paths)
-    const std::string invalidChars = "<>:\"/\\|?*";
+    const char *data = name.data();
+    const std::size_t size = name.size();
 
-    // Process byte by byte, but preserve UTF-8 sequences
-    for (size_t i = 0; i < name.size();) {
-        unsigned char c = static_cast<unsigned char>(name[i]);
+    for (size_t i = 0; i < size;) {
+        // Most names are plain ASCII, which is copied a block at a time
+        size_t plain_end = i;
+        while (plain_end + blockSize <= size && isPlainBlock(data + plain_end)) {
+            plain_end += blockSize;
+        }
+        while (plain_end < size && isPlainByte(static_cast<unsigned char>(data[plain_end]))) {
+            plain_end++;
+        }
 
-        // Check if this is the start of a UTF-8 multibyte sequence
-        if (c >= 0x80) {
-            // UTF-8 multibyte character - copy the entire sequence
-            int bytes = 0;
-            if ((c & 0xE0) == 0xC0) bytes = 2; // 110xxxxx
-            else if ((c & 0xF0) == 0xE0) bytes = 3; // 1110xxxx
-            else if ((c & 0xF8) == 0xF0) bytes = 4; // 11110xxx
-            else {
-                // Invalid UTF-8 start byte, skip it
-                i++;
-                continue;
-            }
+        if (plain_end > i) {
+            sanitized.append(data + i, plain_end - i);
+            i = plain_end;
+            continue;
+        }
 
-            // Verify we have enough bytes and they're valid continuation bytes
-            bool valid = true;
-            if (i + bytes > name.size()) {
-                valid = false;
-            } else {
-                for (int j = 1; j < bytes; j++) {
-                    if ((static_cast<unsigned char>(name[i + j]) & 0xC0) != 0x80) {
-                        valid = false;
-                        break;
-                    }
-                }
-            }
+        unsigned char c = static_cast<unsigned char>(data[i]);
 
-            if (valid) {
-                // Copy the entire multibyte sequence
-                sanitized.append(name, i, bytes);
-                i += bytes;
-            } else {
-                // Invalid sequence, skip the byte
-                i++;
-            }
+        // Control characters (0-31), DEL (127) and invalid characters are skipped
+        if (c < 0x80) {
+            i++;
+            continue;
         }
-        // ASCII character
-        else {
-            char asciiChar = static_cast<char>(c);
 
-            // Skip control characters (0-31) and DEL (127)
-            if (c < 32 || c == 127) {
-                i++;
-                continue;
-            }
+        // Check if this is the start of a UTF-8 multibyte sequence
+        size_t bytes = 0;
+        if ((c & 0xE0) == 0xC0) bytes = 2; // 110xxxxx
+        else if ((c & 0xF0) == 0xE0) bytes = 3; // 1110xxxx
+        else if ((c & 0xF8) == 0xF0) bytes = 4; // 11110xxx
+        else {
+            // Invalid UTF-8 start byte, skip it
+            i++;
+            continue;
+        }
 
-            // Skip invalid characters
-            if (invalidChars.find(asciiChar) != std::string::npos) {
-                i++;
-                continue;
-            }
+        // Verify we have enough bytes and they're valid continuation bytes
+        bool valid = i + bytes <= size;
+        for (size_t j = 1; valid && j < bytes; j++) {
+            valid = (static_cast<unsigned char>(data[i + j]) & 0xC0) == 0x80;
+        }
 
-            sanitized += asciiChar;
+        if (valid) {
+            // Copy the entire multibyte sequence
+            sanitized.append(data + i, bytes);
+            i += bytes;
+        } else {
+            // Invalid sequence, skip the byte
             i++;
         }
     }
 
-    // Trim whitespace from both ends
+    // Trim spaces from both ends, in place
     auto start = sanitized.find_first_not_of(' ');
     if (start == std::string::npos) {
         return {}; // All whitespace
     }
 
-    auto end = sanitized.find_last_not_of(' ');
-    sanitized = sanitized.substr(start, end - start + 1);
+    sanitized.resize(sanitized.find_last_not_of(' ') + 1);
+    sanitized.erase(0, start);
 
     // Windows: Remove trailing dots and spaces (invalid on Windows)
-    while (!sanitized.empty() && (sanitized.back() == '.' || sanitized.back() == ' ')) {
-        sanitized.pop_back();
-    }
+    trimTrailingDotsAndSpaces(sanitized);
 
     // Check if empty after sanitization
     if (sanitized.empty()) {
         return {};
     }
 
-    // Windows: Check for reserved names (case-insensitive, ASCII only)
-    static const std::unordered_set<std::string> reservedNames = {
-        "CON", "PRN", "AUX", "NUL",
-        "COM1", "COM2", "COM3", "COM4", "COM5", "COM6", "COM7", "COM8", "COM9",
-        "LPT1", "LPT2", "LPT3", "LPT4", "LPT5", "LPT6", "LPT7", "LPT8", "LPT9"
-    };
-
-    // Extract ASCII prefix for reserved name check
-    std::string asciiPrefix;
-    for (char c: sanitized) {
-        if (static_cast<unsigned char>(c) >= 0x80) break;
-        asciiPrefix += c;
+    // Windows: Check for reserved names (case-insensitive, ASCII only). The part checked is the
+    // ASCII prefix of the name up to its first dot, e.g. "CON" for "con.txt"
+    size_t base_end = 0;
+    while (base_end < sanitized.size() && static_cast<unsigned char>(sanitized[base_end]) < 0x80 &&
+           sanitized[base_end] != '.') {
+        base_end++;
     }
 
-    std::string upperName = asciiPrefix;
-    std::ranges::transform(upperName, upperName.begin(),
-                           [](unsigned char c) { return std::toupper(c); });
-
-    auto dotPos = upperName.find('.');
-    std::string baseName = (dotPos != std::string::npos) ? upperName.substr(0, dotPos) : upperName;
-
-    if (reservedNames.contains(baseName)) {
-        sanitized = "_" + sanitized;
+    if (isReservedName(std::string_view(sanitized).substr(0, base_end))) {
+        sanitized.insert(sanitized.begin(), '_');
     }
 
     // Limit byte length (most filesystems support 255 bytes, not characters)
@@ -142,30 +223,17 @@ std::string Utils::sanitizeFolderName(const std::string &name) {
         while (cutPoint > 0 && (static_cast<unsigned char>(sanitized[cutPoint]) & 0xC0) == 0x80) {
             cutPoint--;
         }
-        sanitized = sanitized.substr(0, cutPoint);
+        sanitized.resize(cutPoint);
 
         // Re-trim trailing dots/spaces after truncation
-        while (!sanitized.empty() && (sanitized.back() == '.' || sanitized.back() == ' ')) {
-            sanitized.pop_back();
-        }
+        trimTrailingDotsAndSpaces(sanitized);
     }
 
     return sanitized;
 }
 
-// Extract series ID from URL
-std::string Utils::extractSeriesId(const std::string &url) {
-    std::regex seriesRegex(R"(weebcentral\.com/series/([A-Z0-9]+))");
-    std::smatch match;
-    if (std::regex_search(url, match, seriesRegex)) {
-        return match[1].str();
-    }
-    return {};
-}
-
 // Parse manga title from HTML
-std::string Utils::parseMangaTitle(lxb_html_document_t *document) {
-    lxb_dom_collection_t *collection = lxb_dom_collection_make(&document->dom_document, 16);
+std::string Utils::parseMangaTitle(lxb_html_document_t *document, lxb_dom_collection_t *collection) {
     lxb_status_t status;
 
     // Find <title> element
@@ -175,14 +243,17 @@ std::string Utils::parseMangaTitle(lxb_html_document_t *document) {
                                           5);
 
     if (status != LXB_STATUS_OK || lxb_dom_collection_length(collection) == 0) {
-        lxb_dom_collection_destroy(collection, true);
         return "";
     }
 
     lxb_dom_element_t *title_elem = lxb_dom_collection_element(collection, 0);
-    const lxb_char_t *text = lxb_dom_node_text_content(lxb_dom_interface_node(title_elem), nullptr);
+    lxb_char_t *text = lxb_dom_node_text_content(lxb_dom_interface_node(title_elem), nullptr);
+    if (text == nullptr) {
+        return "";
+    }
 
     std::string title = reinterpret_cast<const char *>(text);
+    lxb_dom_document_destroy_text(&document->dom_document, text);
 
     // Remove " | Weeb Central" suffix
     size_t pos = title.find(" | Weeb Central");
@@ -190,14 +261,11 @@ std::string Utils::parseMangaTitle(lxb_html_document_t *document) {
         title = title.substr(0, pos);
     }
 
-    lxb_dom_collection_destroy(collection, true);
     return title;
 }
 
 // Parse chapters from full-chapter-list HTML
-std::vector<Chapter> Utils::parseChapterList(lxb_html_document_t *document) {
-    std::vector<Chapter> chapters;
-    lxb_dom_collection_t *collection = lxb_dom_collection_make(&document->dom_document, 128);
+void Utils::parseChapterList(lxb_html_document_t *document, lxb_dom_collection_t *collection, ChapterTable &chapters) {
     lxb_status_t status;
 
     // Find all <a> elements with href containing "/chapters/"
@@ -207,83 +275,80 @@ std::vector<Chapter> Utils::parseChapterList(lxb_html_document_t *document) {
                                           1);
 
     if (status != LXB_STATUS_OK) {
-        lxb_dom_collection_destroy(collection, true);
-        return chapters;
+        return;
     }
 
-    for (size_t i = 0; i < lxb_dom_collection_length(collection); i++) {
+    // The page lists the newest chapter first, so walk it backwards to have Chapter 1 first
+    for (size_t i = lxb_dom_collection_length(collection); i-- > 0;) {
         lxb_dom_element_t *elem = lxb_dom_collection_element(collection, i);
 
         // Get href attribute
+        size_t href_length = 0;
         const lxb_char_t *href = lxb_dom_element_get_attribute(elem,
                                                                (const lxb_char_t *) "href",
                                                                4,
-                                                               nullptr);
-
-        if (href != nullptr) {
-            std::string href_str = reinterpret_cast<const char *>(href);
-
-            // Check if this is a chapter link
-            if (href_str.starts_with("/chapters/")) {
-                // Get the chapter name from the text content
-                // We need to find the <span> with the chapter name
-                lxb_dom_node_t *node = lxb_dom_interface_node(elem);
-                lxb_dom_node_t *child = node->first_child;
-
-                std::string chapterName;
-                while (child != nullptr) {
-                    if (child->type == LXB_DOM_NODE_TYPE_ELEMENT) {
-                        lxb_dom_element_t *child_elem = lxb_dom_interface_element(child);
-                        const lxb_char_t *class_attr = lxb_dom_element_get_attribute(child_elem,
-                            (const lxb_char_t *) "class",
-                            5,
-                            nullptr);
-
-                        if (class_attr != nullptr) {
-                            std::string class_str = reinterpret_cast<const char *>(class_attr);
-                            // Look for span with "grow flex items-center gap-2" class
-                            if (class_str.find("grow") != std::string::npos) {
-                                // Get first span child which contains chapter name
-                                lxb_dom_node_t *span_child = child->first_child;
-                                while (span_child != nullptr) {
-                                    if (span_child->type == LXB_DOM_NODE_TYPE_ELEMENT) {
-                                        const lxb_char_t *text = lxb_dom_node_text_content(span_child, nullptr);
-                                        if (text != nullptr) {
-                                            chapterName = reinterpret_cast<const char *>(text);
-                                            break;
-                                        }
-                                    }
-                                    span_child = span_child->next;
+                                                               &href_length);
+
+        if (href == nullptr) {
+            continue;
+        }
+
+        std::string_view href_str(reinterpret_cast<const char *>(href), href_length);
+
+        // Check if this is a chapter link
+        if (!href_str.starts_with("/chapters/")) {
+            continue;
+        }
+
+        // Get the chapter name from the text content
+        // We need to find the <span> with the chapter name
+        lxb_dom_node_t *node = lxb_dom_interface_node(elem);
+        lxb_dom_node_t *child = node->first_child;
+
+        chapters.begin_chapter(href_str);
+        while (child != nullptr) {
+            if (child->type == LXB_DOM_NODE_TYPE_ELEMENT) {
+                lxb_dom_element_t *child_elem = lxb_dom_interface_element(child);
+                size_t class_length = 0;
+                const lxb_char_t *class_attr = lxb_dom_element_get_attribute(child_elem,
+                    (const lxb_char_t *) "class",
+                    5,
+                    &class_length);
+
+                if (class_attr != nullptr) {
+                    std::string_view class_str(reinterpret_cast<const char *>(class_attr), class_length);
+                    // Look for span with "grow flex items-center gap-2" class
+                    if (class_str.find("grow") != std::string_view::npos) {
+                        // Get first span child which contains chapter name
+                        lxb_dom_node_t *span_child = child->first_child;
+                        while (span_child != nullptr) {
+                            if (span_child->type == LXB_DOM_NODE_TYPE_ELEMENT) {
+                                size_t text_length = 0;
+                                lxb_char_t *text = lxb_dom_node_text_content(span_child, &text_length);
+                                if (text != nullptr) {
+                                    chapters.append_name(
+                                        std::string_view(reinterpret_cast<const char *>(text), text_length));
+                                    lxb_dom_document_destroy_text(&document->dom_document, text);
+                                    break;
                                 }
-                                break;
                             }
+                            span_child = span_child->next;
                         }
+                        break;
                     }
-                    child = child->next;
-                }
-
-                if (!chapterName.empty()) {
-                    Chapter chapter;
-                    chapter.name = chapterName;
-                    chapter.url = href_str;
-                    chapters.push_back(chapter);
                 }
             }
+            child = child->next;
         }
-    }
-
-    lxb_dom_collection_destroy(collection, true);
 
-    // Reverse the order so Chapter 1 comes first
-    std::reverse(chapters.begin(), chapters.end());
-
-    return chapters;
+        // Chapters without a name are dropped by the table
+        chapters.end_chapter();
+    }
 }
 
 // Parse image URLs from chapter images page
-std::vector<std::string> Utils::parseChapterImageURIs(lxb_html_document_t *document) {
-    std::vector<std::string> image_uris;
-    lxb_dom_collection_t *collection = lxb_dom_collection_make(&document->dom_document, 128);
+void Utils::parseChapterImageURIs(lxb_html_document_t *document, lxb_dom_collection_t *collection, StringArena &arena,
+                                  std::vector<std::string_view> &image_uris) {
     lxb_status_t status;
 
     // Find all <img> elements with href containing "/chapters/" (FIX ME)
@@ -293,29 +358,21 @@ std::vector<std::string> Utils::parseChapterImageURIs(lxb_html_document_t *docum
                                           3);
 
     if (status != LXB_STATUS_OK) {
-        lxb_dom_collection_destroy(collection, true);
-        return image_uris;
+        return;
     }
 
     for (size_t i = 0; i < lxb_dom_collection_length(collection); i++) {
         lxb_dom_element_t *elem = lxb_dom_collection_element(collection, i);
 
         // Get src attribute
+        size_t src_length = 0;
         const lxb_char_t *src = lxb_dom_element_get_attribute(elem,
                                                               (const lxb_char_t *) "src",
                                                               3,
-                                                              nullptr);
+                                                              &src_length);
 
-        if (src != nullptr) {
-            std::string href_str = reinterpret_cast<const char *>(src);
-
-            if (!href_str.empty()) {
-                image_uris.push_back(href_str);
-            }
+        if (src != nullptr && src_length > 0) {
+            image_uris.push_back(arena.store(std::string_view(reinterpret_cast<const char *>(src), src_length)));
         }
     }
-
-    lxb_dom_collection_destroy(collection, true);
-
-    return image_uris;
 }
@@ -7,8 +7,10 @@
 
 
 #include <vector>  // Add this at the very top, before other includes
+#include "lexbor/dom/collection.h"
 #include "lexbor/html/interface.h"
-#include "models/Chapter.h"
+#include "StringArena.h"
+#include "models/ChapterTable.h"
 
 namespace Utils {
     /**
@@ -20,25 +22,36 @@ namespace Utils {
      * @return A sanitized version of the folder name. Returns an empty string if the input name is invalid
      *         or cannot be sanitized into a valid folder name.
      */
-    std::string sanitizeFolderName(const std::string &name);
+    std::string sanitizeFolderName(std::string_view name);
 
     /**
-     * Extracts the series ID from a given URL string. The method searches for a
-     * specific pattern in URLs (e.g., "weebcentral.com/series/<series_id>") and
-     * returns the series ID if it matches. If no valid series ID is found, an
-     * empty string is returned.
+     * Reads the manga title from a series page, without the " | Weeb Central" suffix.
      *
-     * @param url The URL string from which to extract the series ID.
-     * @return The extracted series ID as a string, or an empty string if no valid
-     *         series ID is found in the input URL.
+     * @param document The parsed series page.
+     * @param collection An empty collection of the document to run the query with.
+     * @return The title, or an empty string if the page has none.
      */
-    std::string extractSeriesId(const std::string &url);
+    std::string parseMangaTitle(lxb_html_document_t *document, lxb_dom_collection_t *collection);
 
-    std::string parseMangaTitle(lxb_html_document_t *document);
-
-    std::vector<Chapter> parseChapterList(lxb_html_document_t *document);
+    /**
+     * Reads the chapters from a full-chapter-list page, in reading order.
+     *
+     * @param document The parsed chapter list page.
+     * @param collection An empty collection of the document to run the query with.
+     * @param chapters Receives the chapters.
+     */
+    void parseChapterList(lxb_html_document_t *document, lxb_dom_collection_t *collection, ChapterTable &chapters);
 
-    std::vector<std::string> parseChapterImageURIs(lxb_html_document_t *document);
+    /**
+     * Reads the image URIs from a chapter's /images page, in page order.
+     *
+     * @param document The parsed images page.
+     * @param collection An empty collection of the document to run the query with.
+     * @param arena Receives the URIs.
+     * @param image_uris Receives the URIs, viewing strings in arena.
+     */
+    void parseChapterImageURIs(lxb_html_document_t *document, lxb_dom_collection_t *collection, StringArena &arena,
+                               std::vector<std::string_view> &image_uris);
 }
 
 
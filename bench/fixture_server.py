@@ -0,0 +1,281 @@
+#!/usr/bin/env python3
+"""
+Local stand-in for weebcentral.com used by the offline benchmark.
+
+Serves series pages, full chapter lists and chapter /images pages built from the templates in
+fixtures/, and synthetic images of a fixed size. Latency, per-connection bandwidth and errors
+can be injected. Every request is logged as a JSON line with its path, status, size and how
+long it took to serve, so the benchmark can report per-request latency.
+
+Run with --port 0 to pick a free port; the server prints "READY <port>" once it listens.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import random
+import re
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from string import Template
+
+FIXTURES = os.path.join(os.path.dirname(os.path.abspath(__file__)), "fixtures")
+
+# Crockford base32, as used by the ULIDs in real series and chapter URLs
+ULID_ALPHABET = "0123456789ABCDEFGHJKMNPQRSTVWXYZ"
+
+
+def load_template(name):
+    with open(os.path.join(FIXTURES, name), encoding="utf-8") as f:
+        return Template(f.read())
+
+
+def ulid(prefix, number):
+    """Deterministic 26-character ULID-like ID."""
+    digits = []
+    for _ in range(26 - len(prefix)):
+        digits.append(ULID_ALPHABET[number % 32])
+        number //= 32
+    return prefix + "".join(reversed(digits))
+
+
+class Site:
+    """The pages and images of the fixture site, generated on demand and cached."""
+
+    def __init__(self, args):
+        self.args = args
+        self.templates = {name: load_template(name + ".html") for name in
+                          ("series", "full-chapter-list", "chapter-entry", "images", "image-entry")}
+        self.pages = {}
+        self.images = {}
+        self.lock = threading.Lock()
+
+    def series_ids(self):
+        return [ulid("01J76XYFCDK6Y8GY447D", i) for i in range(self.args.series)]
+
+    def chapter_id(self, series_number, chapter_number):
+        return ulid("01J8" + ULID_ALPHABET[series_number % 32], chapter_number)
+
+    def series_number(self, series_id):
+        ids = self.series_ids()
+        return ids.index(series_id) if series_id in ids else None
+
+    def title(self, series_number):
+        # Titles mix in non-ASCII text, as many real titles do
+        return "Fixture Series %d: Ōkami to Kōshinryō ☆ ～ Édition" % (series_number + 1)
+
+    def page(self, key, build):
+        with self.lock:
+            body = self.pages.get(key)
+        if body is None:
+            body = build().encode("utf-8")
+            with self.lock:
+                self.pages[key] = body
+        return body
+
+    def series_page(self, base_url, series_number):
+        series_id = self.series_ids()[series_number]
+        return self.page(("series", series_number), lambda: self.templates["series"].substitute(
+            base_url=base_url, series_id=series_id, title=self.title(series_number),
+            description="Synthetic series served by the benchmark fixture server. " * 20))
+
+    def chapter_list(self, series_number):
+        def build():
+            entries = []
+            # Newest first, like the real site
+            for chapter in reversed(range(self.args.chapters)):
+                entries.append(self.templates["chapter-entry"].substitute(
+                    chapter_id=self.chapter_id(series_number, chapter),
+                    chapter_name="Chapter %d" % (chapter + 1)))
+            return self.templates["full-chapter-list"].substitute(
+                chapter_count=self.args.chapters, chapters="".join(entries))
+
+        return self.page(("list", series_number), build)
+
+    def images_page(self, base_url, chapter_id):
+        def build():
+            entries = []
+            for page in range(self.args.images):
+                entries.append(self.templates["image-entry"].substitute(
+                    src="%s/img/%s/%03d-%03d.png" % (base_url, chapter_id, 1, page + 1), page=page + 1))
+            return self.templates["images"].substitute(chapter_id=chapter_id, images="".join(entries))
+
+        return self.page(("images", chapter_id), build)
+
+    def image(self, chapter_id, name):
+        # The first page of every chapter is the same credits page, the rest are unique
+        shared = self.args.shared_pages > 0 and name <= "001-%03d.png" % self.args.shared_pages
+        key = name if shared else chapter_id + "/" + name
+        with self.lock:
+            body = self.images.get(key)
+        if body is None:
+            seed = hashlib.sha256(key.encode("utf-8")).digest()
+            block = hashlib.sha256(seed).digest() * 128  # 4 KiB
+            body = (block * (self.args.image_size // len(block) + 1))[:self.args.image_size]
+            body = b"\x89PNG\r\n\x1a\n" + seed + body[len(seed) + 8:]
+            with self.lock:
+                self.images[key] = body
+        return body
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "FixtureServer/1"
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_GET(self):
+        started = time.perf_counter()
+        status, sent = self.respond()
+        self.server.log_request_line(self.path, status, sent, time.perf_counter() - started)
+
+    def respond(self):
+        args = self.server.args
+        site = self.server.site
+        path = self.path.split("?", 1)[0]
+        base_url = "http://%s" % self.headers.get("Host", "127.0.0.1")
+
+        if args.latency_ms > 0 or args.jitter_ms > 0:
+            time.sleep((args.latency_ms + random.uniform(0, args.jitter_ms)) / 1000)
+
+        if args.error_rate > 0 and random.random() < args.error_rate:
+            return self.send_body(503, b"Service Unavailable", "text/plain")
+
+        match = re.fullmatch(r"/series/([0-9A-Z]{26})(?:/(full-chapter-list|[^/]*))?", path)
+        if match:
+            number = site.series_number(match.group(1))
+            if number is None:
+                return self.not_found()
+            if match.group(2) == "full-chapter-list":
+                return self.send_page(site.chapter_list(number))
+            return self.send_page(site.series_page(base_url, number))
+
+        match = re.fullmatch(r"/chapters/([0-9A-Z]{26})/images", path)
+        if match:
+            return self.send_page(site.images_page(base_url, match.group(1)))
+
+        match = re.fullmatch(r"/img/([0-9A-Z]{26})/(\d{3}-\d{3}\.png)", path)
+        if match:
+            return self.send_image(site.image(match.group(1), match.group(2)))
+
+        return self.not_found()
+
+    def not_found(self):
+        return self.send_body(404, b"Not Found", "text/plain")
+
+    def send_page(self, body):
+        etag = '"%s"' % hashlib.sha1(body).hexdigest()
+        if self.headers.get("If-None-Match") == etag:
+            self.send_response(304)
+            self.send_header("ETag", etag)
+            self.end_headers()
+            return 304, 0
+        return self.send_body(200, body, "text/html; charset=utf-8", {"ETag": etag})
+
+    def send_image(self, body):
+        # Resumed downloads ask for the rest of a partial image
+        start = 0
+        match = re.fullmatch(r"bytes=(\d+)-", self.headers.get("Range", ""))
+        if match:
+            start = int(match.group(1))
+            if start >= len(body):
+                self.send_response(416)
+                self.send_header("Content-Range", "bytes */%d" % len(body))
+                self.send_header("Content-Length", "0")
+                self.end_headers()
+                return 416, 0
+            headers = {"Content-Range": "bytes %d-%d/%d" % (start, len(body) - 1, len(body))}
+            return self.send_body(206, body[start:], "image/png", headers)
+        return self.send_body(200, body, "image/png")
+
+    def send_body(self, status, body, content_type, headers=None):
+        args = self.server.args
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        self.end_headers()
+
+        # A dropped connection sends only part of the body
+        drop = status == 200 and args.drop_rate > 0 and random.random() < args.drop_rate
+        limit = len(body) // 2 if drop else len(body)
+
+        chunk_size = 16 * 1024
+        sent = 0
+        started = time.perf_counter()
+        while sent < limit:
+            chunk = body[sent:min(sent + chunk_size, limit)]
+            self.wfile.write(chunk)
+            sent += len(chunk)
+            if args.bandwidth > 0:
+                ahead = sent / args.bandwidth - (time.perf_counter() - started)
+                if ahead > 0:
+                    time.sleep(ahead)
+
+        if drop:
+            self.close_connection = True
+            self.wfile.flush()
+            self.connection.shutdown(2)
+        return status, sent
+
+
+class FixtureServer(ThreadingHTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, args):
+        super().__init__((args.host, args.port), Handler)
+        self.args = args
+        self.site = Site(args)
+        self.log_file = open(args.log, "a", encoding="utf-8") if args.log else None
+        self.log_lock = threading.Lock()
+
+    def log_request_line(self, path, status, size, seconds):
+        if not self.log_file:
+            return
+        line = json.dumps({"path": path, "status": status, "bytes": size, "seconds": seconds})
+        with self.log_lock:
+            self.log_file.write(line + "\n")
+            self.log_file.flush()
+
+
+def add_arguments(parser):
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=0, help="0 picks a free port")
+    parser.add_argument("--series", type=int, default=1, help="number of series")
+    parser.add_argument("--chapters", type=int, default=20, help="chapters per series")
+    parser.add_argument("--images", type=int, default=15, help="images per chapter")
+    parser.add_argument("--image-size", type=int, default=256 * 1024, help="bytes per image")
+    parser.add_argument("--shared-pages", type=int, default=1,
+                        help="leading pages that are identical in every chapter")
+    parser.add_argument("--latency-ms", type=float, default=0, help="delay before every response")
+    parser.add_argument("--jitter-ms", type=float, default=0, help="random extra delay up to this")
+    parser.add_argument("--bandwidth", type=float, default=0, help="bytes per second per connection, 0 unlimited")
+    parser.add_argument("--error-rate", type=float, default=0, help="fraction of requests answered with 503")
+    parser.add_argument("--drop-rate", type=float, default=0, help="fraction of bodies cut off halfway")
+    parser.add_argument("--seed", type=int, default=1, help="seed for latency jitter and error injection")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    add_arguments(parser)
+    parser.add_argument("--log", help="append one JSON line per request to this file")
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+    server = FixtureServer(args)
+    print("READY %d" % server.server_address[1], flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
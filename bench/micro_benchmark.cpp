@@ -0,0 +1,855 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+// Micro-benchmarks of the functions that run for every chapter and image: sanitizing names,
+// reading IDs out of URLs and extracting chapter lists and image lists from pages. Every
+// benchmark reports the time and the heap allocations per operation, so that changes to these
+// functions can be judged on numbers.
+//
+// The pages are built from the fixture server's templates in bench/fixtures: a full chapter
+// list of 2,000 chapters, a long-strip chapter of 300 images and series pages whose titles mix
+// scripts. Run with --help for the options.
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "AllocationCounter.h"
+#include "HtmlStreamParser.h"
+#include "ImageCheck.h"
+#include "PageExtractor.h"
+#include "StringArena.h"
+#include "Url.h"
+#include "Utils.h"
+#include "models/ChapterTable.h"
+
+#ifndef WEEBCENTRAL_FIXTURES_DIR
+#define WEEBCENTRAL_FIXTURES_DIR "bench/fixtures"
+#endif
+
+namespace {
+    constexpr std::size_t chapterCount = 2000;
+    constexpr std::size_t longStripImages = 300;
+
+    // Titles as they appear on the site: Japanese, Korean, Chinese and Cyrillic text, accents,
+    // emoji, typographic punctuation and the characters that folder names cannot hold
+    const std::vector<std::string> unicodeTitles = {
+        "進撃の巨人",
+        "나 혼자만 레벨업",
+        "Ōkami to Kōshinryō ☆ ～ Édition",
+        "Kaguya-sama wa Kokurasetai: Tensai-tachi no Ren'ai Zunousen",
+        "Boku no Kokoro no Yabai Yatsu 💕",
+        "Sono Bisque Doll wa Koi wo Suru ～“Gojo-kun”～",
+        "Re:Zero kara Hajimeru Isekai Seikatsu - Daisanshou - Truth of Zero",
+        "魔道祖师 / Mo Dao Zu Shi",
+        "Ягодка и «Волк»",
+        "Çà et là… « Mémoires d'un cœur brisé »",
+        "Tensei Shitara Slime Datta Ken: Ibun ~Makoku Gurashi no Trinity~ ",
+        "Spy x Family | 間諜家家酒 | 스파이 패밀리",
+        "  ???  Who Are You?!  ",
+        "CON.manga",
+        "Kimetsu no Yaiba <Official> 鬼滅の刃 ★★★",
+        "Dungeon Meshi — Delicious in Dungeon 🍲🐉",
+    };
+
+    // Keeps the compiler from optimising away a result that is never used
+    template<typename T>
+    void keep(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "r"(&value) : "memory");
+#else
+        static const void *volatile sink;
+        sink = &value;
+#endif
+    }
+
+    struct Benchmark {
+        std::string name;
+        std::size_t operations; // Operations done by one call of run
+        std::function<void()> run;
+    };
+
+    struct Result {
+        std::uint64_t operations = 0;
+        double nanoseconds_per_operation = 0;
+        double allocations_per_operation = 0;
+    };
+
+    Result measure(const Benchmark &benchmark, std::chrono::nanoseconds min_time) {
+        using Clock = std::chrono::steady_clock;
+
+        // The first call grows buffers that later calls reuse, as a long run would
+        benchmark.run();
+
+        std::uint64_t runs = 1;
+        while (true) {
+            const std::uint64_t allocations = AllocationCounter::threadAllocations();
+            const auto start = Clock::now();
+            for (std::uint64_t i = 0; i < runs; ++i) {
+                benchmark.run();
+            }
+            const auto elapsed = Clock::now() - start;
+            const std::uint64_t allocated = AllocationCounter::threadAllocations() - allocations;
+
+            if (elapsed >= min_time || runs >= (std::uint64_t{1} << 40)) {
+                Result result;
+                result.operations = runs * benchmark.operations;
+                result.nanoseconds_per_operation =
+                        static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) /
+                        static_cast<double>(result.operations);
+                result.allocations_per_operation =
+                        static_cast<double>(allocated) / static_cast<double>(result.operations);
+                return result;
+            }
+
+            // Aim a little past min_time with the next attempt
+            const double elapsed_ns = static_cast<double>(
+                std::max<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), 1));
+            const double factor = std::clamp(1.2 * static_cast<double>(min_time.count()) / elapsed_ns, 2.0, 100.0);
+            runs = static_cast<std::uint64_t>(static_cast<double>(runs) * factor);
+        }
+    }
+
+    // The ways series IDs, URLs and image file names were handled before the Url functions,
+    // kept to compare against
+
+    std::string regexSeriesId(const std::string &url) {
+        std::regex seriesRegex(R"(weebcentral\.com/series/([A-Z0-9]+))");
+        std::smatch match;
+        if (std::regex_search(url, match, seriesRegex)) {
+            return match[1].str();
+        }
+        return {};
+    }
+
+    bool curlIsHttpUri(const std::string &uri) {
+        CURLU *url = curl_url();
+        bool is_http = false;
+        if (curl_url_set(url, CURLUPART_URL, uri.c_str(), 0) == CURLUE_OK) {
+            char *scheme = nullptr;
+            if (curl_url_get(url, CURLUPART_SCHEME, &scheme, 0) == CURLUE_OK) {
+                is_http = std::strcmp(scheme, "http") == 0 || std::strcmp(scheme, "https") == 0;
+                curl_free(scheme);
+            }
+        }
+        curl_url_cleanup(url);
+        return is_http;
+    }
+
+    std::string pathFilename(const std::string &url) {
+        std::string filename = std::filesystem::path(url).filename().string();
+        return filename.substr(0, std::min(filename.find('?'), filename.find('#')));
+    }
+
+    // sanitizeFolderName as it was before its block-wise fast path, which it must match exactly
+    std::string referenceSanitizeFolderName(std::string_view name) {
+        if (name.empty()) {
+            return {};
+        }
+
+        std::string sanitized;
+        sanitized.reserve(name.size());
+
+        // Remove characters invalid on Windows/Linux/macOS
+        // Including / and \ since we're sanitizing folder *names* (not paths)
+        const std::string invalidChars = "<>:\"/\\|?*";
+
+        // Process byte by byte, but preserve UTF-8 sequences
+        for (size_t i = 0; i < name.size();) {
+            unsigned char c = static_cast<unsigned char>(name[i]);
+
+            // Check if this is the start of a UTF-8 multibyte sequence
+            if (c >= 0x80) {
+                // UTF-8 multibyte character - copy the entire sequence
+                int bytes = 0;
+                if ((c & 0xE0) == 0xC0) bytes = 2; // 110xxxxx
+                else if ((c & 0xF0) == 0xE0) bytes = 3; // 1110xxxx
+                else if ((c & 0xF8) == 0xF0) bytes = 4; // 11110xxx
+                else {
+                    // Invalid UTF-8 start byte, skip it
+                    i++;
+                    continue;
+                }
+
+                // Verify we have enough bytes and they're valid continuation bytes
+                bool valid = true;
+                if (i + bytes > name.size()) {
+                    valid = false;
+                } else {
+                    for (int j = 1; j < bytes; j++) {
+                        if ((static_cast<unsigned char>(name[i + j]) & 0xC0) != 0x80) {
+                            valid = false;
+                            break;
+                        }
+                    }
+                }
+
+                if (valid) {
+                    // Copy the entire multibyte sequence
+                    sanitized.append(name, i, bytes);
+                    i += bytes;
+                } else {
+                    // Invalid sequence, skip the byte
+                    i++;
+                }
+            }
+            // ASCII character
+            else {
+                char asciiChar = static_cast<char>(c);
+
+                // Skip control characters (0-31) and DEL (127)
+                if (c < 32 || c == 127) {
+                    i++;
+                    continue;
+                }
+
+                // Skip invalid characters
+                if (invalidChars.find(asciiChar) != std::string::npos) {
+                    i++;
+                    continue;
+                }
+
+                sanitized += asciiChar;
+                i++;
+            }
+        }
+
+        // Trim whitespace from both ends
+        auto start = sanitized.find_first_not_of(' ');
+        if (start == std::string::npos) {
+            return {}; // All whitespace
+        }
+
+        auto end = sanitized.find_last_not_of(' ');
+        sanitized = sanitized.substr(start, end - start + 1);
+
+        // Windows: Remove trailing dots and spaces (invalid on Windows)
+        while (!sanitized.empty() && (sanitized.back() == '.' || sanitized.back() == ' ')) {
+            sanitized.pop_back();
+        }
+
+        // Check if empty after sanitization
+        if (sanitized.empty()) {
+            return {};
+        }
+
+        // Windows: Check for reserved names (case-insensitive, ASCII only)
+        static const std::unordered_set<std::string> reservedNames = {
+            "CON", "PRN", "AUX", "NUL",
+            "COM1", "COM2", "COM3", "COM4", "COM5", "COM6", "COM7", "COM8", "COM9",
+            "LPT1", "LPT2", "LPT3", "LPT4", "LPT5", "LPT6", "LPT7", "LPT8", "LPT9"
+        };
+
+        // Extract ASCII prefix for reserved name check
+        std::string asciiPrefix;
+        for (char c: sanitized) {
+            if (static_cast<unsigned char>(c) >= 0x80) break;
+            asciiPrefix += c;
+        }
+
+        std::string upperName = asciiPrefix;
+        std::ranges::transform(upperName, upperName.begin(),
+                               [](unsigned char c) { return std::toupper(c); });
+
+        auto dotPos = upperName.find('.');
+        std::string baseName = (dotPos != std::string::npos) ? upperName.substr(0, dotPos) : upperName;
+
+        if (reservedNames.contains(baseName)) {
+            sanitized = "_" + sanitized;
+        }
+
+        // Limit byte length (most filesystems support 255 bytes, not characters)
+        // Be careful not to cut in the middle of a UTF-8 sequence
+        if (sanitized.length() > 255) {
+            size_t cutPoint = 255;
+            // Walk back to find a safe UTF-8 boundary
+            while (cutPoint > 0 && (static_cast<unsigned char>(sanitized[cutPoint]) & 0xC0) == 0x80) {
+                cutPoint--;
+            }
+            sanitized = sanitized.substr(0, cutPoint);
+
+            // Re-trim trailing dots/spaces after truncation
+            while (!sanitized.empty() && (sanitized.back() == '.' || sanitized.back() == ' ')) {
+                sanitized.pop_back();
+            }
+        }
+
+        return sanitized;
+    }
+
+    // Compares sanitizeFolderName against the reference on the fixtures and on random names
+    // built from the bytes that take its slow paths. Returns false and reports the first
+    // difference if there is one.
+    bool checkSanitizer(const std::vector<std::string> &names) {
+        auto check = [](const std::string &name) {
+            if (Utils::sanitizeFolderName(name) == referenceSanitizeFolderName(name)) {
+                return true;
+            }
+
+            std::cerr << "sanitizeFolderName differs from the reference for the bytes:";
+            for (unsigned char c: name) {
+                std::fprintf(stderr, " %02x", c);
+            }
+            std::cerr << std::endl;
+            return false;
+        };
+
+        for (const std::string &name: names) {
+            if (!check(name)) {
+                return false;
+            }
+        }
+
+        const std::vector<std::string> pieces = {
+            " ", ".", "<", ">", ":", "\"", "/", "\\", "|", "?", "*", "\x7f", "\x01", "\t", "a", "Z", "9",
+            "con", "CON", "Com1", "lpt9", "NUL.", "aux", "prn.txt", "é", "日本", "💕", "\xe6\x97", "\xf0\x9f",
+            "\x80", "\xff", "\xc3", "~", "Chapter 12.5 ", "0123456789abcdef",
+        };
+
+        std::mt19937_64 random(1);
+        for (int i = 0; i < 200000; ++i) {
+            // Now and then a name long enough to be cut at 255 bytes
+            const std::size_t length = random() % (i % 64 == 0 ? 160 : 16);
+
+            std::string name;
+            for (std::size_t j = 0; j < length; ++j) {
+                if (random() % 4 == 0) {
+                    name += static_cast<char>(random() % 256);
+                } else {
+                    name += pieces[random() % pieces.size()];
+                }
+            }
+
+            if (!check(name)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // A small valid image of each checked format, named with its extension
+    std::vector<std::pair<std::string, std::string>> sampleImages() {
+        const std::string filler(100, '\x55');
+
+        std::string webp = std::string("RIFF") + std::string(4, '\0') + "WEBPVP8 " + filler;
+        const std::uint32_t riff_size = static_cast<std::uint32_t>(webp.size() - 8);
+        for (int i = 0; i < 4; ++i) {
+            webp[4 + i] = static_cast<char>(riff_size >> (8 * i) & 0xFF);
+        }
+
+        return {
+            {"page.jpg", std::string("\xFF\xD8\xFF\xE0") + filler + "\xFF\xD9"},
+            {"page.png", std::string("\x89PNG\r\n\x1A\n") + filler + std::string("\0\0\0\0IEND\xAE\x42\x60\x82", 12)},
+            {"page.webp", webp},
+            {"page.gif", std::string("GIF89a") + filler + "\x3B"},
+        };
+    }
+
+    // Checks ImageCheck on images fed in chunks of every size, on images resumed from partial
+    // files of every length (those between its head and tail buffers included), on a WebP whose
+    // RIFF size does not match, on an HTML page named .jpg and on an empty body. Returns false
+    // and reports the first wrong answer if there is one.
+    bool checkImageCheck() {
+        bool passed = true;
+        auto expect = [&passed](const std::string &what, ImageCheck::Problem problem, ImageCheck::Problem expected) {
+            if (problem != expected && passed) {
+                std::cerr << "ImageCheck found " << ImageCheck::describe(problem, ImageCheck::Format::unknown)
+                        << " instead of " << ImageCheck::describe(expected, ImageCheck::Format::unknown)
+                        << " for " << what << std::endl;
+                passed = false;
+            }
+        };
+
+        const std::filesystem::path partial = std::filesystem::temp_directory_path() / "weebcentral-imagecheck.part";
+        ImageCheck check;
+
+        for (const auto &[name, image]: sampleImages()) {
+            const auto size = static_cast<std::int64_t>(image.size());
+            const std::string_view bytes(image);
+
+            for (std::size_t chunk = 1; chunk <= image.size(); ++chunk) {
+                check.reset(ImageCheck::format_of(name));
+                for (std::size_t offset = 0; offset < image.size(); offset += chunk) {
+                    check.update(bytes.substr(offset, chunk));
+                }
+                expect(name + " in chunks of " + std::to_string(chunk), check.finish(size, true),
+                       ImageCheck::Problem::none);
+            }
+
+            // Cut short by a server that closed the connection after sending what it announced
+            check.reset(ImageCheck::format_of(name));
+            check.update(bytes.substr(0, image.size() - 1));
+            expect(name + " without its last byte", check.finish(size - 1, true), ImageCheck::Problem::truncated);
+            expect(name + " without its last byte", check.finish(size, false), ImageCheck::Problem::wrong_length);
+
+            for (std::size_t resumed = 1; resumed < image.size(); ++resumed) {
+                std::ofstream(partial, std::ios::binary).write(image.data(), static_cast<std::streamsize>(resumed));
+
+                check.reset(ImageCheck::format_of(name));
+                if (!check.resume(partial, resumed)) {
+                    std::cerr << "ImageCheck could not read back " << partial << std::endl;
+                    passed = false;
+                    break;
+                }
+                for (std::size_t offset = resumed; offset < image.size(); offset += 5) {
+                    check.update(bytes.substr(offset, 5));
+                }
+                expect(name + " resumed after " + std::to_string(resumed) + " bytes", check.finish(size, true),
+                       ImageCheck::Problem::none);
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::remove(partial, ec);
+
+        // A RIFF size that does not match the length is only caught with trailer checks
+        std::string webp = sampleImages()[2].second;
+        webp[4] = static_cast<char>(webp[4] + 1);
+        check.reset(ImageCheck::Format::webp);
+        check.update(webp);
+        expect("a WebP with a wrong RIFF size", check.finish(static_cast<std::int64_t>(webp.size()), true),
+               ImageCheck::Problem::truncated);
+        expect("a WebP with a wrong RIFF size", check.finish(static_cast<std::int64_t>(webp.size()), false),
+               ImageCheck::Problem::none);
+
+        const std::string_view html = "<!DOCTYPE html><html><body>Too many requests</body></html>";
+        check.reset(ImageCheck::format_of("https://example.com/0001.JPG"));
+        check.update(html);
+        expect("an HTML page named .jpg", check.finish(static_cast<std::int64_t>(html.size()), false),
+               ImageCheck::Problem::wrong_format);
+
+        check.reset(ImageCheck::Format::png);
+        expect("an empty body", check.finish(-1, false), ImageCheck::Problem::empty);
+        expect("an empty body", check.finish(0, true), ImageCheck::Problem::empty);
+
+        return passed;
+    }
+
+    std::string readFixture(const std::string &directory, const std::string &name) {
+        std::ifstream file(directory + "/" + name, std::ios::binary);
+        if (!file) {
+            std::cerr << "Could not read fixture " << directory << "/" << name << std::endl;
+            std::exit(1);
+        }
+
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        return contents.str();
+    }
+
+    // Fills in the $name placeholders of a fixture template, as Python's string.Template does
+    std::string substitute(std::string_view text, const std::vector<std::pair<std::string_view, std::string>> &values) {
+        std::string out;
+        out.reserve(text.size());
+
+        for (std::size_t i = 0; i < text.size();) {
+            if (text[i] != '$') {
+                out += text[i++];
+                continue;
+            }
+
+            std::size_t end = i + 1;
+            while (end < text.size() && (std::isalnum(static_cast<unsigned char>(text[end])) || text[end] == '_')) {
+                ++end;
+            }
+
+            const std::string_view name = text.substr(i + 1, end - i - 1);
+            auto value = std::ranges::find(values, name, &std::pair<std::string_view, std::string>::first);
+            if (value == values.end()) {
+                out += text[i++];
+                continue;
+            }
+
+            out += value->second;
+            i = end;
+        }
+
+        return out;
+    }
+
+    std::string ulid(std::string_view prefix, std::size_t number) {
+        constexpr std::string_view alphabet = "0123456789ABCDEFGHJKMNPQRSTVWXYZ";
+        std::string id(26, '0');
+        id.replace(0, prefix.size(), prefix);
+        for (std::size_t i = 26; i-- > prefix.size();) {
+            id[i] = alphabet[number % 32];
+            number /= 32;
+        }
+        return id;
+    }
+
+    struct Fixtures {
+        std::vector<std::string> series_pages;
+        std::string chapter_list_page;
+        std::string long_strip_page;
+        std::vector<std::string> series_urls;
+        std::vector<std::string> chapter_urls;
+        std::vector<std::string> chapter_names;
+        std::vector<std::string> image_urls;
+        std::vector<std::string> image_filenames;
+    };
+
+    Fixtures buildFixtures(const std::string &directory) {
+        const std::string series_template = readFixture(directory, "series.html");
+        const std::string list_template = readFixture(directory, "full-chapter-list.html");
+        const std::string entry_template = readFixture(directory, "chapter-entry.html");
+        const std::string images_template = readFixture(directory, "images.html");
+        const std::string image_template = readFixture(directory, "image-entry.html");
+
+        Fixtures fixtures;
+
+        for (std::size_t i = 0; i < unicodeTitles.size(); ++i) {
+            const std::string series_id = ulid("01J76XYFCDK6Y8GY447D", i);
+            fixtures.series_urls.push_back("https://weebcentral.com/series/" + series_id + "/Fixture-Series");
+            fixtures.series_pages.push_back(substitute(series_template, {
+                {"description", std::string(400, 'x')},
+                {"series_id", series_id},
+                {"base_url", "https://weebcentral.com"},
+                {"title", unicodeTitles[i]},
+            }));
+        }
+
+        // Newest first, like the real site, with the occasional half chapter and special
+        std::string entries;
+        for (std::size_t chapter = chapterCount; chapter-- > 0;) {
+            std::string name = "Chapter " + std::to_string(chapter + 1);
+            if (chapter % 200 == 199) {
+                name = "Special: Side Story " + std::to_string(chapter / 200 + 1) + " — 番外編";
+            } else if (chapter % 50 == 49) {
+                name += ".5";
+            }
+
+            const std::string chapter_id = ulid("01J8", chapter);
+            fixtures.chapter_urls.push_back("https://weebcentral.com/chapters/" + chapter_id);
+            fixtures.chapter_names.push_back(name);
+            entries += substitute(entry_template, {{"chapter_name", name}, {"chapter_id", chapter_id}});
+        }
+        fixtures.chapter_list_page = substitute(list_template, {
+            {"chapter_count", std::to_string(chapterCount)},
+            {"chapters", entries},
+        });
+
+        // A long-strip (webtoon) chapter is one tall image cut into many slices
+        const std::string chapter_id = ulid("01J9", 1);
+        std::string images;
+        for (std::size_t page = 1; page <= longStripImages; ++page) {
+            char filename[16];
+            std::snprintf(filename, sizeof(filename), "%03d-%03zu.png", 1, page);
+            fixtures.image_urls.push_back("https://hot.planeptune.us/manga/Fixture-Series/" + std::string(filename));
+            fixtures.image_filenames.emplace_back(filename);
+            images += substitute(image_template, {
+                {"page", std::to_string(page)},
+                {"src", fixtures.image_urls.back()},
+            });
+        }
+        fixtures.long_strip_page = substitute(images_template, {{"chapter_id", chapter_id}, {"images", images}});
+
+        return fixtures;
+    }
+
+    // Parses a whole page with the same parser the downloader uses for the document mode
+    lxb_html_document_t *parsePage(HtmlStreamParser &parser, const std::string &page) {
+        if (!parser.begin() || !parser.feed(page)) {
+            return nullptr;
+        }
+        return parser.finish();
+    }
+
+    // Extracts a page the way the downloader does, fed in chunks the size curl usually hands out
+    void extractPage(PageExtractor &extractor, PageExtractor::Page page, std::string_view body) {
+        constexpr std::size_t chunk_size = 16 * 1024;
+
+        extractor.begin(page);
+        for (std::size_t offset = 0; offset < body.size(); offset += chunk_size) {
+            extractor.feed(body.substr(offset, chunk_size));
+        }
+        extractor.finish();
+    }
+
+    // Chapter links the way the site writes them, except that the icons end in "/>" and the
+    // spacer before the time is an HTML element written the same way, which stays open
+    constexpr std::string_view selfClosingChapterList = R"(<div id="chapter-list">
+    <div class="flex items-center">
+        <a href="/chapters/01A" class="flex items-center p-2">
+            <span class="flex items-center"><svg viewBox="0 0 24 24"><path d="M4 6h16"/><circle r="2" /></svg></span>
+            <span class="grow flex items-center gap-2"><span class="">Chapter 2</span><span class="opacity-50"/></span>
+            <time datetime="2025-01-01T00:00:00.000Z">Jan 1, 2025</time>
+        </a>
+    </div>
+    <div class="flex items-center">
+        <a href="/chapters/01B" class="flex items-center p-2">
+            <span class="flex items-center"><svg viewBox="0 0 24 24"/></span>
+            <span class="grow flex items-center gap-2"><span class="">Chapter 1</span></span>
+        </a>
+    </div>
+</div>)";
+
+    // Checks that both parsers find the same chapters as the expected ones, with the page fed
+    // in pieces small enough to split every tag. Returns false and reports the parser that
+    // differs if one does.
+    bool checkExtractors() {
+        const std::vector<std::pair<std::string_view, std::string_view>> expected = {
+            {"Chapter 1", "/chapters/01B"},
+            {"Chapter 2", "/chapters/01A"},
+        };
+
+        for (ParserMode mode: {ParserMode::dom, ParserMode::scan}) {
+            PageExtractor extractor(mode);
+            extractor.begin(PageExtractor::Page::chapter_list);
+            for (std::size_t offset = 0; offset < selfClosingChapterList.size(); offset += 7) {
+                extractor.feed(selfClosingChapterList.substr(offset, 7));
+            }
+
+            std::vector<std::pair<std::string_view, std::string_view>> found;
+            if (extractor.finish()) {
+                for (const Chapter chapter: extractor.chapters) {
+                    found.emplace_back(chapter.name, chapter.url);
+                }
+            }
+
+            if (found != expected) {
+                std::cerr << "The " << (mode == ParserMode::dom ? "dom" : "scan")
+                        << " parser found " << found.size() << " of the chapters in the self-closing fixture"
+                        << std::endl;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void printUsage(const char *program) {
+        std::cout << "Usage: " << program << " [--filter <text>] [--min-time <ms>] [--fixtures <dir>] [--check]\n"
+                << "  --filter <text>    Only run the benchmarks whose name contains the text\n"
+                << "  --min-time <ms>    Minimum time each benchmark runs for (default: 250)\n"
+                << "  --fixtures <dir>   Folder of the page templates (default: " << WEEBCENTRAL_FIXTURES_DIR << ")\n"
+                << "  --check            Only run the checks that come before the benchmarks\n";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (!AllocationCounter::install()) {
+        std::cerr << "Could not count lexbor's allocations" << std::endl;
+        return 1;
+    }
+
+    std::string filter;
+    std::string fixtures_dir = WEEBCENTRAL_FIXTURES_DIR;
+    std::chrono::milliseconds min_time(250);
+    bool check_only = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            min_time = std::chrono::milliseconds(std::max(1, std::atoi(argv[++i])));
+        } else if (arg == "--fixtures" && i + 1 < argc) {
+            fixtures_dir = argv[++i];
+        } else if (arg == "--check") {
+            check_only = true;
+        } else {
+            printUsage(argv[0]);
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    const Fixtures fixtures = buildFixtures(fixtures_dir);
+
+    std::vector<std::string> names = unicodeTitles;
+    names.insert(names.end(), fixtures.chapter_names.begin(), fixtures.chapter_names.end());
+    names.insert(names.end(), fixtures.image_filenames.begin(), fixtures.image_filenames.end());
+    if (!checkSanitizer(names) || !checkImageCheck() || !checkExtractors()) {
+        return 1;
+    }
+    if (check_only) {
+        std::cout << "All checks passed" << std::endl;
+        return 0;
+    }
+
+    // Documents for the extraction benchmarks, parsed once so that only the queries are timed
+    HtmlStreamParser list_parser;
+    HtmlStreamParser images_parser;
+    HtmlStreamParser series_parser;
+    lxb_html_document_t *list_document = parsePage(list_parser, fixtures.chapter_list_page);
+    lxb_html_document_t *images_document = parsePage(images_parser, fixtures.long_strip_page);
+    lxb_html_document_t *series_document = parsePage(series_parser, fixtures.series_pages.front());
+    if (list_document == nullptr || images_document == nullptr || series_document == nullptr) {
+        std::cerr << "Could not parse the fixture pages" << std::endl;
+        return 1;
+    }
+
+    ChapterTable chapters;
+    StringArena arena;
+    std::vector<std::string_view> image_uris;
+    PageExtractor dom_extractor(ParserMode::dom);
+    PageExtractor scan_extractor(ParserMode::scan);
+    HtmlStreamParser parser;
+
+    const std::vector<Benchmark> benchmarks = {
+        {
+            "sanitizeFolderName/unicode-titles", unicodeTitles.size(), [&] {
+                for (const std::string &title: unicodeTitles) {
+                    keep(Utils::sanitizeFolderName(title));
+                }
+            }
+        },
+        {
+            "sanitizeFolderName/chapter-names", fixtures.chapter_names.size(), [&] {
+                for (const std::string &name: fixtures.chapter_names) {
+                    keep(Utils::sanitizeFolderName(name));
+                }
+            }
+        },
+        {
+            "sanitizeFolderName/image-filenames", fixtures.image_filenames.size(), [&] {
+                for (const std::string &filename: fixtures.image_filenames) {
+                    keep(Utils::sanitizeFolderName(filename));
+                }
+            }
+        },
+        {
+            "reference/sanitize/unicode-titles", unicodeTitles.size(), [&] {
+                for (const std::string &title: unicodeTitles) {
+                    keep(referenceSanitizeFolderName(title));
+                }
+            }
+        },
+        {
+            "reference/sanitize/chapter-names", fixtures.chapter_names.size(), [&] {
+                for (const std::string &name: fixtures.chapter_names) {
+                    keep(referenceSanitizeFolderName(name));
+                }
+            }
+        },
+        {
+            "Url::seriesId/series-urls", fixtures.series_urls.size(), [&] {
+                for (const std::string &url: fixtures.series_urls) {
+                    keep(Url::seriesId(url));
+                }
+            }
+        },
+        {
+            "regex/series-id/series-urls", fixtures.series_urls.size(), [&] {
+                for (const std::string &url: fixtures.series_urls) {
+                    keep(regexSeriesId(url));
+                }
+            }
+        },
+        {
+            "Url::isHttpUri/series-urls", fixtures.series_urls.size(), [&] {
+                for (const std::string &url: fixtures.series_urls) {
+                    keep(Url::isHttpUri(url));
+                }
+            }
+        },
+        {
+            "curl/is-http-uri/series-urls", fixtures.series_urls.size(), [&] {
+                for (const std::string &url: fixtures.series_urls) {
+                    keep(curlIsHttpUri(url));
+                }
+            }
+        },
+        {
+            "Url::chapterId/chapter-urls", fixtures.chapter_urls.size(), [&] {
+                for (const std::string &url: fixtures.chapter_urls) {
+                    keep(Url::chapterId(url));
+                }
+            }
+        },
+        {
+            "Url::filename/image-urls", fixtures.image_urls.size(), [&] {
+                for (const std::string &url: fixtures.image_urls) {
+                    keep(Url::filename(url));
+                }
+            }
+        },
+        {
+            "path/filename/image-urls", fixtures.image_urls.size(), [&] {
+                for (const std::string &url: fixtures.image_urls) {
+                    keep(pathFilename(url));
+                }
+            }
+        },
+        {
+            "parseMangaTitle/unicode-title", 1, [&] {
+                keep(Utils::parseMangaTitle(series_document, series_parser.collection()));
+            }
+        },
+        {
+            "parseChapterList/2000-chapters", 1, [&] {
+                chapters.clear();
+                Utils::parseChapterList(list_document, list_parser.collection(), chapters);
+                keep(chapters);
+            }
+        },
+        {
+            "parseChapterImageURIs/long-strip", 1, [&] {
+                arena.reset();
+                image_uris.clear();
+                Utils::parseChapterImageURIs(images_document, images_parser.collection(), arena, image_uris);
+                keep(image_uris);
+            }
+        },
+        {
+            "HtmlStreamParser/2000-chapters", 1, [&] {
+                keep(parsePage(parser, fixtures.chapter_list_page));
+            }
+        },
+        {
+            "PageExtractor/dom/2000-chapters", 1, [&] {
+                extractPage(dom_extractor, PageExtractor::Page::chapter_list, fixtures.chapter_list_page);
+            }
+        },
+        {
+            "PageExtractor/scan/2000-chapters", 1, [&] {
+                extractPage(scan_extractor, PageExtractor::Page::chapter_list, fixtures.chapter_list_page);
+            }
+        },
+        {
+            "PageExtractor/dom/long-strip", 1, [&] {
+                extractPage(dom_extractor, PageExtractor::Page::chapter_images, fixtures.long_strip_page);
+            }
+        },
+        {
+            "PageExtractor/scan/long-strip", 1, [&] {
+                extractPage(scan_extractor, PageExtractor::Page::chapter_images, fixtures.long_strip_page);
+            }
+        },
+    };
+
+    std::printf("%-40s %14s %14s %12s\n", "Benchmark", "Operations", "ns/op", "allocs/op");
+    for (const Benchmark &benchmark: benchmarks) {
+        if (!filter.empty() && benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        const Result result = measure(benchmark, min_time);
+        std::printf("%-40s %14llu %14.1f %12.2f\n", benchmark.name.c_str(),
+                    static_cast<unsigned long long>(result.operations), result.nanoseconds_per_operation,
+                    result.allocations_per_operation);
+        std::fflush(stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""
+Offline benchmark: runs weebcentral-download end to end against the local fixture server.
+
+Starts fixture_server.py, downloads its series into a scratch directory with the given build
+of weebcentral-download and reports throughput, per-request latency (p50/p99, as measured by
+the server from request to last byte), peak RSS and CPU time of the downloader. Runs are
+repeated with --runs; the median run is reported. Use --json to keep the results for comparing
+versions.
+
+Arguments after "--" are passed on to weebcentral-download, e.g. -- --workers 4 --parser scan.
+"""
+
+import argparse
+import json
+import os
+import platform
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+import zipfile
+
+import fixture_server
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+
+def percentile(values, fraction):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, max(0, round(fraction * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def start_server(args, log_path):
+    command = [sys.executable, os.path.join(BENCH_DIR, "fixture_server.py"), "--port", "0", "--log", log_path]
+    for name in ("series", "chapters", "images", "image_size", "shared_pages", "latency_ms", "jitter_ms",
+                 "bandwidth", "error_rate", "drop_rate", "seed"):
+        command += ["--" + name.replace("_", "-"), str(getattr(args, name))]
+
+    server = subprocess.Popen(command, stdout=subprocess.PIPE, text=True)
+    line = server.stdout.readline()
+    if not line.startswith("READY "):
+        server.kill()
+        raise RuntimeError("fixture server did not start")
+    return server, int(line.split()[1])
+
+
+def run_downloader(binary, arguments, work_dir, quiet):
+    """Runs the downloader and returns its exit code, wall time and resource usage."""
+    output = subprocess.DEVNULL if quiet else None
+    started = time.perf_counter()
+    process = subprocess.Popen([binary] + arguments, cwd=work_dir, stdout=output, stderr=output)
+    _, status, usage = os.wait4(process.pid, 0)
+    wall = time.perf_counter() - started
+    process.returncode = os.waitstatus_to_exitcode(status)
+
+    # ru_maxrss is in KiB on Linux but in bytes on macOS
+    peak_rss = usage.ru_maxrss if platform.system() == "Darwin" else usage.ru_maxrss * 1024
+    return process.returncode, wall, usage.ru_utime, usage.ru_stime, peak_rss
+
+
+def count_images(work_dir):
+    """Counts the images written, as files or as entries of .cbz archives."""
+    count = 0
+    for folder, _, files in os.walk(work_dir):
+        for name in files:
+            if name.endswith(".png"):
+                count += 1
+            elif name.endswith(".cbz"):
+                with zipfile.ZipFile(os.path.join(folder, name)) as archive:
+                    count += sum(1 for entry in archive.namelist() if entry.endswith(".png"))
+    return count
+
+
+def run_once(args, passthrough):
+    scratch = tempfile.mkdtemp(prefix="weebcentral-bench-")
+    log_path = os.path.join(scratch, "requests.jsonl")
+    work_dir = os.path.join(scratch, "library")
+    os.makedirs(work_dir)
+
+    server, port = start_server(args, log_path)
+    try:
+        series_ids = [fixture_server.ulid("01J76XYFCDK6Y8GY447D", i) for i in range(args.series)]
+        uris = ["https://weebcentral.com/series/%s/Fixture-Series" % series_id for series_id in series_ids]
+        arguments = ["--base-url", "http://127.0.0.1:%d" % port] + passthrough + uris
+        exit_code, wall, user, system, peak_rss = run_downloader(args.binary, arguments, work_dir, not args.verbose)
+    finally:
+        server.terminate()
+        server.wait()
+
+    with open(log_path, encoding="utf-8") as f:
+        requests = [json.loads(line) for line in f if line.strip()]
+
+    images = [r for r in requests if r["path"].startswith("/img/")]
+    expected_images = args.series * args.chapters * args.images
+    downloaded_images = count_images(work_dir)
+
+    if args.keep:
+        print("Kept scratch directory: %s" % scratch)
+    else:
+        shutil.rmtree(scratch, ignore_errors=True)
+
+    served_bytes = sum(r["bytes"] for r in requests)
+    return {
+        "exit_code": exit_code,
+        "wall_seconds": wall,
+        "user_seconds": user,
+        "system_seconds": system,
+        "peak_rss_bytes": peak_rss,
+        "requests": len(requests),
+        "failed_requests": sum(1 for r in requests if r["status"] >= 400),
+        "bytes": served_bytes,
+        "images_expected": expected_images,
+        "images_downloaded": downloaded_images,
+        "images_per_second": downloaded_images / wall if wall > 0 else 0,
+        "megabytes_per_second": served_bytes / wall / 1e6 if wall > 0 else 0,
+        "latency_p50_ms": percentile([r["seconds"] for r in requests], 0.50) * 1000,
+        "latency_p99_ms": percentile([r["seconds"] for r in requests], 0.99) * 1000,
+        "image_latency_p50_ms": percentile([r["seconds"] for r in images], 0.50) * 1000,
+        "image_latency_p99_ms": percentile([r["seconds"] for r in images], 0.99) * 1000,
+    }
+
+
+def report(result, runs):
+    print("weebcentral-download offline benchmark (median of %d run%s)" % (runs, "" if runs == 1 else "s"))
+    print("  Exit code:      %d" % result["exit_code"])
+    print("  Images:         %d of %d downloaded" % (result["images_downloaded"], result["images_expected"]))
+    print("  Wall time:      %.3f s" % result["wall_seconds"])
+    print("  Throughput:     %.1f images/s, %.2f MB/s" % (result["images_per_second"],
+                                                         result["megabytes_per_second"]))
+    print("  Requests:       %d (%d failed)" % (result["requests"], result["failed_requests"]))
+    print("  Latency:        p50 %.2f ms, p99 %.2f ms (images: p50 %.2f ms, p99 %.2f ms)" % (
+        result["latency_p50_ms"], result["latency_p99_ms"],
+        result["image_latency_p50_ms"], result["image_latency_p99_ms"]))
+    print("  CPU time:       %.3f s user, %.3f s system" % (result["user_seconds"], result["system_seconds"]))
+    print("  Peak RSS:       %.1f MiB" % (result["peak_rss_bytes"] / (1024 * 1024)))
+
+
+def main():
+    argv = sys.argv[1:]
+    passthrough = []
+    if "--" in argv:
+        split = argv.index("--")
+        argv, passthrough = argv[:split], argv[split + 1:]
+
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--binary", required=True, help="path to the weebcentral-download executable")
+    parser.add_argument("--runs", type=int, default=3, help="number of runs, the median is reported")
+    parser.add_argument("--json", help="write the median result and the settings to this file")
+    parser.add_argument("--keep", action="store_true", help="keep the scratch directories")
+    parser.add_argument("--verbose", action="store_true", help="show the downloader's output")
+    fixture_server.add_arguments(parser)
+    args = parser.parse_args(argv)
+
+    # Without this, the default request rate limit would be all the benchmark measures
+    if not any(arg == "--rate" for arg in passthrough):
+        passthrough = ["--rate", "0"] + passthrough
+
+    args.binary = os.path.abspath(args.binary)
+    results = [run_once(args, passthrough) for _ in range(max(args.runs, 1))]
+    result = sorted(results, key=lambda r: r["wall_seconds"])[len(results) // 2]
+    result["wall_seconds_stdev"] = statistics.pstdev(r["wall_seconds"] for r in results)
+
+    report(result, len(results))
+
+    if args.json:
+        settings = {name: value for name, value in vars(args).items() if name not in ("json", "keep", "verbose")}
+        settings["downloader_arguments"] = passthrough
+        with open(args.json, "w", encoding="utf-8") as f:
+            json.dump({"settings": settings, "result": result, "runs": results}, f, indent=2)
+
+    complete = result["exit_code"] == 0 and result["images_downloaded"] == result["images_expected"]
+    return 0 if complete else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -3,189 +3,773 @@
 //
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
-#include <chrono>
+#include <string_view>
+#include <cstring>
 #include <ranges>
-#include <thread>
 
+#include "AllocationCounter.h"
+#include "ChapterPipeline.h"
+#include "HttpCache.h"
 #include "HttpClient.h"
+#include "ImageStore.h"
+#include "MemoryBudget.h"
+#include "Metrics.h"
+#include "PageExtractor.h"
+#include "Storage.h"
+#include "SyncDaemon.h"
+#include "Url.h"
 #include "Utils.h"
 #include "models/Chapter.h"
-#include "lexbor/html/interfaces/document.h"
+#include "models/Options.h"
+#include "models/Series.h"
+
+// Allocations are counted only in builds that replace operator new with AllocationHooks.cpp
+#ifdef WEEBCENTRAL_COUNT_ALLOCATIONS
+constexpr bool countAllocations = true;
+#else
+constexpr bool countAllocations = false;
+#endif
 
-std::string getMangaTitle(HttpClient &http_client, const std::string &manga_uri);
+// Outcome of fetching a page into a PageExtractor
+enum class FetchResult {
+    parsed, // The page was parsed and its results are in the extractor
+    unchanged, // The page did not change since it was cached and did not need to be parsed
+    failed
+};
+
+FetchResult fetchPage(HttpClient &http_client, const std::string &url, PageExtractor &extractor,
+                      PageExtractor::Page page, const std::function<bool()> &skip_if_unchanged);
+
+std::string getMangaTitle(HttpClient &http_client, const std::string &manga_uri, PageExtractor &extractor);
 
 bool createMangaDirectory(const std::string &manga_title, std::filesystem::path &manga_folder);
 
-std::vector<Chapter> getChapters(HttpClient &http_client, const std::string &series_id);
+ChapterTable getChapters(HttpClient &http_client, const std::string &base_url, const std::string &series_id,
+                         PageExtractor &extractor, const std::string &synced_validator, std::string &list_validator,
+                         bool &up_to_date);
+
+bool lookUpSeries(HttpClient &http_client, const std::string &manga_uri, const std::string &base_url,
+                  PageExtractor &extractor, Series &series);
+
+void markSynced(Series &series);
+
+bool syncSeries(HttpClient &http_client, const Options &options, const std::vector<std::string> &manga_uris,
+                PageExtractor &extractor, ChapterPipeline &pipeline);
+
+bool readWatchList(const Options &options, std::vector<std::string> &manga_uris);
+
+void printSummary(HttpClient &http_client, const std::vector<PageExtractor::Stats> &parser_stats);
+
+bool readBatchFile(const std::string &path, std::vector<std::string> &manga_uris);
 
-std::vector<std::string> getChapterImageURIs(HttpClient &http_client, const std::string &chapter_uri);
+void printUsage(const char *program);
+
+bool parseArguments(int argc, char *argv[], Options &options);
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <manga_uri>" << std::endl;
-        std::cerr << "Example: " << argv[0] << " https://weebcentral.com/series/01J76XYFCDK6Y8GY447DTTTZ2F" <<
-                std::endl;
-        return 1;
+    // Lets the parser statistics include lexbor's own allocations
+    if (countAllocations && !AllocationCounter::install()) {
+        std::cerr << "Warning: Could not count lexbor's allocations" << std::endl;
     }
 
-    std::string arg = argv[1];
-
-    // Convert to lowercase for case-insensitive comparison
-    std::string arg_lower = arg;
-    std::ranges::transform(arg_lower, arg_lower.begin(),
-                          [](unsigned char c) { return std::tolower(c); });
+    Options options;
+    if (!parseArguments(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
 
     // Check for version flag
-    if (arg_lower == "-v" || arg_lower == "--version") {
+    if (options.show_version) {
         std::cout << "weebcentral-download version 0.1" << std::endl;
         return 0;
     }
 
-    const std::string& manga_uri = arg;
-
     HttpClient http_client;
+    http_client.set_concurrency(options.concurrency, options.per_host_concurrency);
+
+    RateLimiter::Limits limits;
+    limits.requests_per_second = options.requests_per_second;
+    limits.request_burst = options.request_burst;
+    limits.bytes_per_second = options.bytes_per_second;
+    http_client.set_rate_limits(limits);
+
+    RetryPolicy::Settings retry_settings;
+    retry_settings.max_attempts = static_cast<int>(std::min<std::size_t>(options.retries, 100)) + 1;
+    http_client.set_retry_policy(retry_settings);
+    http_client.set_trailer_check(options.check_trailers);
+
+    // Series pages and chapter lists are revalidated instead of downloaded again when unchanged
+    std::unique_ptr<HttpCache> http_cache;
+    if (options.use_cache) {
+        http_cache = std::make_unique<HttpCache>(options.cache_dir);
+        http_client.set_cache(http_cache.get());
+    }
+
+    // Timings of every request and stage, kept for the summary and written out if asked for
+    Metrics metrics;
+    if (!metrics.open(options.metrics_path, options.trace_path)) {
+        std::cerr << "Error: Could not create the metrics or trace file" << std::endl;
+        return 1;
+    }
+    metrics.name_thread("main");
+    http_client.set_metrics(&metrics);
+
+    // Images repeated across chapters, such as credit pages, are stored once and hard linked
+    std::unique_ptr<ImageStore> image_store;
+    if (options.dedup) {
+        image_store = std::make_unique<ImageStore>(options.store_dir);
+        http_client.set_image_store(image_store.get());
+    }
+
+    // Images that finish ahead of their turn in an archive wait in memory only up to this much
+    MemoryBudget memory_budget(options.memory_limit);
+    http_client.set_memory_budget(&memory_budget);
+
+    // Both are kept for every sync, so their buffers only grow once
+    PageExtractor extractor(options.parser);
+    ChapterPipeline pipeline(http_client, options.workers, options.parser, options.output_format);
+    pipeline.set_base_url(options.base_url);
+
+    bool success = true;
+    if (options.daemon) {
+        SyncDaemon::Settings daemon_settings;
+        daemon_settings.interval = std::chrono::minutes(options.poll_interval);
+        daemon_settings.queue_path = options.queue_path;
+        daemon_settings.status_socket = options.status_socket;
+
+        // A batch file that cannot be read, e.g. while it is being saved, leaves the list as it was
+        std::vector<std::string> watched = options.manga_uris;
+        auto watch_list = [&options, &watched] {
+            std::vector<std::string> manga_uris;
+            if (readWatchList(options, manga_uris)) {
+                watched = std::move(manga_uris);
+            }
+            return watched;
+        };
+        auto sync = [&](const std::string &manga_uri) {
+            return syncSeries(http_client, options, {manga_uri}, extractor, pipeline);
+        };
+
+        SyncDaemon daemon(http_client, daemon_settings);
+        success = daemon.run(watch_list, sync);
+    } else {
+        success = syncSeries(http_client, options, options.manga_uris, extractor, pipeline);
+    }
+
+    printSummary(http_client, {extractor.stats(), pipeline.parser_stats()});
+    metrics.close();
+
+    return success ? 0 : 1;
+}
+
+bool syncSeries(HttpClient &http_client, const Options &options, const std::vector<std::string> &manga_uris,
+                PageExtractor &extractor, ChapterPipeline &pipeline) {
+    // Look up every series before the chapters of all of them are scheduled together
+    std::vector<Series> series_list;
+    bool lookup_failed = false;
+
+    for (const std::string &manga_uri: manga_uris) {
+        Series series;
+        if (!lookUpSeries(http_client, manga_uri, options.base_url, extractor, series)) {
+            // A single series keeps failing fast; in a batch the other series carry on
+            if (manga_uris.size() == 1) {
+                return false;
+            }
+
+            std::cerr << "Skipping series: " << manga_uri << std::endl;
+            lookup_failed = true;
+            continue;
+        }
+
+        series_list.push_back(std::move(series));
+    }
+
+    bool success = pipeline.run(series_list) && !lookup_failed;
+
+    for (Series &series: series_list) {
+        markSynced(series);
+    }
+
+    if (success) {
+        std::cout << "\nDownload completed." << std::endl;
+    } else {
+        std::cerr << "\nDownload finished with errors." << std::endl;
+    }
+
+    return success;
+}
 
+bool lookUpSeries(HttpClient &http_client, const std::string &manga_uri, const std::string &base_url,
+                  PageExtractor &extractor, Series &series) {
     // Validate URI
     if (!http_client.is_valid_http_uri(manga_uri)) {
         std::cerr << "Invalid Manga URI: " << manga_uri << std::endl;
-        return 1;
+        return false;
     }
 
     std::cout << "Manga URI: " << manga_uri << std::endl;
 
     // Extract Series ID from URI
-    std::string series_id = Utils::extractSeriesId(manga_uri);
+    std::string series_id(Url::seriesId(manga_uri));
 
     if (series_id.empty()) {
         std::cerr << "Error: Could not extract series ID from URI" << std::endl;
-        return 1;
+        return false;
     }
 
     std::cout << "Series ID: " << series_id << std::endl;
 
     // Look up manga title
     std::cout << "Looking up manga title..." << std::endl;
-    std::string manga_title = getMangaTitle(http_client, manga_uri);
+    std::string manga_title;
+    {
+        Metrics::Label metrics_label(series_id);
+        manga_title = getMangaTitle(http_client, Url::rebase(manga_uri, base_url), extractor);
+    }
 
     if (manga_title.empty()) {
         std::cerr << "Error: Could not look up manga title" << std::endl;
-        return 1;
+        return false;
     }
 
     std::cout << "Manga title: " << manga_title << std::endl;
 
+    Metrics::Label metrics_label(manga_title);
+
     // Create directory using the manga's title
     std::filesystem::path manga_folder;
     bool folderSuccess = createMangaDirectory(manga_title, manga_folder);
 
     if (!folderSuccess) {
-        return 1;
+        return false;
     }
 
     std::cout << "Created manga folder: " << manga_folder << std::endl;
 
+    series.uri = manga_uri;
+    series.id = series_id;
+    series.title = manga_title;
+    series.folder = manga_folder;
+
+    // Only chapters that the index does not know as complete need to be looked at
+    Storage::loadSeriesIndex(series.folder, series.index);
+
     // Get chapters
-    std::vector<Chapter> chapters = getChapters(http_client, series_id);
+    bool up_to_date = false;
+    ChapterTable chapters = getChapters(http_client, base_url, series_id, extractor, series.index.synced_validator,
+                                        series.list_validator, up_to_date);
+
+    if (up_to_date) {
+        std::cout << "\nChapter list unchanged since the last complete download, nothing to do." << std::endl;
+        return true;
+    }
 
     if (chapters.empty()) {
         std::cerr << "Error: Could not get chapters" << std::endl;
-        return 1;
+        return false;
+    }
+
+    series.chapters = std::move(chapters);
+
+    std::size_t corrupt_chapters = 0;
+    for (std::size_t i = 0; i < series.chapters.size(); ++i) {
+        auto indexed = series.index.chapters.find(Url::chapterId(series.chapters[i].url));
+        if (indexed == series.index.chapters.end() || !indexed->second.complete) {
+            series.pending_chapters.push_back(i);
+        }
+        if (indexed != series.index.chapters.end() && indexed->second.corrupt) {
+            ++corrupt_chapters;
+        }
+    }
+
+    std::cout << "\nFound " << series.chapters.size() << " chapters, " << series.pending_chapters.size()
+            << " new or incomplete";
+    if (corrupt_chapters > 0) {
+        std::cout << " (" << corrupt_chapters << " with corrupt images last time)";
+    }
+    std::cout << "." << std::endl;
+
+    return true;
+}
+
+void markSynced(Series &series) {
+    if (series.list_validator.empty() || series.list_validator == series.index.synced_validator) {
+        return;
+    }
+
+    // Only a chapter list whose every chapter is on disk lets later runs skip it while it is unchanged
+    for (Chapter chapter: series.chapters) {
+        auto indexed = series.index.chapters.find(Url::chapterId(chapter.url));
+        if (indexed == series.index.chapters.end() || !indexed->second.complete) {
+            return;
+        }
+    }
+
+    series.index.synced_validator = series.list_validator;
+    if (!Storage::saveSeriesIndex(series.folder, series.index)) {
+        std::cerr << "Warning: Could not write the chapter index of " << series.title << std::endl;
+    }
+}
+
+void printSummary(HttpClient &http_client, const std::vector<PageExtractor::Stats> &parser_stats) {
+    const HttpClient::ConnectionStats connection_stats = http_client.connection_stats();
+    std::cout << "Connections: " << connection_stats.opened << " opened, "
+            << connection_stats.reused << " reused" << std::endl;
+
+    const RetryStats retry_stats = http_client.retry_stats();
+    std::cout << "Requests: " << retry_stats.requests << " in " << retry_stats.attempts << " attempts ("
+            << retry_stats.retries << " retries, " << retry_stats.recovered << " recovered, "
+            << retry_stats.exhausted << " gave up, " << retry_stats.fatal << " fatal)" << std::endl;
+
+    if (retry_stats.attempts > retry_stats.requests || retry_stats.fatal > 0) {
+        std::cout << "Failed attempts: " << retry_stats.timeouts << " timeouts, " << retry_stats.connection_errors
+                << " connection errors, " << retry_stats.rate_limited << " rate limited, "
+                << retry_stats.server_errors << " server errors, " << retry_stats.client_errors
+                << " client errors, " << retry_stats.corrupt << " corrupt images, " << retry_stats.other_errors
+                << " other" << std::endl;
+    }
+
+    // Pages are requested compressed; this shows how much that saved
+    const HttpClient::HtmlStats html_stats = http_client.html_stats();
+    if (html_stats.responses > 0) {
+        std::cout << "HTML: " << html_stats.responses << " responses (" << html_stats.compressed << " compressed), "
+                << html_stats.received_bytes / 1024 << " KiB received for "
+                << html_stats.decoded_bytes / 1024 << " KiB of pages" << std::endl;
+    }
+
+    // Each extractor allocates while its buffers grow on its first page; after that, a page
+    // should need next to nothing
+    std::size_t pages = 0;
+    std::size_t warm_pages = 0;
+    std::uint64_t warm_allocations = 0;
+    for (const PageExtractor::Stats &stats: parser_stats) {
+        pages += stats.pages;
+        if (stats.pages > 1) {
+            warm_pages += stats.pages - 1;
+            warm_allocations += stats.allocations - stats.first_page_allocations;
+        }
     }
 
-    const std::size_t chapters_count = chapters.size();
+    if (pages > 0) {
+        std::cout << "Parsing: " << pages << " pages";
+        if (countAllocations && warm_pages > 0) {
+            std::cout << ", " << static_cast<double>(warm_allocations) / static_cast<double>(warm_pages)
+                    << " allocations per page after the first";
+        }
+        std::cout << std::endl;
+    }
 
-    std::cout << "\nFound " << chapters_count << " chapters:" << std::endl;
+    // Summed over every request, so concurrent transfers can add up to more than the run took
+    if (Metrics *metrics = http_client.get_metrics()) {
+        const Metrics::Totals totals = metrics->totals();
+        if (totals.transfers > 0) {
+            auto ms = [](double seconds) { return static_cast<long long>(seconds * 1000); };
+            std::cout << "Time: " << ms(totals.dns) << " ms DNS, " << ms(totals.connect) << " ms connecting, "
+                    << ms(totals.tls) << " ms TLS, " << ms(totals.wait) << " ms waiting, " << ms(totals.receive)
+                    << " ms receiving, " << ms(totals.write) << " ms writing, " << ms(totals.parse)
+                    << " ms parsing, " << ms(totals.storage) << " ms saving manifests and archives" << std::endl;
+        }
+    }
 
-    for (size_t i = 0; i < chapters_count; ++i) {
-        const auto& chapter = chapters[i];
-        std::cout << "  [" << (i + 1) << "/" << chapters_count << "] " << chapter.name << " -> " << chapter.url << std::endl;
+    if (const MemoryBudget *memory_budget = http_client.get_memory_budget()) {
+        const MemoryBudget::Stats memory_stats = memory_budget->stats();
+        if (memory_stats.peak > 0 || memory_stats.spilled > 0) {
+            std::cout << "Memory: at most " << memory_stats.peak / 1024 << " KiB of images held at once (limit "
+                    << memory_stats.limit / 1024 << " KiB), " << memory_stats.spilled << " staged on disk"
+                    << std::endl;
+        }
+    }
 
-        std::filesystem::path chapter_folder = manga_folder / Utils::sanitizeFolderName(chapter.name);
+    if (const ImageStore *image_store = http_client.get_image_store()) {
+        const ImageStore::Stats store_stats = image_store->stats();
+        std::cout << "Image store: " << store_stats.stored << " new, " << store_stats.linked
+                << " already stored (" << store_stats.bytes_saved / (1024 * 1024) << " MiB saved)" << std::endl;
+    }
+}
+
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " [options] <manga_uri>..." << std::endl;
+    std::cerr << "Example: " << program << " https://weebcentral.com/series/01J76XYFCDK6Y8GY447DTTTZ2F" <<
+            std::endl;
+    std::cerr << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  -v, --version        Print the version and exit" << std::endl;
+    std::cerr << "  --batch <file>       Also download the series listed in a file, one URI per line" << std::endl;
+    std::cerr << "  --workers <n>        Number of chapters downloaded at the same time, shared by all series" <<
+            " (default 1)" << std::endl;
+    std::cerr << "  --concurrency <n>    Number of images downloaded at the same time (default 4)" << std::endl;
+    std::cerr << "  --per-host <n>       Number of images downloaded at the same time from one host (default 4)" <<
+            std::endl;
+    std::cerr << "  --rate <n>           Requests per second to one host, 0 for unlimited (default 4)" << std::endl;
+    std::cerr << "  --burst <n>          Requests that may start back to back to one host (default 4)" << std::endl;
+    std::cerr << "  --bandwidth <n>      Bytes per second from one host, with optional K or M suffix," << std::endl;
+    std::cerr << "                       0 for unlimited (default 0)" << std::endl;
+    std::cerr << "  --retries <n>        Times a request failing with a transient error is retried (default 4)" <<
+            std::endl;
+    std::cerr << "  --check-trailers     Also reject images that do not end like their format should, e.g. JPEG" <<
+            std::endl;
+    std::cerr << "                       images without an end of image marker" << std::endl;
+    std::cerr << "  --cache-dir <dir>    Folder for cached series and chapter list pages" << std::endl;
+    std::cerr << "                       (default .weebcentral-cache)" << std::endl;
+    std::cerr << "  --no-cache           Always download series and chapter list pages in full" << std::endl;
+    std::cerr << "  --parser <mode>      How chapter and image lists are parsed: dom, scan (faster, no document" <<
+            std::endl;
+    std::cerr << "                       tree) or verify (run both and report differences) (default dom)" << std::endl;
+    std::cerr << "  --dedup              Keep one copy of every distinct image and hard link it into the chapter" <<
+            std::endl;
+    std::cerr << "                       folders (not with --format cbz)" << std::endl;
+    std::cerr << "  --store-dir <dir>    Folder holding the single copies for --dedup (default .weebcentral-store)" <<
+            std::endl;
+    std::cerr << "  --format <format>    How chapters are written: folder (a folder of images) or cbz" << std::endl;
+    std::cerr << "                       (one uncompressed .cbz archive per chapter) (default folder)" << std::endl;
+    std::cerr << "  --memory-limit <n>   Bytes of images that may wait in memory for their turn in an archive," <<
+            std::endl;
+    std::cerr << "                       with optional K or M suffix; the rest are staged on disk (default 64M)" <<
+            std::endl;
+    std::cerr << "  --metrics <file>     Write the timings of every request and stage to a file, one JSON object" <<
+            std::endl;
+    std::cerr << "                       per line" << std::endl;
+    std::cerr << "  --trace <file>       Write a trace of the run for chrome://tracing or Perfetto" << std::endl;
+    std::cerr << "  --daemon             Keep running and sync the series on a schedule, reading the --batch" <<
+            std::endl;
+    std::cerr << "                       files again every minute" << std::endl;
+    std::cerr << "  --interval <n>       Minutes between two syncs of a series with --daemon (default 60)" <<
+            std::endl;
+    std::cerr << "  --queue-file <file>  File the --daemon schedule is kept in (default .weebcentral-queue)" <<
+            std::endl;
+    std::cerr << "  --status-socket <path>" << std::endl;
+    std::cerr << "                       Unix domain socket that reports the --daemon status" << std::endl;
+}
+
+bool parseArguments(int argc, char *argv[], Options &options) {
+    // Parses a positive (or with allow_zero, non-negative) number for an option, printing an
+    // error if it is not one
+    auto parseCount = [](const std::string &option, const char *value, std::size_t &out, bool allow_zero = false) {
+        if (value == nullptr) {
+            std::cerr << "Error: Missing value for " << option << std::endl;
+            return false;
+        }
 
         try {
-            if (!std::filesystem::create_directories(chapter_folder)) {
-                std::cout << "    Chapter folder " << chapter_folder << " exists, skipping." << std::endl;
-                continue;
+            std::size_t pos = 0;
+            unsigned long parsed = std::stoul(value, &pos);
+            if (pos != std::strlen(value) || (parsed == 0 && !allow_zero) || value[0] == '-') {
+                throw std::invalid_argument(value);
             }
-        } catch (const std::filesystem::filesystem_error &e) {
-            std::cerr << "Error: Could not create folder: " << chapter_folder << std::endl << e.what() << std::endl;
-            return 1;
+            out = parsed;
+        } catch (const std::exception &) {
+            std::cerr << "Error: Invalid value for " << option << ": " << value << std::endl;
+            return false;
         }
 
-        std::cout << "    Created chapter folder: " << chapter_folder << std::endl;
-
-        std::vector<std::string> image_uris = getChapterImageURIs(http_client, chapter.url);
+        return true;
+    };
 
-        if (image_uris.empty()) {
-            std::cerr << "    Error: Could not get image URIs for chapter: " << chapter.name << std::endl;
-            return 1;
+    // Parses a finite, non-negative rate with an optional K (1024) or M (1024 * 1024) multiplier suffix
+    auto parseRate = [](const std::string &option, const char *value, double &out) {
+        if (value == nullptr) {
+            std::cerr << "Error: Missing value for " << option << std::endl;
+            return false;
         }
 
-        const std::size_t image_uris_count = image_uris.size();
+        try {
+            std::string text = value;
+            double multiplier = 1;
+            if (!text.empty() && (text.back() == 'k' || text.back() == 'K')) {
+                multiplier = 1024;
+                text.pop_back();
+            } else if (!text.empty() && (text.back() == 'm' || text.back() == 'M')) {
+                multiplier = 1024 * 1024;
+                text.pop_back();
+            }
 
-        for (size_t j = 0; j < image_uris_count; ++j) {
-            const std::string &image_uri = image_uris[j];
-            std::string image_filename = std::filesystem::path(image_uri).filename().string();
+            std::size_t pos = 0;
+            double parsed = std::stod(text, &pos);
+            if (pos != text.size() || !std::isfinite(parsed) || parsed < 0) {
+                throw std::invalid_argument(value);
+            }
+            out = parsed * multiplier;
+        } catch (const std::exception &) {
+            std::cerr << "Error: Invalid value for " << option << ": " << value << std::endl;
+            return false;
+        }
 
-            size_t queryPos = image_filename.find('?');
-            size_t fragmentPos = image_filename.find('#');
-            size_t endPos = std::min(queryPos, fragmentPos);
+        return true;
+    };
 
-            image_filename = image_filename.substr(0, endPos);
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
 
-            std::filesystem::path image_path = chapter_folder / Utils::sanitizeFolderName(image_filename);
-            std::string image_path_string = image_path.string();
+        // Convert to lowercase for case-insensitive comparison
+        std::string arg_lower = arg;
+        std::ranges::transform(arg_lower, arg_lower.begin(),
+                               [](unsigned char c) { return std::tolower(c); });
 
-            http_client.download_image(image_uri, image_path_string);
+        const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
 
-            std::cout << "    [" << (j + 1) << "/" << image_uris_count << "] " << image_uri << " -> " << image_path_string << std::endl;
+        if (arg_lower == "-v" || arg_lower == "--version") {
+            options.show_version = true;
+            return true;
+        } else if (arg_lower == "--batch") {
+            if (value == nullptr) {
+                std::cerr << "Error: Missing value for " << arg << std::endl;
+                return false;
+            }
+            if (!readBatchFile(value, options.manga_uris)) return false;
+            options.batch_files.push_back(value);
+            ++i;
+        } else if (arg_lower == "--workers") {
+            if (!parseCount(arg, value, options.workers)) return false;
+            ++i;
+        } else if (arg_lower == "--concurrency") {
+            if (!parseCount(arg, value, options.concurrency)) return false;
+            ++i;
+        } else if (arg_lower == "--per-host") {
+            if (!parseCount(arg, value, options.per_host_concurrency)) return false;
+            ++i;
+        } else if (arg_lower == "--retries") {
+            if (!parseCount(arg, value, options.retries, true)) return false;
+            ++i;
+        } else if (arg_lower == "--rate") {
+            if (!parseRate(arg, value, options.requests_per_second)) return false;
+            ++i;
+        } else if (arg_lower == "--burst") {
+            // A whole number of requests, without the suffixes of the rates
+            std::size_t burst = 0;
+            if (!parseCount(arg, value, burst)) return false;
+            options.request_burst = static_cast<double>(burst);
+            ++i;
+        } else if (arg_lower == "--bandwidth") {
+            if (!parseRate(arg, value, options.bytes_per_second)) return false;
+            ++i;
+        } else if (arg_lower == "--check-trailers") {
+            options.check_trailers = true;
+        } else if (arg_lower == "--cache-dir") {
+            if (value == nullptr || *value == '\0') {
+                std::cerr << "Error: Missing value for " << arg << std::endl;
+                return false;
+            }
+            options.cache_dir = value;
+            ++i;
+        } else if (arg_lower == "--no-cache") {
+            options.use_cache = false;
+        } else if (arg_lower == "--parser") {
+            std::string mode = value ? value : "";
+            if (mode == "dom") {
+                options.parser = ParserMode::dom;
+            } else if (mode == "scan") {
+                options.parser = ParserMode::scan;
+            } else if (mode == "verify") {
+                options.parser = ParserMode::verify;
+            } else {
+                std::cerr << "Error: Invalid value for " << arg << ": " << mode << std::endl;
+                return false;
+            }
+            ++i;
+        } else if (arg_lower == "--base-url") {
+            // Not in the usage text: only meant for the benchmark's fixture server
+            if (value == nullptr || *value == '\0') {
+                std::cerr << "Error: Missing value for " << arg << std::endl;
+                return false;
+            }
+            options.base_url = value;
+            while (options.base_url.ends_with('/')) {
+                options.base_url.pop_back();
+            }
+            ++i;
+        } else if (arg_lower == "--metrics" || arg_lower == "--trace") {
+            if (value == nullptr || *value == '\0') {
+                std::cerr << "Error: Missing value for " << arg << std::endl;
+                return false;
+            }
+            (arg_lower == "--metrics" ? options.metrics_path : options.trace_path) = value;
+            ++i;
+        } else if (arg_lower == "--daemon") {
+            options.daemon = true;
+        } else if (arg_lower == "--interval") {
+            if (!parseCount(arg, value, options.poll_interval)) return false;
+            ++i;
+        } else if (arg_lower == "--queue-file" || arg_lower == "--status-socket") {
+            if (value == nullptr || *value == '\0') {
+                std::cerr << "Error: Missing value for " << arg << std::endl;
+                return false;
+            }
+            (arg_lower == "--queue-file" ? options.queue_path : options.status_socket) = value;
+            ++i;
+        } else if (arg_lower == "--dedup") {
+            options.dedup = true;
+        } else if (arg_lower == "--store-dir") {
+            if (value == nullptr || *value == '\0') {
+                std::cerr << "Error: Missing value for " << arg << std::endl;
+                return false;
+            }
+            options.store_dir = value;
+            ++i;
+        } else if (arg_lower == "--format") {
+            std::string format = value ? value : "";
+            if (format == "folder") {
+                options.output_format = OutputFormat::folder;
+            } else if (format == "cbz") {
+                options.output_format = OutputFormat::cbz;
+            } else {
+                std::cerr << "Error: Invalid value for " << arg << ": " << format << std::endl;
+                return false;
+            }
+            ++i;
+        } else if (arg_lower == "--memory-limit") {
+            double limit = 0;
+            if (!parseRate(arg, value, limit)) return false;
+            options.memory_limit = static_cast<std::uint64_t>(limit);
+            ++i;
+        } else if (arg.starts_with("-")) {
+            std::cerr << "Error: Unknown option: " << arg << std::endl;
+            return false;
+        } else {
+            options.manga_uris.push_back(arg);
+            options.command_line_uris.push_back(arg);
         }
+    }
+
+    // An archive holds its own copy of every image, so there would be nothing to link to the store
+    if (options.dedup && options.output_format == OutputFormat::cbz) {
+        std::cerr << "Error: --dedup cannot be used with --format cbz" << std::endl;
+        return false;
+    }
 
-        if (i < chapters_count - 1) {
-            // Sleep for 1500 milliseconds
-            std::cout << "    Sleeping for 4 seconds before downloading the next chapter" << std::endl;
-            std::this_thread::sleep_for(std::chrono::milliseconds(4000));
+    return !options.manga_uris.empty();
+}
+
+bool readWatchList(const Options &options, std::vector<std::string> &manga_uris) {
+    manga_uris = options.command_line_uris;
+
+    for (const std::string &batch_file: options.batch_files) {
+        if (!readBatchFile(batch_file, manga_uris)) {
+            return false;
         }
     }
 
-    std::cout << "\nDownload completed." << std::endl;
+    return true;
+}
+
+bool readBatchFile(const std::string &path, std::vector<std::string> &manga_uris) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Error: Could not open batch file: " << path << std::endl;
+        return false;
+    }
+
+    // One URI per line; blank lines and lines starting with # are ignored
+    std::string line;
+    while (std::getline(file, line)) {
+        auto start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
 
-    return 0;
+        auto end = line.find_last_not_of(" \t\r");
+        manga_uris.push_back(line.substr(start, end - start + 1));
+    }
+
+    return true;
 }
 
-std::string getMangaTitle(HttpClient &http_client, const std::string &manga_uri) {
-    // Download HTML
-    std::string html_content;
-    if (!http_client.download_html(manga_uri, html_content)) {
-        std::cerr << "Failed to download HTML" << std::endl;
-        return {};
+FetchResult fetchPage(HttpClient &http_client, const std::string &url, PageExtractor &extractor,
+                      PageExtractor::Page page, const std::function<bool()> &skip_if_unchanged) {
+    bool parse_failed = false;
+    auto on_begin = [&extractor, &parse_failed, page] {
+        parse_failed = !extractor.begin(page);
+        return !parse_failed;
+    };
+    auto on_chunk = [&extractor, &parse_failed](std::string_view chunk) {
+        parse_failed = !extractor.feed(chunk);
+        return !parse_failed;
+    };
+
+    // The page is parsed as it arrives rather than once the whole of it is in
+    bool not_modified = false;
+    auto download = [&] {
+        if (!http_client.download_html_stream(url, on_begin, on_chunk, &not_modified) && !parse_failed) {
+            std::cerr << "Failed to download HTML" << std::endl;
+            return false;
+        }
+        return true;
+    };
+
+    if (!download()) {
+        return FetchResult::failed;
     }
 
-    // std::cout << "Downloaded " << html_content.size() << " bytes" << std::endl;
+    bool parsed = false;
+    if (not_modified) {
+        if (skip_if_unchanged && skip_if_unchanged()) {
+            return FetchResult::unchanged;
+        }
 
-    // Parse HTML with lexbor
-    lxb_html_document_t *document = lxb_html_document_create();
-    lxb_status_t status = lxb_html_document_parse(document,
-                                                  (const lxb_char_t *) html_content.c_str(),
-                                                  html_content.length());
+        // Otherwise an unchanged page is parsed from the cached copy
+        parsed = on_begin() && http_client.get_cache()->replay_body(url, on_chunk) && extractor.finish();
+        if (!parsed) {
+            // A copy that cannot be read or parsed is dropped. Without its entry the page is asked
+            // for unconditionally and comes back in full.
+            std::cerr << "Warning: Could not use the cached copy of " << url << ", downloading it again" <<
+                    std::endl;
+            http_client.get_cache()->remove(url);
+            if (!download()) {
+                return FetchResult::failed;
+            }
+        }
+    }
 
-    if (status != LXB_STATUS_OK) {
+    if (!parsed && (parse_failed || !extractor.finish())) {
         std::cerr << "Error: Failed to parse HTML" << std::endl;
+        return FetchResult::failed;
+    }
 
-        // Clean up document
-        lxb_html_document_destroy(document);
+    if (Metrics *metrics = http_client.get_metrics()) {
+        metrics->record_stage("parse", url, extractor.last_page_time());
+    }
+
+    if (!extractor.mismatch.empty()) {
+        std::cerr << "Warning: Parsers disagree on " << url << ": " << extractor.mismatch << std::endl;
+    }
+
+    return FetchResult::parsed;
+}
 
-        return {};
+std::string getMangaTitle(HttpClient &http_client, const std::string &manga_uri, PageExtractor &extractor) {
+    HttpCache *http_cache = http_client.get_cache();
+
+    // An unchanged page has the same title as the last time it was parsed
+    std::string cached_title;
+    auto use_cached_title = [&] {
+        HttpCache::Entry cached;
+        if (http_cache && http_cache->lookup(manga_uri, cached)) {
+            cached_title = cached.annotation;
+        }
+        return !cached_title.empty();
+    };
+
+    switch (fetchPage(http_client, manga_uri, extractor, PageExtractor::Page::series, use_cached_title)) {
+        case FetchResult::failed:
+            return {};
+        case FetchResult::unchanged:
+            return cached_title;
+        case FetchResult::parsed:
+            break;
     }
 
-    // Parse manga title
-    std::string manga_title = Utils::parseMangaTitle(document);
+    std::string manga_title(extractor.title);
 
-    // Clean up document
-    lxb_html_document_destroy(document);
+    if (http_cache && !manga_title.empty()) {
+        http_cache->annotate(manga_uri, manga_title);
+    }
 
     return manga_title;
 }
@@ -214,77 +798,34 @@ bool createMangaDirectory(const std::string &manga_title, std::filesystem::path
     return true;
 }
 
-std::vector<Chapter> getChapters(HttpClient &http_client, const std::string &series_id) {
+ChapterTable getChapters(HttpClient &http_client, const std::string &base_url, const std::string &series_id,
+                         PageExtractor &extractor, const std::string &synced_validator, std::string &list_validator,
+                         bool &up_to_date) {
+    up_to_date = false;
+
     // Build full chapter list URL
-    std::string chapter_list_url = "https://weebcentral.com/series/" + series_id + "/full-chapter-list";
+    std::string chapter_list_url = base_url + "/series/" + series_id + "/full-chapter-list";
     std::cout << "Chapter list URL: " << chapter_list_url << std::endl;
 
-    // Download HTML
-    std::string html_content;
-    if (!http_client.download_html(chapter_list_url, html_content)) {
-        std::cerr << "Failed to download HTML" << std::endl;
-        return {};
-    }
-
-    // std::cout << "Downloaded " << html_content.size() << " bytes" << std::endl;
-
-    // Parse chapter list HTML
-    lxb_html_document_t *document = lxb_html_document_create();
-    lxb_status_t status = lxb_html_document_parse(document,
-                                                  (const lxb_char_t *) html_content.c_str(),
-                                                  html_content.length());
-
-
-    if (status != LXB_STATUS_OK) {
-        std::cerr << "Error: Failed to parse chapter list HTML" << std::endl;
-
-        // Clean up document
-        lxb_html_document_destroy(document);
-
-        return {};
-    }
-
-    // Parse chapter names and URLs
-    std::vector<Chapter> chapters = Utils::parseChapterList(document);
-
-    // Clean up document
-    lxb_html_document_destroy(document);
-
-    return chapters;
-}
-
-std::vector<std::string> getChapterImageURIs(HttpClient &http_client, const std::string &chapter_uri) {
-    std::string images_uri = "https://weebcentral.com" + chapter_uri + "/images?is_prev=False&current_page=1&reading_style=long_strip";
-
-    // Download HTML
-    std::string html_content;
-    if (!http_client.download_html(images_uri, html_content)) {
-        std::cerr << "Failed to download HTML" << std::endl;
-        return {};
-    }
-
-    // std::cout << "Downloaded " << html_content.size() << " bytes" << std::endl;
-
-    // Parse chapter images list HTML
-    lxb_html_document_t *document = lxb_html_document_create();
-    lxb_status_t status = lxb_html_document_parse(document,
-                                                  (const lxb_char_t *) html_content.c_str(),
-                                                  html_content.length());
-
-    if (status != LXB_STATUS_OK) {
-        std::cerr << "Error: Failed to parse chapter images list HTML" << std::endl;
-
-        // Clean up document
-        lxb_html_document_destroy(document);
-
-        return {};
+    // Every chapter of an unchanged list was downloaded before, so there is nothing to parse
+    HttpCache *http_cache = http_client.get_cache();
+    auto is_synced = [&] {
+        list_validator = http_cache->validator(chapter_list_url);
+        return !list_validator.empty() && list_validator == synced_validator;
+    };
+
+    switch (fetchPage(http_client, chapter_list_url, extractor, PageExtractor::Page::chapter_list, is_synced)) {
+        case FetchResult::failed:
+            return {};
+        case FetchResult::unchanged:
+            up_to_date = true;
+            return {};
+        case FetchResult::parsed:
+            break;
     }
 
-    // Parse chapter image URIs
-    std::vector<std::string> image_uris = Utils::parseChapterImageURIs(document);
-
-    // Clean up document
-    lxb_html_document_destroy(document);
+    list_validator = http_cache ? http_cache->validator(chapter_list_url) : std::string();
 
-    return image_uris;
+    // The extractor's table is reused for the next page; the copy is sized to this list alone
+    return extractor.chapters;
 }
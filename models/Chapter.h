@@ -5,12 +5,13 @@
 #ifndef WEEBCENTRAL_DOWNLOAD_CHAPTER_H
 #define WEEBCENTRAL_DOWNLOAD_CHAPTER_H
 
-#include <string>
+#include <string_view>
 
-// Structure to hold chapter information
+// Structure to hold chapter information. The strings are owned by the ChapterTable the
+// chapter was read from.
 struct Chapter {
-    std::string name;
-    std::string url;
+    std::string_view name;
+    std::string_view url;
 };
 
-#endif //WEEBCENTRAL_DOWNLOAD_CHAPTER_H
\ No newline at end of file
+#endif //WEEBCENTRAL_DOWNLOAD_CHAPTER_H
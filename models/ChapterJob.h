@@ -0,0 +1,40 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_CHAPTERJOB_H
+#define WEEBCENTRAL_DOWNLOAD_CHAPTERJOB_H
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "Chapter.h"
+#include "ChapterManifest.h"
+#include "ImageDownload.h"
+
+// Structure to hold a chapter as it moves through the download pipeline
+struct ChapterJob {
+    std::size_t series_index = 0; // Position of the chapter's series in the batch
+    std::size_t index = 0; // Position of the chapter in its series' chapter list
+    Chapter chapter; // Views the chapter table of its series, which outlives the pipeline run
+    std::filesystem::path folder;
+    std::filesystem::path archive; // The chapter's .cbz when chapters are written as archives, otherwise empty
+
+    bool skipped = false; // The chapter is already complete
+    bool resumed = false; // An interrupted download is continued from the chapter's manifest
+    bool adopted = false; // The folder predates manifests; its files are checked against the image list
+    std::string error; // Set by the stage that failed; the job is then only passed along
+
+    // Expected images: their URLs are filled by the list fetch stage and their filenames by the
+    // parse stage, or the whole manifest is loaded for a resume
+    ChapterManifest manifest;
+
+    std::vector<ImageDownload> downloads; // Images still missing, filled by the image download stage
+    std::vector<std::size_t> download_images; // Index into manifest.images of each entry in downloads
+    bool images_success = false; // Set by the image download stage
+    std::size_t corrupt_images = 0; // Images that kept failing the image check, counted by the image download stage
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_CHAPTERJOB_H
@@ -0,0 +1,27 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_CHAPTERMANIFEST_H
+#define WEEBCENTRAL_DOWNLOAD_CHAPTERMANIFEST_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Structure to hold one image of a chapter manifest
+struct ManifestImage {
+    std::string url;
+    std::string filename; // Sanitized file name inside the chapter folder
+    std::uintmax_t size = 0; // Size of the file on disk, recorded once downloaded
+    bool done = false;
+    bool corrupt = false; // The last download gave up on an invalid image; it is tried again next run
+};
+
+// Structure to hold the expected images of a chapter and how far the download got
+struct ChapterManifest {
+    std::vector<ManifestImage> images;
+    bool complete = false; // Every image was downloaded
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_CHAPTERMANIFEST_H
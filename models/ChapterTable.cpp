@@ -0,0 +1,80 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#include "ChapterTable.h"
+
+#include <algorithm>
+#include <utility>
+
+Chapter ChapterTable::operator[](std::size_t index) const {
+    const Record &record = records[index];
+    const char *url = text.data() + record.url_offset;
+    return {std::string_view(url + record.url_length, record.name_length), std::string_view(url, record.url_length)};
+}
+
+void ChapterTable::clear() {
+    text.clear();
+    records.clear();
+    building = false;
+}
+
+void ChapterTable::reserve(std::size_t chapters, std::size_t text_size) {
+    records.reserve(chapters);
+    text.reserve(text_size);
+}
+
+void ChapterTable::push_back(std::string_view name, std::string_view url) {
+    begin_chapter(url);
+    append_name(name);
+    end_chapter();
+}
+
+void ChapterTable::begin_chapter(std::string_view url) {
+    // A chapter that was never ended is dropped
+    if (building) {
+        text.resize(pending.url_offset);
+    }
+
+    building = true;
+    pending = {static_cast<std::uint32_t>(text.size()), static_cast<std::uint32_t>(url.size()), 0};
+    text.append(url);
+}
+
+void ChapterTable::append_name(std::string_view piece) {
+    if (!building) {
+        return;
+    }
+
+    text.append(piece);
+    pending.name_length += static_cast<std::uint32_t>(piece.size());
+}
+
+void ChapterTable::end_chapter() {
+    if (!building) {
+        return;
+    }
+
+    building = false;
+    if (pending.name_length == 0) {
+        text.resize(pending.url_offset);
+        return;
+    }
+
+    records.push_back(pending);
+}
+
+void ChapterTable::reverse() {
+    std::ranges::reverse(records);
+}
+
+void ChapterTable::swap(ChapterTable &other) noexcept {
+    text.swap(other.text);
+    records.swap(other.records);
+    std::swap(building, other.building);
+    std::swap(pending, other.pending);
+}
+
+std::size_t ChapterTable::memory_usage() const {
+    return text.capacity() + records.capacity() * sizeof(Record);
+}
@@ -0,0 +1,150 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_CHAPTERTABLE_H
+#define WEEBCENTRAL_DOWNLOAD_CHAPTERTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Chapter.h"
+
+/**
+ * Holds a chapter list compactly: the URLs and names of all chapters back to back in one
+ * string, and a small fixed-size record per chapter pointing into it.
+ *
+ * Chapters are handed out as Chapter values whose views point into the table. They stay valid
+ * until the table is changed, moved from or destroyed. Copying a table copies two buffers no
+ * matter how many chapters it holds, and clear keeps both for reuse.
+ */
+class ChapterTable {
+public:
+    class const_iterator {
+    public:
+        using value_type = Chapter;
+        using difference_type = std::ptrdiff_t;
+
+        const_iterator() = default;
+
+        Chapter operator*() const {
+            return (*table)[index];
+        }
+
+        const_iterator &operator++() {
+            ++index;
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator previous = *this;
+            ++index;
+            return previous;
+        }
+
+        bool operator==(const const_iterator &) const = default;
+
+    private:
+        friend class ChapterTable;
+
+        const ChapterTable *table = nullptr;
+        std::size_t index = 0;
+
+        const_iterator(const ChapterTable *table, std::size_t index) : table(table), index(index) {
+        }
+    };
+
+    std::size_t size() const {
+        return records.size();
+    }
+
+    bool empty() const {
+        return records.empty();
+    }
+
+    Chapter operator[](std::size_t index) const;
+
+    const_iterator begin() const {
+        return {this, 0};
+    }
+
+    const_iterator end() const {
+        return {this, records.size()};
+    }
+
+    /**
+     * Removes every chapter, keeping the buffers for reuse.
+     */
+    void clear();
+
+    /**
+     * Makes room for more chapters before they are added.
+     *
+     * @param chapters How many chapters the table will hold.
+     * @param text_size How many bytes their names and URLs will take up together.
+     */
+    void reserve(std::size_t chapters, std::size_t text_size);
+
+    /**
+     * Adds a chapter after the last one.
+     *
+     * @param name The chapter name.
+     * @param url The chapter URL.
+     */
+    void push_back(std::string_view name, std::string_view url);
+
+    /**
+     * Starts adding a chapter whose name arrives in pieces. It is only added to the table once
+     * end_chapter is called, and not at all if it ends up without a name.
+     *
+     * @param url The chapter URL.
+     */
+    void begin_chapter(std::string_view url);
+
+    /**
+     * Appends to the name of the chapter started with begin_chapter.
+     *
+     * @param piece The next piece of the name.
+     */
+    void append_name(std::string_view piece);
+
+    /**
+     * Completes the chapter started with begin_chapter.
+     */
+    void end_chapter();
+
+    /**
+     * Reverses the order of the chapters. Only the records move; the text stays in place.
+     */
+    void reverse();
+
+    /**
+     * Exchanges the chapters and buffers of two tables without copying either.
+     */
+    void swap(ChapterTable &other) noexcept;
+
+    /**
+     * Returns the number of bytes held by the table's buffers.
+     */
+    std::size_t memory_usage() const;
+
+private:
+    // A chapter's name directly follows its URL in text. 32 bits are plenty for the chapter
+    // list of a single series and keep a record at 12 bytes.
+    struct Record {
+        std::uint32_t url_offset = 0;
+        std::uint32_t url_length = 0;
+        std::uint32_t name_length = 0;
+    };
+
+    std::string text;
+    std::vector<Record> records;
+
+    bool building = false; // A chapter was started with begin_chapter and not yet ended
+    Record pending;
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_CHAPTERTABLE_H
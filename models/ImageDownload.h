@@ -0,0 +1,28 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_IMAGEDOWNLOAD_H
+#define WEEBCENTRAL_DOWNLOAD_IMAGEDOWNLOAD_H
+
+#include <string>
+
+// Structure to hold a single image transfer of a chapter
+struct ImageDownload {
+    std::string url;
+    std::string output_path;
+    bool success = false;
+    std::string problem; // Why the last attempt was not a valid image, empty if it was
+
+    // Keep the image in body instead of writing it to output_path. Cleared by the download if
+    // the body did not fit the memory budget and was written to output_path after all.
+    bool in_memory = false;
+    std::string body;
+    std::string validator; // ETag or Last-Modified that a partial body was received under
+
+    // output_path only stages the image until it is copied into an archive, so it is never
+    // adopted into the image store
+    bool staged = false;
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_IMAGEDOWNLOAD_H
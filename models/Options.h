@@ -0,0 +1,94 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_OPTIONS_H
+#define WEEBCENTRAL_DOWNLOAD_OPTIONS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// How pages are turned into chapter and image lists
+enum class ParserMode {
+    dom, // Build a lexbor document and query it
+    scan, // Scan the tags without building a document
+    verify // Run both and report any difference, using the result of the document
+};
+
+// How each chapter is written to disk
+enum class OutputFormat {
+    folder, // A folder of image files
+    cbz // A .cbz archive next to where the folder would be
+};
+
+// Structure to hold the command line options
+struct Options {
+    std::vector<std::string> manga_uris; // From the command line and --batch files
+
+    // Where manga_uris came from, so the daemon can read the batch files again while it runs
+    std::vector<std::string> command_line_uris;
+    std::vector<std::string> batch_files;
+    bool show_version = false;
+
+    // Number of chapters downloading their images at the same time, shared by all series
+    std::size_t workers = 1;
+
+    // Maximum number of image transfers in flight for a chapter
+    std::size_t concurrency = 4;
+
+    // Maximum number of image transfers in flight to a single host
+    std::size_t per_host_concurrency = 4;
+
+    // Requests started per second to a single host (0 means unlimited)
+    double requests_per_second = 4;
+
+    // Requests that may start back to back to a single host after it was idle
+    double request_burst = 4;
+
+    // Bytes received per second from a single host (0 means unlimited)
+    double bytes_per_second = 0;
+
+    // How many times a request that failed with a transient error is attempted again
+    std::size_t retries = 4;
+
+    // Also require every image to end with the trailer of its format
+    bool check_trailers = false;
+
+    // Folder holding cached series and chapter list pages for conditional requests
+    std::string cache_dir = ".weebcentral-cache";
+    bool use_cache = true;
+
+    ParserMode parser = ParserMode::dom;
+
+    // Folder keeping one copy of every distinct image, linked into the chapter folders
+    std::string store_dir = ".weebcentral-store";
+    bool dedup = false;
+
+    OutputFormat output_format = OutputFormat::folder;
+
+    // Bytes of images that may wait in memory to be written to their archive; the rest are
+    // staged on disk
+    std::uint64_t memory_limit = 64 * 1024 * 1024;
+
+    // Files the per-request and per-stage timings are written to, empty for none
+    std::string metrics_path;
+    std::string trace_path;
+
+    // Keep running and sync the series on a schedule
+    bool daemon = false;
+
+    // Minutes between two syncs of a series in daemon mode
+    std::size_t poll_interval = 60;
+
+    // File the daemon keeps its schedule in, so a restart continues where it left off
+    std::string queue_path = ".weebcentral-queue";
+
+    // Unix domain socket the daemon reports its status on, empty for none
+    std::string status_socket;
+
+    // Origin every request to the site goes to; only changed to run against a local fixture server
+    std::string base_url = "https://weebcentral.com";
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_OPTIONS_H
@@ -0,0 +1,28 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_SERIES_H
+#define WEEBCENTRAL_DOWNLOAD_SERIES_H
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "ChapterTable.h"
+#include "SeriesIndex.h"
+
+// Structure to hold a series and its chapter list
+struct Series {
+    std::string uri;
+    std::string id;
+    std::string title;
+    std::filesystem::path folder;
+    ChapterTable chapters;
+
+    SeriesIndex index; // Chapters seen by earlier runs
+    std::string list_validator; // Cache validator of the chapter list the chapters were read from
+    std::vector<std::size_t> pending_chapters; // Index into chapters of those that are new or incomplete
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_SERIES_H
@@ -0,0 +1,37 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_SERIESINDEX_H
+#define WEEBCENTRAL_DOWNLOAD_SERIESINDEX_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Structure to hold what is known locally about one chapter of a series
+struct IndexedChapter {
+    std::string name;
+    bool complete = false;
+    bool corrupt = false; // Some of its images kept arriving corrupt the last time it was downloaded
+};
+
+// Hash that lets the index be searched with a string_view, such as a chapter ID viewed in its URL
+struct ChapterIdHash {
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view id) const {
+        return std::hash<std::string_view>{}(id);
+    }
+};
+
+// Structure to hold the chapters of a series that were seen before, keyed by chapter ID
+struct SeriesIndex {
+    std::unordered_map<std::string, IndexedChapter, ChapterIdHash, std::equal_to<>> chapters;
+
+    // Cache validator of the chapter list page the last time every chapter on it was downloaded
+    std::string synced_validator;
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_SERIESINDEX_H
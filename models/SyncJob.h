@@ -0,0 +1,20 @@
+//
+// Created by reikooters on 16/10/26.
+//
+
+#ifndef WEEBCENTRAL_DOWNLOAD_SYNCJOB_H
+#define WEEBCENTRAL_DOWNLOAD_SYNCJOB_H
+
+#include <cstdint>
+#include <string>
+
+// Structure to hold the schedule of one watched series in the daemon's job queue
+struct SyncJob {
+    std::string uri;
+    std::int64_t next_run = 0; // Unix time at which the series is synced next, 0 for right away
+    std::int64_t last_run = 0; // Unix time at which the last sync finished, 0 if there was none
+    bool running = false; // A sync had started and not finished when the queue was saved
+    unsigned failures = 0; // Syncs in a row that ended with an error
+};
+
+#endif //WEEBCENTRAL_DOWNLOAD_SYNCJOB_H